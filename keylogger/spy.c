@@ -24,12 +24,13 @@ void flush(void *p);
 void maccess(void *p);
 int flush_reload_t(void *ptr);
 
+// Same fencing as TIMER_RDTSCP in src/timing.c, so timings compare
 u64 fenced_rdtsc(void) {
   u64 a, d;
   asm volatile("mfence");
   asm volatile("rdtscp" : "=a"(a), "=d"(d)::"rcx");
   a = (d << 32) | a;
-  asm volatile("mfence");
+  asm volatile("lfence");
   return a;
 }
 
@@ -32,6 +32,19 @@ typedef struct {
   unsigned int present : 1;
 } PagemapEntry;
 
+/* Decode a raw 64-bit pagemap entry.
+ *
+ * @param[out] entry the parsed entry
+ * @param[in]  data  the entry as read from /proc/pid/pagemap
+ */
+void pagemap_parse_entry(PagemapEntry *entry, uint64_t data) {
+  entry->pfn = data & (((uint64_t)1 << 54) - 1);
+  entry->soft_dirty = (data >> 54) & 1;
+  entry->file_page = (data >> 61) & 1;
+  entry->swapped = (data >> 62) & 1;
+  entry->present = (data >> 63) & 1;
+}
+
 /* Parse the pagemap entry for the given virtual address.
  *
  * @param[out] entry      the parsed entry
@@ -55,11 +68,7 @@ int pagemap_get_entry(PagemapEntry *entry, int pagemap_fd, uintptr_t vaddr) {
       return 1;
     }
   }
-  entry->pfn = data & (((uint64_t)1 << 54) - 1);
-  entry->soft_dirty = (data >> 54) & 1;
-  entry->file_page = (data >> 61) & 1;
-  entry->swapped = (data >> 62) & 1;
-  entry->present = (data >> 63) & 1;
+  pagemap_parse_entry(entry, data);
   return 0;
 }
 
@@ -82,6 +91,7 @@ int virt_to_phys_user(uintptr_t *paddr, pid_t pid, uintptr_t vaddr) {
   }
   PagemapEntry entry;
   if (pagemap_get_entry(&entry, pagemap_fd, vaddr)) {
+    close(pagemap_fd);
     return 1;
   }
   close(pagemap_fd);
@@ -0,0 +1,80 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "eviction.h"
+#include "geometry.h"
+
+#ifndef ATLAS_H
+#define ATLAS_H
+
+/*********************************************************************
+ * Eviction Set Atlas
+ *
+ * Minimal eviction sets for every (set index, slice) pair of the LLC. The
+ * slices of one base set index are found by reduction over hugepage lines.
+ * Because the set index lies in the hugepage offset, rewriting the set index
+ * bits of those lines gives candidate sets for every other index. The rewrite
+ * XORs the same bits into every line, so a linear slice hash keeps congruent
+ * lines congruent even where it reads set index bits. The derived sets are
+ * then verified by timing, in parallel across set indices (different set
+ * indices never evict each other), and the set indices whose slice grouping
+ * changed, which takes a non-linear hash or noise, are rebuilt by reduction.
+ *********************************************************************/
+
+// Candidate lines per set index, as a multiple of slices * (ways + 1)
+#define ATLAS_OVERSUBSCRIPTION 3
+
+// evict_and_time repetitions to accept an eviction set or a congruent line
+#define ATLAS_VERIFY_REPS 5
+
+typedef enum {
+  ATLAS_MISSING,
+  // Rewritten from the base set index, not verified yet
+  ATLAS_DERIVED,
+  ATLAS_VERIFIED,
+  // Derived set that did not evict its victim
+  ATLAS_FAILED,
+  // Found by reduction after derivation failed
+  ATLAS_REBUILT,
+  NUM_ATLAS_STATES
+} AtlasState;
+
+// A minimal eviction set and a line congruent with it that it evicts. Slice
+// numbers are the order in which the base set index's slices were found, not
+// the hardware slice ids.
+typedef struct {
+  CacheLineSet *lines;
+  CacheLine *victim;
+  AtlasState state;
+} AtlasEntry;
+
+typedef struct {
+  CacheGeometry *geometry;
+  HugepagePool *pool;
+  uint64_t threshold;
+  int sets;
+  int slices;
+  int base_set;
+  // sets * slices entries, slice-major within each set index
+  AtlasEntry *entries;
+  // Wall time of the base reduction (or of loading from a cache file),
+  // derivation, verification and rebuilds
+  double seconds[4];
+} EvictionAtlas;
+
+const char *atlas_state_name(AtlasState state);
+AtlasEntry *atlas_entry(EvictionAtlas *atlas, int set, int slice);
+double seconds_since(struct timespec *start);
+EvictionAtlas *new_eviction_atlas(CacheGeometry *geometry, int base_set);
+int discover_atlas_set(EvictionAtlas *atlas, int set, AtlasState state);
+void derive_atlas_set(EvictionAtlas *atlas, int set);
+void verify_eviction_atlas(EvictionAtlas *atlas, int threads);
+int rebuild_eviction_atlas(EvictionAtlas *atlas);
+void fill_eviction_atlas(EvictionAtlas *atlas, int threads);
+EvictionAtlas *build_eviction_atlas(CacheGeometry *geometry, int base_set,
+                                    int threads);
+void print_atlas_coverage(EvictionAtlas *atlas);
+void free_eviction_atlas(EvictionAtlas *atlas);
+
+#endif
@@ -0,0 +1,56 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "atlas.h"
+#include "geometry.h"
+
+#ifndef ATLAS_CACHE_H
+#define ATLAS_CACHE_H
+
+/*********************************************************************
+ * Eviction Atlas Cache
+ *
+ * Saves an EvictionAtlas to disk so later runs can skip building it. Lines are
+ * stored as offsets into the atlas's hugepage pool, together with the
+ * physical address of each hugepage. Loading maps a new pool and moves each
+ * saved hugepage onto the new hugepage with the same physical address, if
+ * there is one. Entries whose lines all land on such hugepages are restored
+ * as they were. The others keep their offsets, and so their set index, and
+ * are verified by timing; set indices that fail are rebuilt by reduction.
+ *********************************************************************/
+
+#define ATLAS_CACHE_MAGIC "EVATLAS"
+#define ATLAS_CACHE_VERSION 1
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  // geometry_fingerprint of the machine and geometry the atlas was built for
+  uint64_t fingerprint;
+  char cpu[64];
+  uint64_t threshold;
+  // Seconds since the epoch
+  int64_t created;
+  int32_t sets;
+  int32_t slices;
+  int32_t base_set;
+  uint64_t pool_bytes;
+  // Followed by the physical address of each hugepage, or (uint64_t)-1
+  uint32_t hugepages;
+} AtlasCacheHeader;
+
+// Followed by size line offsets
+typedef struct {
+  uint32_t state;
+  uint32_t size;
+  uint64_t victim;
+} AtlasCacheEntry;
+
+bool save_eviction_atlas(EvictionAtlas *atlas, const char *path);
+EvictionAtlas *load_eviction_atlas(const char *path, CacheGeometry *geometry,
+                                   int threads);
+EvictionAtlas *cached_eviction_atlas(const char *path,
+                                     CacheGeometry *geometry, int base_set,
+                                     int threads);
+
+#endif
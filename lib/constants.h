@@ -8,11 +8,6 @@
 #define HUGE_PAGE_OFFSET_BITS 21
 #define HUGE_PAGE_BYTES (1 << HUGE_PAGE_OFFSET_BITS)
 #define KBD_KEYCODE_ADDR 0x656920106b20
-/*********************************************************************
- * Machine Constants
- *********************************************************************/
-#define ACADIA 0
-#define EVERGLADES 1
 /*********************************************************************
  * Acadia (Coffee Lake i7-9750H) Constants
  *********************************************************************/
@@ -36,4 +31,6 @@
  * Prime+Probe
  *********************************************************************/
 #define WAIT_INTERVAL 10000
+// Probes in one prime_probe window, about 1 s on Sandy Bridge
+#define PROBES_PER_WINDOW (1024 * 1024)
 #define BITS_PER_BYTE 8
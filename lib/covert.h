@@ -0,0 +1,124 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "eviction.h"
+#include "utils.h"
+
+#ifndef COVERT_H
+#define COVERT_H
+
+/*********************************************************************
+ * Covert Channel
+ *
+ * A sender process transmits frames to a receiver process through one LLC
+ * set. Each symbol lasts symbol_cycles: for a 1 the sender loads a line of the
+ * set over and over, and for a 0 it waits. The receiver probes an eviction
+ * set for the line and records the time and outcome of every probe.
+ *
+ * A frame is COVERT_PREAMBLE_BITS alternating bits starting with 1, the
+ * 16-bit COVERT_SYNC_WORD, then a sequence number, COVERT_PAYLOAD_BYTES of
+ * payload and a CRC-16/CCITT of both. With fec, everything after the sync
+ * word is sent as Hamming(7,4) codewords, which correct one flipped bit in
+ * every 7. Bytes are sent least significant bit first.
+ *
+ * The receiver recovers the symbol clock by correlating the hit rate of the
+ * probes with the preamble and sync word at every offset, in steps of
+ * symbol_cycles / COVERT_PHASE_STEPS, and decides each following symbol
+ * against the midpoint of the hit rates of the preamble's ones and zeros.
+ *
+ * Both processes read the same TSC, so they agree on time without talking.
+ * Time is split into epochs of COVERT_EPOCH_CYCLES: the sender sends as many
+ * frames as fit in each epoch, and the receiver listens for whole epochs. In
+ * a sweep, epoch e uses covert_sweep_cycles[e % COVERT_SWEEP_STEPS] as the
+ * symbol period on both sides. Every frame carries the same known payload, so
+ * the receiver can count bit errors as well as frames that pass the CRC.
+ *********************************************************************/
+
+// Set index the sender's line and the receiver's eviction sets share
+#define COVERT_SET 428
+
+#define COVERT_SYMBOL_CYCLES 20000
+#define COVERT_PREAMBLE_BITS 16
+#define COVERT_SYNC_WORD 0xD391
+#define COVERT_PAYLOAD_BYTES 32
+// Seed of the xorshift generator that fills the known payload
+#define COVERT_PAYLOAD_SEED 0x9E3779B97F4A7C15ULL
+// Sequence number, payload and CRC
+#define COVERT_FRAME_BYTES (1 + COVERT_PAYLOAD_BYTES + 2)
+// Symbols on the wire for the longest frame, sent with fec
+#define COVERT_MAX_FRAME_BITS                                                 \
+  (COVERT_PREAMBLE_BITS + 16 + COVERT_FRAME_BYTES * 8 / 4 * 7)
+
+// Offsets tried per symbol when recovering the clock
+#define COVERT_PHASE_STEPS 8
+// Symbols past the first offset that correlates well enough that the best
+// offset is searched for, which covers the offsets a couple of symbols early
+// that match most of the preamble
+#define COVERT_REFINE_SYMBOLS 4
+// Smallest correlation with the preamble and sync word that starts a frame.
+// Over its 32 symbols, noise alone correlates with a standard deviation of
+// about 0.18.
+#define COVERT_MIN_CORRELATION 0.7
+
+// About a third of a second at 3 GHz
+#define COVERT_EPOCH_CYCLES (1ULL << 30)
+// Epochs the receiver listens to outside a sweep
+#define COVERT_EPOCHS 4
+// Cycles the receiver probes each slice for when looking for the sender
+#define COVERT_SEARCH_CYCLES (COVERT_EPOCH_CYCLES / 8)
+
+#define COVERT_SWEEP_STEPS 6
+extern uint64_t covert_sweep_cycles[COVERT_SWEEP_STEPS];
+
+typedef struct {
+  uint64_t symbol_cycles;
+  bool fec;
+} CovertConfig;
+
+typedef struct {
+  // Time each probe ended, and the hits among the probes before each one, so
+  // that hits[j] - hits[i] counts the hits of probes i to j - 1
+  NumList *times;
+  NumList *hits;
+} CovertRecording;
+
+typedef struct {
+  uint64_t frames;
+  // Frames that passed the CRC
+  uint64_t good_frames;
+  // Payload bits of every frame found, and how many were wrong
+  uint64_t bits;
+  uint64_t bit_errors;
+  uint64_t cycles;
+} CovertStats;
+
+uint16_t crc16_ccitt(uint8_t *bytes, int length);
+void covert_test_payload(uint8_t *payload);
+uint64_t covert_epoch_symbol_cycles(uint64_t epoch, uint64_t symbol_cycles,
+                                    bool sweep);
+
+int covert_encode_frame(CovertConfig *config, uint8_t sequence,
+                        uint8_t *payload, uint8_t *symbols);
+void covert_send(uint8_t *target, CovertConfig *config, uint8_t *symbols,
+                 int length, uint64_t start);
+void covert_send_epochs(uint8_t *target, uint64_t symbol_cycles, bool fec,
+                        bool sweep);
+
+CovertRecording *new_covert_recording(void);
+void clear_covert_recording(CovertRecording *recording);
+void free_covert_recording(CovertRecording *recording);
+void covert_listen(EvictionSet *es, int threshold, uint64_t until,
+                   CovertRecording *recording);
+double covert_hit_rate(CovertRecording *recording, uint64_t from,
+                       uint64_t to);
+void covert_decode(CovertRecording *recording, CovertConfig *config,
+                   CovertStats *stats);
+void print_covert_stats(CovertConfig *config, CovertStats *stats,
+                        double tsc_hz);
+int covert_find_sender(EvictionSet **es_list, int count, int threshold);
+void covert_receive_epochs(EvictionSet *es, int threshold,
+                           uint64_t symbol_cycles, bool fec, bool sweep);
+bool parse_covert_args(int argc, char **argv, uint64_t *symbol_cycles,
+                       bool *fec, bool *sweep);
+
+#endif
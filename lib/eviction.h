@@ -2,6 +2,12 @@
 #include <stdint.h>
 #include <time.h>
 
+#include "geometry.h"
+#include "histogram.h"
+#include "pagemap.h"
+#include "pipeline.h"
+#include "slice.h"
+#include "timing.h"
 #include "utils.h"
 
 #ifndef EVICTION_H
@@ -23,6 +29,39 @@
 // Number of bins used when reducing with reduce2
 #define BINS 64
 
+// Histogram bins used by estimate_threshold, spanning twice the median miss
+#define THRESHOLD_BINS 256
+
+// Separation margin below which a threshold estimate is repeated, and how many
+// estimates to make before settling for the best one
+#define THRESHOLD_MIN_MARGIN 2.0
+#define THRESHOLD_RETRIES 5
+
+// How many times reduce_group_testing may put back a removed group before
+// giving up
+#define GROUP_TESTING_BACKTRACKS 20
+
+// Per-sample eviction probabilities of a non-eviction set and an eviction set,
+// tested against each other by is_eviction_set
+#define SPRT_P0 0.2
+#define SPRT_P1 0.8
+
+// Confidence used by the reductions when sequential_tests is set
+#define SPRT_CONFIDENCE 0.999
+
+// Most samples is_eviction_set takes before deciding anyway
+#define SPRT_MAX_SAMPLES (5 * SAMPLES)
+
+// Number of pages reserved by the default candidate arena
+#define ARENA_PAGES (4 * INITIAL_SIZE)
+
+// Default memory budget for inflate when called with a max_size of 0
+#define INFLATE_BUDGET ((size_t)ARENA_PAGES * PAGE_BYTES)
+
+// inflate bisects the evicting set down to within 1/INFLATE_RESOLUTION of the
+// smallest evicting prefix
+#define INFLATE_RESOLUTION 16
+
 // Slicing of the last-level cache on 6-core Coffee Lake
 #define HIGH_MARK 9 / 10
 #define LOW_MARK 1 / 10
@@ -35,14 +74,35 @@
  * Address Translation
  *********************************************************************/
 
+// Reader used by pointer_to_pa and cl_set_to_pas, opened on first use. Call
+// pagemap_invalidate(_all) on it when pages may have been remapped.
+extern PagemapReader *pagemap_reader;
+
+bool open_pagemap_reader(void);
 uintptr_t pointer_to_pa(void *va);
-int pa_to_set(uintptr_t pa, int machine);
+bool pa_available(uintptr_t pa);
+int pa_to_set(uintptr_t pa, CacheGeometry *geometry);
 
 /*********************************************************************
  * Timing
  *********************************************************************/
 
+// A cut between cache hits and misses. margin is the distance between the
+// means of the two classes over the sum of their standard deviations, and
+// error is the fraction of the timings the cut misclassifies.
+typedef struct {
+  uint64_t threshold;
+  double margin;
+  double error;
+} ThresholdEstimate;
+
 uint64_t time_load(volatile uint8_t *victim);
+ThresholdEstimate estimate_threshold(NumList *hits, NumList *misses);
+ThresholdEstimate estimate_flush_threshold(uint8_t *victim, int samples);
+void keep_best_estimate(ThresholdEstimate *best, ThresholdEstimate estimate,
+                        int attempt);
+void report_threshold(ThresholdEstimate estimate, int attempts,
+                      const char *method);
 uint64_t threshold_from_flush(uint8_t *victim);
 
 /*********************************************************************
@@ -57,20 +117,79 @@ struct CacheLine {
   CacheLine *previous;
 };
 
+// A CacheLineSet is a growable array of CacheLine pointers. capacity tracks
+// the allocated length so pushes only reallocate when the array is full.
 typedef struct {
   CacheLine **cache_lines;
   int size;
+  int capacity;
 } CacheLineSet;
 
+// A CandidateArena hands out candidate pages from a single mmap'd region.
+// Released pages go on a free stack and are handed out again before any
+// untouched page, so retries reuse pages that are already faulted in.
+typedef struct {
+  uint8_t *start;
+  int num_pages;
+  int next_page;
+  int *free_pages;
+  int free_count;
+} CandidateArena;
+
+// Arena used by allocate_cache_line. Created on first use if NULL.
+extern CandidateArena *candidate_arena;
+
+// When set, allocate_cache_line takes pages prepared by this pipeline's helper
+// thread instead of using candidate_arena
+extern CandidatePipeline *candidate_pipeline;
+
+CandidateArena *new_candidate_arena(int num_pages, bool populate);
+void free_candidate_arena(CandidateArena *arena);
+void reset_candidate_arena(CandidateArena *arena);
+bool arena_contains(CandidateArena *arena, void *va);
+CacheLine *arena_allocate_line(CandidateArena *arena, uint8_t *victim);
+void arena_release_line(CandidateArena *arena, CacheLine *cl);
+
+// A HugepagePool is a hugepage mapping that candidates sharing the full set
+// index of a victim are taken from, instead of allocating 4 KB pages. in_use
+// has one bit per cache line so each line is in at most one set at a time.
+typedef struct {
+  uint8_t *start;
+  size_t bytes;
+  CacheGeometry *geometry;
+  uint64_t *in_use;
+} HugepagePool;
+
+// When set, inflate takes its candidates from this pool
+extern HugepagePool *hugepage_pool;
+
+HugepagePool *new_hugepage_pool(size_t bytes, CacheGeometry *geometry);
+void free_hugepage_pool(HugepagePool *pool);
+bool hugepage_pool_contains(HugepagePool *pool, void *va);
+int hugepage_set_lines(CacheLineSet *cl_set, uint8_t *start, size_t bytes,
+                       CacheGeometry *geometry, int set, int count);
+int hugepage_victim_set(HugepagePool *pool, uint8_t *victim);
+CacheLineSet *hugepage_candidates(HugepagePool *pool, int set, int max_lines);
+CacheLineSet **cl_set_slices(CacheLineSet *cl_set, SliceHash *hash);
+
 void print_cache_line(CacheLine *cl);
 CacheLine *allocate_cache_line(uint8_t *victim);
+CacheLine *allocate_translated_line(uint8_t *victim, uintptr_t *pa);
+CacheLine *allocate_matching(uint8_t *victim, int matching_bits,
+                             CacheGeometry *geometry);
 CacheLineSet *new_cl_set(void);
 void print_cl_set(CacheLineSet *cl_set);
+int cl_set_to_pas(CacheLineSet *cl_set, uintptr_t *pas);
+void reserve_cl_set(CacheLineSet *cl_set, int capacity);
+void shrink_cl_set(CacheLineSet *cl_set);
 void push_cache_line(CacheLineSet *cl_set, CacheLine *cl);
 void free_cl_set(CacheLineSet *cl_set);
+void free_cache_line(CacheLine *cl);
 void deep_free_cl_set(CacheLineSet *cl_set);
 CacheLine *pop_cache_line(CacheLineSet *cl_set);
 CacheLine *remove_cache_line(CacheLineSet *cl_set, int index);
+CacheLine *swap_remove_cache_line(CacheLineSet *cl_set, int index);
+void remove_cache_line_range(CacheLineSet *cl_set, int low, int high);
 void shuffle_lines(CacheLineSet *cl_set);
 CacheLineSet *inflate(uint8_t *victim, int max_size, int samples,
                       uint64_t threshold);
@@ -87,18 +206,71 @@ typedef struct {
   int size;
 } EvictionSet;
 
+// Caller-owned scratch space for evict_and_time_scratch. lines holds the
+// permutation that is shuffled and relinked in place for every sample, so the
+// sampling loop never allocates. latencies gives the median without sorting.
+typedef struct {
+  CacheLineSet *lines;
+  EvictionSet es;
+  LatencyHistogram *latencies;
+} EvictionScratch;
+
 extern bool attack_finished;
 
+// Number of eviction tests (evict_and_time or is_eviction_set calls) and of
+// individual timed samples run so far, for comparing reductions
+extern uint64_t eviction_tests;
+extern uint64_t eviction_samples;
+
+// Number of times get_minimal_set inflated a new set after a failed reduction
+extern uint64_t reduction_retries;
+
+// Candidate memory inflate may use when called with a max_size of 0
+extern size_t inflate_budget;
+
+// Use is_eviction_set instead of repeated evict_and_time medians when
+// inflating and reducing
+extern bool sequential_tests;
+
+// A reduction algorithm. reduce2 and reduce_group_testing both have this type.
+typedef bool (*ReduceFunction)(CacheLineSet *cl_set, CacheLineSet *reserve,
+                               uint8_t *victim, int samples, uint64_t threshold,
+                               int bins);
+
+// Reduction used by get_minimal_set, reduce2 by default
+extern ReduceFunction reduce_function;
+
 void print_eviction_set(CacheLineSet *cl_set);
+void link_eviction_set(EvictionSet *es, CacheLineSet *cl_set);
 EvictionSet *new_eviction_set(CacheLineSet *cl_set);
 void deep_free_es(EvictionSet *es);
 void access_set(EvictionSet *es);
 void *access_loop(void *in);
 uint64_t evict_and_time_once(EvictionSet *es, uint8_t *victim);
+EvictionScratch *new_eviction_scratch(int capacity);
+void free_eviction_scratch(EvictionScratch *scratch);
+uint64_t evict_and_time_scratch(CacheLineSet *cl_set, uint8_t *victim,
+                                NumList *timings, bool use_siblings,
+                                EvictionScratch *scratch);
 uint64_t evict_and_time(CacheLineSet *cl_set, uint8_t *victim, NumList *timings,
                         bool use_siblings);
+bool is_eviction_set_scratch(CacheLineSet *cl_set, uint8_t *victim,
+                             uint64_t threshold, double confidence,
+                             EvictionScratch *scratch, int *samples_used);
+bool is_eviction_set(CacheLineSet *cl_set, uint8_t *victim, uint64_t threshold,
+                     double confidence);
+bool evicts_all(CacheLineSet *cl_set, uint8_t *victim, uint64_t threshold,
+                int reps, bool early_termination, NumList *timings,
+                EvictionScratch *scratch);
 bool reduce2(CacheLineSet *cl_set, CacheLineSet *reserve, uint8_t *victim,
              int samples, uint64_t threshold, int bins);
+bool reduce_group_testing_ex(CacheLineSet *cl_set, CacheLineSet *reserve,
+                             uint8_t *victim, int samples, uint64_t threshold,
+                             int groups, bool early_termination,
+                             int max_backtracks);
+bool reduce_group_testing(CacheLineSet *cl_set, CacheLineSet *reserve,
+                          uint8_t *victim, int samples, uint64_t threshold,
+                          int bins);
 EvictionSet *generate_set(uint8_t *victim);
 uint64_t threshold_from_evict(CacheLineSet *cl_set, uint8_t *victim);
 
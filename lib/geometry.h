@@ -0,0 +1,50 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef GEOMETRY_H
+#define GEOMETRY_H
+
+/*********************************************************************
+ * Cache Geometry
+ *********************************************************************/
+
+// Describes the last-level cache of a machine. A physical address selects a
+// cache set with bits [line_bits, line_bits + set_bits), and one of slices
+// slices with the slicing function. Each slice has 1 << set_bits sets.
+typedef struct {
+  const char *name;
+  int line_bits;
+  int set_bits;
+  int ways;
+  int slices;
+  int hugepage_bits;
+  // Whether the LLC holds a copy of every line in the private caches
+  bool inclusive;
+} CacheGeometry;
+
+extern CacheGeometry acadia_geometry;
+extern CacheGeometry everglades_geometry;
+
+// Geometry of the machine we run on. Points to everglades_geometry until
+// init_cache_geometry detects the actual one.
+extern CacheGeometry *cache_geometry;
+
+// Number of LLC slices detect_cache_geometry uses instead of detecting it, if
+// positive. The LLC_SLICES environment variable does the same.
+extern int slices_override;
+
+int geometry_set_index(CacheGeometry *geometry, uintptr_t pa);
+uintptr_t geometry_set_stride(CacheGeometry *geometry);
+size_t geometry_llc_bytes(CacheGeometry *geometry);
+
+/*********************************************************************
+ * Detection
+ *********************************************************************/
+
+bool detect_cache_geometry(CacheGeometry *geometry);
+CacheGeometry *init_cache_geometry(void);
+uint64_t geometry_fingerprint(CacheGeometry *geometry);
+void print_cache_geometry(CacheGeometry *geometry);
+
+#endif
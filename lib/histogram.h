@@ -0,0 +1,53 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "utils.h"
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+/*********************************************************************
+ * Latency Histograms
+ *
+ * A LatencyHistogram counts timings in HISTOGRAM_BUCKETS buckets of
+ * 1 << shift ticks, so inserting a timing is O(1) and the median,
+ * percentiles and threshold counts are O(buckets) without sorting. The last
+ * bucket also holds every timing beyond it. The exact minimum, maximum, sum
+ * and sum of squares are kept alongside for the other statistics.
+ *
+ * Ranks are reported as the lower edge of their bucket, so with shift 0 the
+ * median is exactly that of median_and_sort for timings below the last bucket.
+ * Ranks in the last bucket are reported as the maximum.
+ *********************************************************************/
+
+#define HISTOGRAM_BUCKETS 1024
+
+typedef struct {
+  uint64_t buckets[HISTOGRAM_BUCKETS] __attribute__((aligned(32)));
+  // Each bucket covers 1 << shift ticks
+  int shift;
+  uint64_t count;
+  uint64_t min;
+  uint64_t max;
+  uint64_t sum;
+  double squares;
+} LatencyHistogram;
+
+LatencyHistogram *new_latency_histogram(int shift);
+void clear_latency_histogram(LatencyHistogram *h);
+void free_latency_histogram(LatencyHistogram *h);
+int histogram_shift_for(uint64_t max);
+
+void histogram_insert(LatencyHistogram *h, uint64_t ticks);
+void histogram_insert_num_list(LatencyHistogram *h, NumList *nl);
+bool merge_latency_histograms(LatencyHistogram *into, LatencyHistogram *from);
+
+uint64_t histogram_rank(LatencyHistogram *h, uint64_t rank);
+uint64_t histogram_median(LatencyHistogram *h);
+uint64_t histogram_percentile(LatencyHistogram *h, double percentile);
+uint64_t histogram_count_at_least(LatencyHistogram *h, uint64_t threshold);
+double histogram_mean(LatencyHistogram *h);
+double histogram_stddev(LatencyHistogram *h);
+void print_histogram_stats(LatencyHistogram *h);
+
+#endif
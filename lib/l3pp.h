@@ -1,43 +1,88 @@
 #include "eviction.h"
+#include "probe_ring.h"
+#include "trace.h"
+
+// Probes between recalibrations of the threshold in prime_probe, and the
+// cached and flushed loads timed by each one
+#define RECALIBRATION_INTERVAL 100000
+#define RECALIBRATION_SAMPLES 32
+
+// Probes between recalibrations in prime_probe, or 0 to keep the threshold
+// it was given for the whole session
+extern uint64_t recalibration_interval;
+
+// Estimate made by the latest recalibration
+extern ThresholdEstimate last_recalibration;
+
+// If not NULL, probe adds every load it times to this histogram, which can
+// accumulate over any number of prime_probe sessions
+extern LatencyHistogram *probe_latencies;
+
+// If not NULL, prime_probe appends the timestamp of every detection to this
+// trace. Appending never blocks, so sessions can run for hours.
+extern TraceWriter *probe_trace;
+
+// Probes between flushes injected by profile_probe_modes
+#define PROFILE_EVENT_INTERVAL 16
+
+typedef enum {
+  // Time each line of the set with time_load, stopping at the first miss
+  PROBE_PER_LINE,
+  // Time a whole traversal of the set with one pair of timestamps. The
+  // traversal also primes the set, and alternates between forward and
+  // backward so the lines loaded last are loaded first.
+  PROBE_TRAVERSAL,
+  NUM_PROBE_MODES
+} ProbeMode;
+
+// Probe used by prime_probe, PROBE_PER_LINE by default. The threshold given
+// to prime_probe must come from threshold_for_probe with the same mode.
+extern ProbeMode probe_mode;
+
+const char *probe_mode_name(ProbeMode mode);
 uint8_t probe(EvictionSet *es, int threshold);
+uint8_t probe_traversal(EvictionSet *es, int threshold, bool backward);
+bool probe_with_mode(EvictionSet *es, int threshold, bool *backward);
+ThresholdEstimate estimate_probe_threshold(EvictionSet *es, ProbeMode mode,
+                                           int samples);
+int threshold_for_probe(EvictionSet *es, ProbeMode mode);
+void recalibrate_threshold(EvictionSet *es, int *threshold);
+void profile_probe_modes(EvictionSet *es, uint64_t probes);
 /**
- * Prime+Probe until the buffer hit_times is completely filled
+ * Prime+Probe es probes times, or until attack_finished is set if probes is 0,
+ * appending each outcome to ring. The first hit of every run of hits is a
+ * detection, including across sessions on the same ring.
+ * Probes with probe_mode. Every recalibration_interval probes, the threshold
+ * is estimated again so that frequency changes do not break classification.
  * @param es: eviction set to probe
- * @param associativity: the associativity of the cache
- * @param numBytes: the number of bytes in array hit_times
- * @return hit_times: a list of output, detected hits of target denoted as 1,
- * misses denoted as 0
- * @return detect_timestamps: a list of rdtscp timestamps from prime+probe
- * @return size: the size of timestamps array
- * detections
+ * @param ring: receives one bit per probe, 1 for a hit and 0 for a miss
+ * @param probes: the number of probes, or 0 to probe until attack_finished
+ * @param max_detections: the length of detect_timestamps
+ * @return detect_timestamps: rdtscp timestamps of the first
+ * max_detections detections (may be NULL if max_detections is 0)
+ * @return size: the number of timestamps written to detect_timestamps
  */
-void prime_probe(EvictionSet *es, uint8_t associativity, uint8_t *hit_times,
-                 uint64_t numBytes, uint64_t *detect_timestamps, uint64_t *size,
-                 int threshold);
+void prime_probe(EvictionSet *es, ProbeRing *ring, uint64_t probes,
+                 uint64_t *detect_timestamps, uint64_t max_detections,
+                 uint64_t *size, int threshold);
 
 /**
- * Return the hit count for the given trace at the last width * height addresses
- * in results
- * @param results: the traces of prime+probe
- * @param numBytes: the number of bytes of results
+ * Return the number of detections in the last width * height probes of ring
+ * @param ring: the outcomes of prime+probe
  * @param width: the width of the printed output
  * @param height: the height of the printed output
  * @return the hit count for the given trace
  */
-uint16_t get_slice_hit_count(uint8_t *results, uint64_t numBytes,
-                             uint64_t width, uint64_t height);
-
-void filter_pp_results(uint8_t *results, uint64_t numBytes);
+uint16_t get_slice_hit_count(ProbeRing *ring, uint64_t width,
+                             uint64_t height);
 
 /**
- * Print the last width * height outputs from results
- * @param results: the traces of prime+probe
- * @param numBytes: the number of bytes of results
+ * Print the detections in the last width * height probes of ring
+ * @param ring: the outcomes of prime+probe
  * @param width: the width of the printed output
  * @param height: the height of the printed output
  */
-void print_probe_result(uint8_t *results, uint64_t numBytes, uint64_t width,
-                        uint64_t height);
+void print_probe_result(ProbeRing *ring, uint64_t width, uint64_t height);
 
 void flush_timestamps(uint64_t *timestamps, int size, char *filePath);
 
@@ -49,7 +94,10 @@ void flush_timestamps(uint64_t *timestamps, int size, char *filePath);
 Last-Level Cache Complex Addressing
 Using Performance Counters */
 int get_i7_2600_slice(uintptr_t pa);
-CacheLineSet *hugepage_inflate(void *mmap_start, int size, int set);
-EvictionSet **get_all_slices_eviction_sets(void *mmap_start, int set);
+CacheLineSet *hugepage_inflate(void *mmap_start, int size, int set,
+                               CacheGeometry *geometry);
+EvictionSet **get_all_slices_eviction_sets(void *mmap_start, int set,
+                                           CacheGeometry *geometry,
+                                           int *found);
 
-void free_es_list(EvictionSet **es_list);
+void free_es_list(EvictionSet **es_list, CacheGeometry *geometry);
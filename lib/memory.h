@@ -0,0 +1,52 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "eviction.h"
+
+#ifndef MEMORY_H
+#define MEMORY_H
+
+/*********************************************************************
+ * Memory Backend
+ *
+ * Every load, flush, timing and address translation the eviction set
+ * algorithms make goes through memory_backend. hardware_memory, the default,
+ * loads from memory and reads pagemap. Other backends (see lib/simulator.h)
+ * model the cache instead, so that inflate, the reductions and generate_sets
+ * can run unmodified on any machine. Backends keep their own data in state.
+ *********************************************************************/
+
+typedef struct MemoryBackend MemoryBackend;
+struct MemoryBackend {
+  const char *name;
+  void (*load)(MemoryBackend *memory, volatile uint8_t *va);
+  uint64_t (*time_load)(MemoryBackend *memory, volatile uint8_t *va);
+  // Time following a list of CacheLines from start, as timer_traverse does
+  uint64_t (*time_traverse)(MemoryBackend *memory, void *start, bool backward);
+  void (*flush)(MemoryBackend *memory, volatile uint8_t *va);
+  // Physical address of va, or (uintptr_t)-1 if it is not available
+  uintptr_t (*translate)(MemoryBackend *memory, void *va);
+  // Translate count addresses, returning how many were translated
+  int (*translate_lines)(MemoryBackend *memory, void **vas, uintptr_t *pas,
+                         int count);
+  // Traverse es as access_set does
+  void (*access_set)(MemoryBackend *memory, EvictionSet *es);
+  // Current time in cycles, for timing work other than a load or a traversal
+  uint64_t (*cycles)(MemoryBackend *memory);
+  // Map bytes backed by hugepages, or return NULL, and unmap such a mapping
+  void *(*map_hugepages)(MemoryBackend *memory, size_t bytes);
+  void (*unmap_hugepages)(MemoryBackend *memory, void *start, size_t bytes);
+  void *state;
+};
+
+extern MemoryBackend hardware_memory;
+
+// Backend the library uses, &hardware_memory by default
+extern MemoryBackend *memory_backend;
+
+void load_line(volatile uint8_t *va);
+void flush_line(volatile uint8_t *va);
+uint64_t time_traversal(void *start, bool backward);
+
+#endif
@@ -0,0 +1,48 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifndef PAGEMAP_H
+#define PAGEMAP_H
+
+/*********************************************************************
+ * Pagemap Reader
+ *
+ * Translates virtual to physical addresses through a /proc/pid/pagemap file
+ * that stays open. Entries are cached per page until invalidated, and batches
+ * of addresses are translated with one pread per run of nearby pages.
+ *********************************************************************/
+
+// Most pagemap entries read by a single pread
+#define PAGEMAP_RUN 4096
+
+// Largest gap, in pages, between two uncached pages of a batch that are still
+// read with the same pread
+#define PAGEMAP_GAP 16
+
+typedef struct {
+  int fd;
+  // Open-addressed table from page number + 1 (0 marks an empty slot) to the
+  // raw pagemap entry of the page
+  uint64_t *pages;
+  uint64_t *entries;
+  int capacity_bits;
+  size_t count;
+  // Holds the entries of one run
+  uint64_t *buffer;
+  // Translations answered from the cache, pages read, and preads issued
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t reads;
+} PagemapReader;
+
+PagemapReader *new_pagemap_reader(pid_t pid);
+void free_pagemap_reader(PagemapReader *reader);
+int pagemap_translate(PagemapReader *reader, void **vas, uintptr_t *pas,
+                      int count);
+uintptr_t pagemap_translate_one(PagemapReader *reader, void *va);
+void pagemap_invalidate(PagemapReader *reader, void *va, size_t bytes);
+void pagemap_invalidate_all(PagemapReader *reader);
+
+#endif
@@ -0,0 +1,63 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "pagemap.h"
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+/*********************************************************************
+ * Candidate Pipeline
+ *
+ * A helper thread, pinned to another physical core than the measuring thread
+ * (which pin_measuring_thread pins to its current CPU), allocates candidate
+ * pages and faults them in (and optionally reads their physical addresses)
+ * ahead of time. It hands them to the measuring thread in batches through a
+ * single-producer, single-consumer ring, so the measuring thread never waits
+ * on the allocator or a page fault between timed tests.
+ *********************************************************************/
+
+// Batches that can be ready at once
+#define PIPELINE_DEPTH 8
+
+// Pages per batch
+#define PIPELINE_BATCH 512
+
+typedef struct {
+  uint8_t **pages;
+  // Physical address of each page, or (uintptr_t)-1, if translated
+  uintptr_t *pas;
+  int size;
+  int next;
+} CandidateBatch;
+
+typedef struct {
+  pthread_t thread;
+  // CPU the helper runs on, or -1 if it is not pinned
+  int cpu;
+  int batch_size;
+  bool translate;
+  // Ring of ready batches. head is only written by the consumer and tail only
+  // by the producer.
+  CandidateBatch *ring[PIPELINE_DEPTH];
+  uint64_t head;
+  uint64_t tail;
+  bool stop;
+  // Batch the consumer is taking pages from
+  CandidateBatch *current;
+  // Only used by the helper thread
+  PagemapReader *reader;
+  // Batches consumed, and times the consumer had to wait for one
+  uint64_t batches;
+  uint64_t stalls;
+} CandidatePipeline;
+
+bool pin_measuring_thread(void);
+int pick_helper_cpu(void);
+CandidatePipeline *new_candidate_pipeline(int batch_size, int cpu,
+                                          bool translate);
+void free_candidate_pipeline(CandidatePipeline *pipeline);
+uint8_t *pipeline_take_page(CandidatePipeline *pipeline, uintptr_t *pa);
+
+#endif
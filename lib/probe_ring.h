@@ -0,0 +1,41 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef PROBE_RING_H
+#define PROBE_RING_H
+
+/*********************************************************************
+ * Probe Ring
+ *
+ * A ProbeRing holds the outcome of the latest probes, one bit each (1 for a
+ * detected access), in a power of two number of 64-bit words. Probes are
+ * numbered from 0 in the order they were pushed; once the ring is full each
+ * push overwrites the oldest probe, so a probe loop can run for as long as it
+ * likes. Bit i of a word is the earlier probe of bits i and i + 1.
+ *
+ * The raw outcomes are kept. Consecutive hits are usually one access, so
+ * probe_ring_detections keeps only the first hit of every run, with a shift
+ * and mask per 64 probes, and counts are popcounts over whole words.
+ *********************************************************************/
+
+typedef struct {
+  uint64_t *words;
+  // Capacity in probes, a power of two and at least 64
+  uint64_t capacity;
+  // Probes pushed since the ring was created
+  uint64_t written;
+} ProbeRing;
+
+ProbeRing *new_probe_ring(uint64_t capacity);
+void clear_probe_ring(ProbeRing *ring);
+void free_probe_ring(ProbeRing *ring);
+
+void probe_ring_push(ProbeRing *ring, bool hit);
+uint64_t probe_ring_oldest(ProbeRing *ring);
+bool probe_ring_get(ProbeRing *ring, uint64_t index);
+uint64_t probe_ring_bits(ProbeRing *ring, uint64_t index, int count);
+uint64_t probe_ring_detections(ProbeRing *ring, uint64_t index, int count);
+uint64_t probe_ring_count(ProbeRing *ring, uint64_t index, uint64_t length,
+                          bool filtered);
+
+#endif
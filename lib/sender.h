@@ -0,0 +1,39 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef SENDER_H
+#define SENDER_H
+
+/*********************************************************************
+ * Synthetic Sender
+ *
+ * The sender victim.c runs: it loads a target line, waits SENDER_SHORT_GAP
+ * cycles, loads it again and waits SENDER_LONG_GAP cycles, forever. Each load
+ * is one access a prober of the target's set should detect. A sender started
+ * with start_sender runs on its own thread, pinned to another physical core
+ * if there is one, and logs the TSC of every access so that detections can be
+ * scored against it.
+ *********************************************************************/
+
+#define SENDER_SHORT_GAP 20000
+#define SENDER_LONG_GAP 40000
+
+typedef struct {
+  uint8_t *target;
+  // TSC right after every access while there is room, if not NULL
+  uint64_t *timestamps;
+  uint64_t capacity;
+  uint64_t length;
+  pthread_t thread;
+  // CPU the sender runs on, or -1 if it is not pinned
+  int cpu;
+  bool stop;
+} Sender;
+
+void run_sender(Sender *sender);
+Sender *start_sender(uint8_t *target, uint64_t capacity);
+void stop_sender(Sender *sender);
+void free_sender(Sender *sender);
+
+#endif
@@ -0,0 +1,179 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "geometry.h"
+#include "memory.h"
+#include "slice.h"
+
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+/*********************************************************************
+ * Simulated Cache
+ *
+ * A MemoryBackend that models a sliced, set-associative, inclusive LLC, with
+ * an optional private LRU cache in front of it, instead of loading from
+ * memory. Loads still read the lines' pointers, so eviction sets are built and
+ * linked as usual; only the cache they would go through is simulated.
+ * Every timed load reports the latency of the level that served it, so the
+ * simulation is deterministic for a given config and rand() seed.
+ *
+ * 4 KiB pages get frames in the lower half of a 48-bit physical address space
+ * in the order they are first translated, through a seeded permutation, so
+ * the mapping does not depend on where the pages happen to be mapped. Regions
+ * registered with simulate_hugepages are mapped with 2 MiB pages into the
+ * upper half instead, keeping their offsets within each hugepage, so they can
+ * stand in for MAP_HUGETLB mappings on machines without hugepages. Hugepage
+ * pools mapped while the simulator is in use are registered this way.
+ *
+ * A SimulatorNoise adds the disturbances of a real machine: loads by other
+ * cores (random lines, a streaming neighbour and periodic bursts), timer
+ * jitter, interrupt-like outliers and pages that get remapped. Noise is paced
+ * by the simulated cycles of the algorithm's own loads and drawn from its own
+ * seeded generator, so noisy runs repeat exactly as well.
+ *********************************************************************/
+
+typedef enum {
+  REPLACE_LRU,
+  // Binary tree of ways, each node pointing away from its last used half
+  REPLACE_TREE_PLRU,
+  // 2-bit ages: lines are inserted with age 1 and hits reset the age to 0.
+  // The first line of age 3 is evicted, after ageing every line until there is
+  // one (QLRU_H00_M1_R0_U0 in Abel and Reineke's naming).
+  REPLACE_QLRU,
+  REPLACE_RANDOM,
+  NUM_REPLACEMENT_POLICIES
+} ReplacementPolicy;
+
+typedef struct {
+  // Loads by other cores, of random lines and of consecutive lines, per 1000
+  // simulated cycles. They only go through the LLC.
+  double random_loads;
+  double stream_loads;
+  // Every burst_period cycles, another core loads burst_lines consecutive
+  // lines from a random place, or never if burst_period is 0
+  uint64_t burst_period;
+  int burst_lines;
+  // Each timing is off by up to jitter either way, and outlier_rate of them
+  // take outlier_latency longer, as if interrupted
+  uint64_t jitter;
+  double outlier_rate;
+  uint64_t outlier_latency;
+  // Pages moved to a new frame per million cycles
+  double remaps;
+  uint64_t seed;
+} SimulatorNoise;
+
+typedef struct {
+  // Geometry of the LLC, which is inclusive regardless of geometry->inclusive
+  CacheGeometry *geometry;
+  // Slice hash, or NULL to pick slices with a fixed mix of the address. Only
+  // used if it has geometry->slices slices.
+  SliceHash *hash;
+  ReplacementPolicy policy;
+  // Private cache of 1 << private_set_bits sets, or none with 0 ways
+  int private_set_bits;
+  int private_ways;
+  // Latencies of loads served by the private cache, the LLC and memory
+  uint64_t private_latency;
+  uint64_t llc_latency;
+  uint64_t memory_latency;
+  // Seeds the page mapping and REPLACE_RANDOM
+  uint64_t seed;
+  SimulatorNoise noise;
+} SimulatorConfig;
+
+// The i7-2600: everglades_geometry with its slice hash, a 256 KiB L2,
+// latencies on either side of INITIAL_THRESHOLD and no noise
+extern SimulatorConfig everglades_simulator;
+
+// One unit of noise, for scale_noise
+extern SimulatorNoise unit_noise;
+
+typedef struct {
+  // Every load, including timed loads and those of timed traversals
+  uint64_t loads;
+  uint64_t timed_loads;
+  uint64_t timed_traversals;
+  uint64_t flushes;
+  uint64_t private_hits;
+  uint64_t llc_hits;
+  uint64_t misses;
+  // Lines evicted from the LLC to make room
+  uint64_t evictions;
+  // Latency of every load added up
+  uint64_t cycles;
+  // Loads by other cores, timings made outliers and pages remapped
+  uint64_t noise_loads;
+  uint64_t outliers;
+  uint64_t remaps;
+} SimulatorStats;
+
+// Most regions simulate_hugepages can register
+#define SIMULATED_HUGEPAGE_REGIONS 16
+
+// Initial capacity of the page table, which doubles when half full
+#define SIMULATED_PAGE_TABLE_SIZE 4096
+
+typedef struct {
+  // Points back to the SimulatedCache through state
+  MemoryBackend backend;
+  SimulatorConfig config;
+  int sets;
+  // Leaves of the tree-PLRU tree, ways rounded up to a power of two
+  int plru_leaves;
+  // Line number + 1 of every LLC way, or 0 if the way is empty, at index
+  // (slice << set_bits | set) * ways + way
+  uint64_t *lines;
+  // Per way: time of last use for LRU, age for QLRU
+  uint64_t *ages;
+  // Per set: tree-PLRU bits, node i at bit i
+  uint64_t *plru;
+  // Same as lines and ages for the private cache
+  uint64_t *private_lines;
+  uint64_t *private_ages;
+  uint64_t clock;
+  uint64_t random;
+  // Open-addressed page table from virtual page number + 1 (0 if empty) to
+  // page frame
+  uint64_t *page_numbers;
+  uint64_t *page_frames;
+  size_t page_capacity;
+  size_t pages;
+  // Frames given out, counting remaps
+  uint64_t frames;
+  // Whether config.noise has any noise, and its generator
+  bool noisy;
+  uint64_t noise_random;
+  // Noise loads and remaps owed for the cycles so far
+  double random_debt;
+  double stream_debt;
+  double remap_debt;
+  uint64_t stream_line;
+  uint64_t next_burst;
+  uint8_t *hugepage_starts[SIMULATED_HUGEPAGE_REGIONS];
+  size_t hugepage_bytes[SIMULATED_HUGEPAGE_REGIONS];
+  int hugepage_regions;
+  SimulatorStats stats;
+} SimulatedCache;
+
+const char *replacement_policy_name(ReplacementPolicy policy);
+SimulatorNoise scale_noise(SimulatorNoise noise, double scale);
+
+SimulatedCache *new_simulated_cache(SimulatorConfig config);
+void free_simulated_cache(SimulatedCache *cache);
+void reset_simulated_cache(SimulatedCache *cache);
+bool simulate_hugepages(SimulatedCache *cache, void *start, size_t bytes);
+void forget_hugepages(SimulatedCache *cache, void *start);
+
+uintptr_t simulated_translate(SimulatedCache *cache, void *va);
+int simulated_slice(SimulatedCache *cache, uintptr_t pa);
+uint64_t simulated_access(SimulatedCache *cache, uintptr_t pa);
+void simulated_flush(SimulatedCache *cache, uintptr_t pa);
+
+void use_simulated_cache(SimulatedCache *cache);
+void use_hardware_memory(void);
+void print_simulator_stats(SimulatedCache *cache);
+
+#endif
@@ -0,0 +1,50 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "geometry.h"
+
+#ifndef SLICE_H
+#define SLICE_H
+
+/*********************************************************************
+ * Slice Hash
+ *
+ * Intel client parts with a power-of-two number of slices select the slice
+ * with a linear hash of the physical address: bit i of the slice is the
+ * parity of the address bits in masks[i]. The masks are from Reverse
+ * Engineering Intel Last-Level Cache Complex Addressing Using Performance
+ * Counters, which found the same functions from Sandy Bridge to Haswell;
+ * later client parts up to Coffee Lake use them as well. Parts with other
+ * slice counts (e.g. six-core Coffee Lake) use a non-linear hash and are not
+ * covered.
+ *********************************************************************/
+
+// pas_to_slices assumes at most three bits
+#define MAX_SLICE_BITS 3
+
+typedef struct {
+  const char *name;
+  // CPUID family 6 display models, terminated by 0
+  int models[6];
+  int slices;
+  int bits;
+  uint64_t masks[MAX_SLICE_BITS];
+} SliceHash;
+
+extern SliceHash slice_hashes[];
+
+// Slice hash of the machine we run on, or NULL if it is not known. Points to
+// the four-slice Sandy Bridge hash, matching everglades_geometry, until
+// init_slice_hash detects the actual one.
+extern SliceHash *slice_hash;
+
+int pa_to_slice(SliceHash *hash, uintptr_t pa);
+void pas_to_slices(SliceHash *hash, uintptr_t *pas, int *slices, int count);
+SliceHash *find_slice_hash(int model, int slices);
+SliceHash *init_slice_hash(CacheGeometry *geometry);
+
+bool save_slice_hash(SliceHash *hash, const char *path);
+SliceHash *load_slice_hash(const char *path);
+void free_slice_hash(SliceHash *hash);
+
+#endif
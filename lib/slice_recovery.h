@@ -0,0 +1,38 @@
+#include <stdint.h>
+
+#include "atlas.h"
+#include "eviction.h"
+#include "geometry.h"
+#include "slice.h"
+
+#ifndef SLICE_RECOVERY_H
+#define SLICE_RECOVERY_H
+
+/*********************************************************************
+ * Slice Hash Recovery
+ *
+ * Recovers a linear slice hash on a CPU without a published one. Minimal
+ * eviction sets for each slice of one set index are found by reduction, and
+ * hugepage lines of that set index are split into congruence classes by which
+ * set evicts them. For a linear hash, the physical addresses of two congruent
+ * lines differ by a vector that every mask is orthogonal to, so the masks
+ * span the null space over GF(2) of those differences.
+ *
+ * Lines of different set indices can never be compared by eviction, so only
+ * the address bits above the set index are recovered. The set index bits just
+ * relabel the slices within each set index: the recovered hash splits any set
+ * index into the right classes, but its slice numbers are only consistent
+ * within one set index.
+ *********************************************************************/
+
+// Hugepages of lines to classify
+#define RECOVERY_HUGEPAGES 64
+
+int classify_slice_lines(EvictionAtlas *atlas, int set, CacheLineSet *lines,
+                         int *classes);
+int solve_slice_masks(uintptr_t *pas, int *classes, int count,
+                      uint64_t columns, uint64_t *masks, int max_masks);
+SliceHash *recover_slice_hash(CacheGeometry *geometry, int set,
+                              int hugepages);
+
+#endif
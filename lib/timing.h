@@ -0,0 +1,74 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef TIMING_H
+#define TIMING_H
+
+/*********************************************************************
+ * Load Timers
+ *
+ * A Timer times a single load, or a traversal of a linked set of lines, with
+ * one of several clocks. Each timer is calibrated when it is created: the
+ * median time of an empty timed region is its overhead, which is subtracted
+ * from every timing, and the smallest nonzero difference between two timings
+ * is its resolution. Timings are in
+ * ticks of the timer's clock: cycles for the counters, and increments of the
+ * counting thread for TIMER_COUNTING_THREAD.
+ *********************************************************************/
+
+// Timed regions used to calibrate a timer
+#define TIMER_CALIBRATION_SAMPLES 1000
+
+// Time measure_tsc_hz counts TSC ticks for
+#define TSC_CALIBRATION_MS 50
+
+typedef enum {
+  // mfence; rdtscp; lfence; load; rdtscp; lfence
+  TIMER_RDTSCP,
+  // lfence; rdtsc; lfence; load; lfence; rdtsc
+  TIMER_RDTSC_LFENCE,
+  // Core cycle counter from perf_event, read with rdpmc if the kernel allows
+  // it and with read() otherwise
+  TIMER_PERF,
+  // A thread on another core incrementing a shared counter, for hosts where
+  // the TSC is virtualized or too coarse
+  TIMER_COUNTING_THREAD,
+  NUM_TIMER_BACKENDS
+} TimerBackend;
+
+struct perf_event_mmap_page;
+
+typedef struct {
+  TimerBackend backend;
+  // Median ticks of an empty timed region, subtracted from every timing
+  uint64_t overhead;
+  // Smallest nonzero difference between two empty timed regions
+  uint64_t resolution;
+
+  // TIMER_PERF
+  int perf_fd;
+  // Mapped counter page, or NULL if rdpmc is not allowed
+  struct perf_event_mmap_page *perf_page;
+  uint64_t perf_mask;
+
+  // TIMER_COUNTING_THREAD
+  pthread_t thread;
+  bool stop;
+  // On its own cache line, so that only the counting thread writes it
+  uint64_t ticks __attribute__((aligned(64)));
+} Timer;
+
+// Timer used by time_load. Points to an uncalibrated TIMER_RDTSCP timer,
+// which times loads exactly as time_load always has, until it is replaced.
+extern Timer *load_timer;
+
+const char *timer_backend_name(TimerBackend backend);
+Timer *new_timer(TimerBackend backend);
+void free_timer(Timer *timer);
+void calibrate_timer(Timer *timer);
+uint64_t timer_load(Timer *timer, volatile uint8_t *victim);
+uint64_t timer_traverse(Timer *timer, void *start, bool backward);
+uint64_t measure_tsc_hz(void);
+
+#endif
@@ -0,0 +1,84 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef TRACE_H
+#define TRACE_H
+
+/*********************************************************************
+ * Trace Writer
+ *
+ * Appends 64-bit records (rdtscp timestamps of detections, for prime_probe)
+ * to a memory-mapped file without the appending thread ever making a system
+ * call. Records go into one of two buffers; a full buffer is handed to a
+ * writer thread, which copies it into the mapping while the other buffer
+ * fills. If the writer has not emptied the other buffer yet, the full one is
+ * discarded and counted as dropped rather than waiting. The file starts
+ * sized for TRACE_INITIAL_RECORDS and the writer doubles it when it is full.
+ *
+ * The file starts with a TraceHeader describing the machine and the probe.
+ * The writer updates its record count after every buffer, so a trace that
+ * was never closed can still be read up to its last full buffer.
+ *********************************************************************/
+
+#define TRACE_MAGIC "EVTRACE"
+#define TRACE_VERSION 1
+
+// Records per buffer handed to the writer thread
+#define TRACE_BUFFER_RECORDS (1 << 16)
+
+// How often the writer thread looks for a full buffer
+#define TRACE_POLL_MS 1
+
+// Records the file is first sized for
+#define TRACE_INITIAL_RECORDS (1 << 20)
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_bytes;
+  // geometry_fingerprint of the machine the trace was taken on
+  uint64_t fingerprint;
+  char cpu[64];
+  // TSC ticks per second, to convert timestamps to time
+  uint64_t tsc_hz;
+  int32_t set;
+  // Slice of the probed eviction set, or -1 if not known
+  int32_t slice;
+  uint64_t threshold;
+  // Seconds since the epoch, and the TSC at the same time
+  int64_t created;
+  uint64_t start_tsc;
+  // Followed by records records
+  uint64_t records;
+  uint64_t dropped;
+} TraceHeader;
+
+typedef struct {
+  uint64_t records[TRACE_BUFFER_RECORDS];
+  int length;
+  // Set when the buffer is handed to the writer thread, and cleared once it
+  // has been written
+  bool full;
+} TraceBuffer;
+
+typedef struct {
+  int fd;
+  // Owned by the writer thread until it is stopped
+  uint8_t *map;
+  size_t map_bytes;
+  TraceBuffer buffers[2];
+  // Buffer being appended to
+  int active;
+  uint64_t dropped;
+  pthread_t thread;
+  bool stop;
+} TraceWriter;
+
+TraceWriter *open_trace_writer(const char *path, int set, int slice,
+                               uint64_t threshold);
+void trace_append(TraceWriter *trace, uint64_t record);
+void close_trace_writer(TraceWriter *trace);
+
+#endif
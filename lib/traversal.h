@@ -0,0 +1,61 @@
+#include <stdint.h>
+
+#include "eviction.h"
+#include "memory.h"
+
+#ifndef TRAVERSAL_H
+#define TRAVERSAL_H
+
+/*********************************************************************
+ * Traversal Kernels
+ *
+ * The zig-zag and sliding window patterns are compiled once per supported
+ * associativity (12 for Coffee Lake, 16 for Sandy Bridge) so that window
+ * lengths and lags are constants, plus a generic version that reads the
+ * associativity from the config. The other patterns do not depend on it and
+ * only have the generic version. src/traversal.c is built with optimizations
+ * regardless of CFLAGS.
+ *********************************************************************/
+
+typedef enum {
+  // Forward then backward, with a second pointer ways / 2 lines ahead
+  TRAVERSE_ZIGZAG,
+  // Windows of ways lines, each accessed repeats times, sliding by
+  // ways - overlap
+  TRAVERSE_SLIDING_WINDOW,
+  // chains pointer chases over equal parts of the set, advanced in lockstep
+  TRAVERSE_MULTI_CHAIN,
+  // Independent loads from the line array, forward then backward
+  TRAVERSE_INDEPENDENT,
+  NUM_TRAVERSAL_PATTERNS
+} TraversalPattern;
+
+typedef struct {
+  TraversalPattern pattern;
+  int ways;
+  int overlap;
+  int repeats;
+  int chains;
+} TraversalConfig;
+
+typedef void (*TraversalKernel)(EvictionSet *es, TraversalConfig *config);
+
+// Most chains TRAVERSE_MULTI_CHAIN can follow at once
+#define MAX_CHAINS 8
+
+// The kernel access_set runs, and its configuration. The default is a 16-way
+// zig-zag repeated twice, the original access_set pattern; init_cache_geometry
+// and switching memory backends set ways to that of cache_geometry.
+extern TraversalConfig traversal_config;
+extern TraversalKernel traversal_kernel;
+
+const char *traversal_pattern_name(TraversalPattern pattern);
+TraversalKernel select_traversal_kernel(TraversalPattern pattern, int ways);
+void traverse_backend(MemoryBackend *memory, EvictionSet *es,
+                      TraversalConfig *config);
+void use_traversal(TraversalConfig config);
+void use_traversal_ways(int ways);
+void profile_traversal_kernels(CacheLineSet *cl_set, uint8_t *victim,
+                               uint64_t threshold);
+
+#endif
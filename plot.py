@@ -1,14 +1,34 @@
 import numpy as np
 import matplotlib.pyplot as plt
 
+# TraceHeader in lib/trace.h
+TRACE_HEADER = np.dtype([
+    ("magic", "S8"), ("version", "<u4"), ("record_bytes", "<u4"),
+    ("fingerprint", "<u8"), ("cpu", "S64"), ("tsc_hz", "<u8"),
+    ("set", "<i4"), ("slice", "<i4"), ("threshold", "<u8"),
+    ("created", "<i8"), ("start_tsc", "<u8"), ("records", "<u8"),
+    ("dropped", "<u8"),
+])
+
+def read_trace(filename):
+    header = np.fromfile(filename, dtype=TRACE_HEADER, count=1)[0]
+    assert header["magic"] == b"EVTRACE", f"{filename} is not a trace"
+    values = np.fromfile(filename, dtype=np.uint64,
+                         count=int(header["records"]),
+                         offset=TRACE_HEADER.itemsize)
+    return header, values
+
 def graph_bin(filename):
-    values = np.fromfile(filename, dtype=np.uint64) - 1872592970464309
-    CPU_FREQ = 3.4
-    values = (values / (3.4 * 1000000)).astype(int)
+    header, values = read_trace(filename)
+    print(f"{header['cpu'].decode()}: set {header['set']} slice "
+          f"{header['slice']}, {header['records']} detections, "
+          f"{header['dropped']} dropped")
+    values = values - header["start_tsc"]
+    values = (values / (header["tsc_hz"] / 1000)).astype(int)
     print(values[:10])
     # plotting histogram with 10 ms intervals over 10s
     slots = np.zeros(10000, dtype=int)
-    for v in values:
+    for v in values[values < len(slots)]:
         slots[v] = 1
 
     plt.figure()
@@ -19,4 +39,4 @@ def graph_bin(filename):
     plt.savefig("keystrokes.png")
 
 if __name__ == "__main__":
-    graph_bin("keystrokes.bin")
+    graph_bin("keystrokes.trace")
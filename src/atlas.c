@@ -0,0 +1,405 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../lib/atlas.h"
+#include "../lib/eviction.h"
+#include "../lib/geometry.h"
+#include "../lib/slice.h"
+#include "../lib/utils.h"
+
+/*********************************************************************
+ * Entries
+ *********************************************************************/
+
+const char *atlas_state_name(AtlasState state) {
+  switch (state) {
+  case ATLAS_MISSING:
+    return "missing";
+  case ATLAS_DERIVED:
+    return "derived";
+  case ATLAS_VERIFIED:
+    return "verified";
+  case ATLAS_FAILED:
+    return "failed";
+  case ATLAS_REBUILT:
+    return "rebuilt";
+  default:
+    return "unknown";
+  }
+}
+
+AtlasEntry *atlas_entry(EvictionAtlas *atlas, int set, int slice) {
+  return &atlas->entries[set * atlas->slices + slice];
+}
+
+// Lines live in the atlas's hugepages, so only the sets are freed
+void clear_atlas_entry(AtlasEntry *entry) {
+  if (entry->lines != NULL) {
+    free_cl_set(entry->lines);
+  }
+  entry->lines = NULL;
+  entry->victim = NULL;
+  entry->state = ATLAS_MISSING;
+}
+
+double seconds_since(struct timespec *start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/*********************************************************************
+ * Construction
+ *********************************************************************/
+
+// Map enough hugepages for ATLAS_OVERSUBSCRIPTION * slices * (ways + 1)
+// candidates per set index. Returns NULL if the set index does not fit in the
+// hugepage offset or no hugepages are available.
+EvictionAtlas *new_eviction_atlas(CacheGeometry *geometry, int base_set) {
+  uintptr_t stride = geometry_set_stride(geometry);
+
+  if (stride > (uintptr_t)1 << geometry->hugepage_bits) {
+    fprintf(stderr, "error: set index bits exceed the hugepage offset\n");
+    return NULL;
+  }
+
+  size_t lines =
+      ATLAS_OVERSUBSCRIPTION * geometry->slices * (geometry->ways + 1);
+  HugepagePool *pool = new_hugepage_pool(lines * stride, geometry);
+  if (pool == NULL) {
+    return NULL;
+  }
+
+  EvictionAtlas *atlas = calloc(1, sizeof(EvictionAtlas));
+  atlas->geometry = geometry;
+  atlas->pool = pool;
+  atlas->threshold = threshold_from_flush(pool->start);
+  atlas->sets = 1 << geometry->set_bits;
+  atlas->slices = geometry->slices;
+  atlas->base_set = base_set;
+  atlas->entries = calloc(atlas->sets * atlas->slices, sizeof(AtlasEntry));
+
+  return atlas;
+}
+
+bool cl_set_contains(CacheLineSet *cl_set, CacheLine *cl) {
+  for (int i = 0; i < cl_set->size; i++) {
+    if (cl_set->cache_lines[i] == cl) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Reduce a copy of candidates to a minimal eviction set for victim, or return
+// NULL if they do not evict it
+CacheLineSet *reduce_atlas_candidates(EvictionAtlas *atlas,
+                                      CacheLineSet *candidates,
+                                      CacheLine *victim, NumList *timings,
+                                      EvictionScratch *scratch) {
+  CacheLineSet *cl_set = new_cl_set();
+  reserve_cl_set(cl_set, candidates->size);
+  for (int i = 0; i < candidates->size; i++) {
+    push_cache_line(cl_set, candidates->cache_lines[i]);
+  }
+
+  // Too few candidates left in the victim's slice
+  if (!evicts_all(cl_set, (uint8_t *)victim, atlas->threshold,
+                  ATLAS_VERIFY_REPS, true, timings, scratch)) {
+    free_cl_set(cl_set);
+    return NULL;
+  }
+
+  CacheLineSet *reserve = new_cl_set();
+  bool reduced = reduce_function(cl_set, reserve, (uint8_t *)victim, SAMPLES,
+                                 atlas->threshold, BINS);
+  free_cl_set(reserve);
+  if (!reduced) {
+    free_cl_set(cl_set);
+    return NULL;
+  }
+
+  return cl_set;
+}
+
+// Find an eviction set for each slice of a set index by reduction. If the
+// slice hash is known, the candidates are split by slice up front. Otherwise,
+// take a candidate as victim, reduce the remaining candidates to a minimal set
+// for it, then drop the set and every candidate it evicts (its slice) before
+// the next victim. Entries found get state. Returns the number of slices
+// found.
+int discover_atlas_set(EvictionAtlas *atlas, int set, AtlasState state) {
+  CacheGeometry *geometry = atlas->geometry;
+  EvictionScratch *scratch = new_eviction_scratch(2 * (geometry->ways + 1));
+  NumList *timings = new_num_list(SAMPLES);
+  CacheLineSet *pool = new_cl_set();
+  CacheLineSet **buckets = NULL;
+  int found = 0;
+
+  hugepage_set_lines(pool, atlas->pool->start, atlas->pool->bytes, geometry,
+                     set, atlas->pool->bytes / geometry_set_stride(geometry));
+  if (slice_hash != NULL && slice_hash->slices == atlas->slices) {
+    buckets = cl_set_slices(pool, slice_hash);
+  }
+
+  for (int slice = 0; buckets != NULL && slice < atlas->slices; slice++) {
+    CacheLineSet *bucket = buckets[slice];
+    if (bucket->size > geometry->ways) {
+      CacheLine *victim = pop_cache_line(bucket);
+      CacheLineSet *cl_set =
+          reduce_atlas_candidates(atlas, bucket, victim, timings, scratch);
+      if (cl_set != NULL) {
+        AtlasEntry *entry = atlas_entry(atlas, set, found++);
+        entry->lines = cl_set;
+        entry->victim = victim;
+        entry->state = state;
+      }
+    }
+    free_cl_set(bucket);
+  }
+
+  while (buckets == NULL && found < atlas->slices &&
+         pool->size > geometry->ways) {
+    CacheLine *victim = pop_cache_line(pool);
+    CacheLineSet *cl_set =
+        reduce_atlas_candidates(atlas, pool, victim, timings, scratch);
+    if (cl_set == NULL) {
+      continue;
+    }
+
+    for (int i = pool->size - 1; i >= 0; i--) {
+      CacheLine *cl = pool->cache_lines[i];
+      if (cl_set_contains(cl_set, cl) ||
+          evicts_all(cl_set, (uint8_t *)cl, atlas->threshold,
+                     ATLAS_VERIFY_REPS, true, timings, scratch)) {
+        swap_remove_cache_line(pool, i);
+      }
+    }
+
+    AtlasEntry *entry = atlas_entry(atlas, set, found++);
+    entry->lines = cl_set;
+    entry->victim = victim;
+    entry->state = state;
+  }
+
+  free(buckets);
+  free_cl_set(pool);
+  free_num_list(timings);
+  free_eviction_scratch(scratch);
+
+  return found;
+}
+
+// Same line with its set index bits replaced by set
+CacheLine *rewrite_set_index(CacheLine *cl, int set, CacheGeometry *geometry) {
+  uintptr_t mask = (((uintptr_t)1 << geometry->set_bits) - 1)
+                   << geometry->line_bits;
+  return (CacheLine *)(((uintptr_t)cl & ~mask) |
+                       ((uintptr_t)set << geometry->line_bits));
+}
+
+// Rewrite every base set index entry to set. This flips the same address bits
+// in every line, so with a linear slice hash all the lines of an entry move
+// to the same slice and the result is still an eviction set, even though the
+// table hashes read set index bits. Only a non-linear hash can split them.
+void derive_atlas_set(EvictionAtlas *atlas, int set) {
+  for (int slice = 0; slice < atlas->slices; slice++) {
+    AtlasEntry *base = atlas_entry(atlas, atlas->base_set, slice);
+    AtlasEntry *entry = atlas_entry(atlas, set, slice);
+
+    clear_atlas_entry(entry);
+    if (base->lines == NULL) {
+      continue;
+    }
+
+    entry->lines = new_cl_set();
+    reserve_cl_set(entry->lines, base->lines->size);
+    for (int i = 0; i < base->lines->size; i++) {
+      CacheLine *cl = base->lines->cache_lines[i];
+      push_cache_line(entry->lines,
+                      rewrite_set_index(cl, set, atlas->geometry));
+    }
+    entry->victim = rewrite_set_index(base->victim, set, atlas->geometry);
+    entry->state = ATLAS_DERIVED;
+  }
+}
+
+/*********************************************************************
+ * Verification
+ *********************************************************************/
+
+typedef struct {
+  EvictionAtlas *atlas;
+  int first_set;
+  int step;
+} AtlasWorker;
+
+// Verify the derived entries of set indices first_set, first_set + step, ...
+// Workers never share a set index, so they do not evict each other's lines.
+void *verify_atlas_sets(void *arg) {
+  AtlasWorker *worker = arg;
+  EvictionAtlas *atlas = worker->atlas;
+  EvictionScratch *scratch =
+      new_eviction_scratch(2 * (atlas->geometry->ways + 1));
+  NumList *timings = new_num_list(SAMPLES);
+
+  for (int set = worker->first_set; set < atlas->sets; set += worker->step) {
+    for (int slice = 0; slice < atlas->slices; slice++) {
+      AtlasEntry *entry = atlas_entry(atlas, set, slice);
+      if (entry->state != ATLAS_DERIVED) {
+        continue;
+      }
+      entry->state = evicts_all(entry->lines, (uint8_t *)entry->victim,
+                                atlas->threshold, ATLAS_VERIFY_REPS, true,
+                                timings, scratch)
+                         ? ATLAS_VERIFIED
+                         : ATLAS_FAILED;
+    }
+  }
+
+  free_num_list(timings);
+  free_eviction_scratch(scratch);
+
+  return NULL;
+}
+
+// Verify every derived entry with threads threads. eviction_tests and
+// eviction_samples are not synchronized and undercount while this runs.
+void verify_eviction_atlas(EvictionAtlas *atlas, int threads) {
+  threads = MAX(threads, 1);
+  pthread_t ids[threads];
+  bool started[threads];
+  AtlasWorker workers[threads];
+
+  for (int i = 0; i < threads; i++) {
+    workers[i] = (AtlasWorker){atlas, i, threads};
+    started[i] = i > 0 && pthread_create(&ids[i], NULL, verify_atlas_sets,
+                                         &workers[i]) == 0;
+  }
+
+  // The calling thread takes the first share and those of workers that could
+  // not be started
+  for (int i = 0; i < threads; i++) {
+    if (!started[i]) {
+      verify_atlas_sets(&workers[i]);
+    }
+  }
+  for (int i = 1; i < threads; i++) {
+    if (started[i]) {
+      pthread_join(ids[i], NULL);
+    }
+  }
+}
+
+// Rebuild by reduction every set index with a failed entry. Returns the
+// number of set indices rebuilt.
+int rebuild_eviction_atlas(EvictionAtlas *atlas) {
+  int rebuilt = 0;
+
+  for (int set = 0; set < atlas->sets; set++) {
+    bool failed = false;
+    for (int slice = 0; slice < atlas->slices; slice++) {
+      failed |= atlas_entry(atlas, set, slice)->state == ATLAS_FAILED;
+    }
+    if (!failed) {
+      continue;
+    }
+
+    for (int slice = 0; slice < atlas->slices; slice++) {
+      clear_atlas_entry(atlas_entry(atlas, set, slice));
+    }
+    discover_atlas_set(atlas, set, ATLAS_REBUILT);
+    rebuilt++;
+  }
+
+  return rebuilt;
+}
+
+// Fill an empty atlas from its base set, verifying derived sets with threads
+// threads, and time each phase
+void fill_eviction_atlas(EvictionAtlas *atlas, int threads) {
+  struct timespec start;
+  int base_set = atlas->base_set;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  int found = discover_atlas_set(atlas, base_set, ATLAS_VERIFIED);
+  atlas->seconds[0] = seconds_since(&start);
+  if (found < atlas->slices) {
+    fprintf(stderr, "warning: found %d of %d slices for base set %d\n", found,
+            atlas->slices, base_set);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int set = 0; set < atlas->sets; set++) {
+    if (set != base_set) {
+      derive_atlas_set(atlas, set);
+    }
+  }
+  atlas->seconds[1] = seconds_since(&start);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  verify_eviction_atlas(atlas, threads);
+  atlas->seconds[2] = seconds_since(&start);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  rebuild_eviction_atlas(atlas);
+  atlas->seconds[3] = seconds_since(&start);
+}
+
+// Build the full atlas from base_set, verifying derived sets with threads
+// threads. Returns NULL if no hugepages are available.
+EvictionAtlas *build_eviction_atlas(CacheGeometry *geometry, int base_set,
+                                    int threads) {
+  EvictionAtlas *atlas = new_eviction_atlas(geometry, base_set);
+  if (atlas == NULL) {
+    return NULL;
+  }
+
+  fill_eviction_atlas(atlas, threads);
+  return atlas;
+}
+
+/*********************************************************************
+ * Reporting
+ *********************************************************************/
+
+void print_atlas_coverage(EvictionAtlas *atlas) {
+  int counts[NUM_ATLAS_STATES] = {0};
+  int complete = 0;
+  int total = atlas->sets * atlas->slices;
+
+  for (int set = 0; set < atlas->sets; set++) {
+    bool covered = true;
+    for (int slice = 0; slice < atlas->slices; slice++) {
+      AtlasState state = atlas_entry(atlas, set, slice)->state;
+      counts[state]++;
+      covered &= state == ATLAS_VERIFIED || state == ATLAS_REBUILT;
+    }
+    complete += covered;
+  }
+
+  printf("Eviction atlas: %d sets x %d slices from base set %d (%s)\n",
+         atlas->sets, atlas->slices, atlas->base_set, atlas->geometry->name);
+  for (int state = 0; state < NUM_ATLAS_STATES; state++) {
+    printf("  %-9s %7d (%5.1f%%)\n", atlas_state_name(state), counts[state],
+           100.0 * counts[state] / total);
+  }
+  printf("  complete set indices: %d/%d\n", complete, atlas->sets);
+  printf("  base/load %.3f s, derive %.3f s, verify %.2f s, rebuild %.2f s\n",
+         atlas->seconds[0], atlas->seconds[1], atlas->seconds[2],
+         atlas->seconds[3]);
+}
+
+void free_eviction_atlas(EvictionAtlas *atlas) {
+  for (int i = 0; i < atlas->sets * atlas->slices; i++) {
+    clear_atlas_entry(&atlas->entries[i]);
+  }
+  free(atlas->entries);
+  free_hugepage_pool(atlas->pool);
+  free(atlas);
+}
@@ -0,0 +1,333 @@
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../lib/atlas.h"
+#include "../lib/atlas_cache.h"
+#include "../lib/eviction.h"
+#include "../lib/geometry.h"
+#include "../lib/pagemap.h"
+
+/*********************************************************************
+ * Hugepages
+ *********************************************************************/
+
+// Physical address of each hugepage of pool, or (uint64_t)-1 where pagemap
+// is unavailable or hides frame numbers
+uint64_t *hugepage_pas(HugepagePool *pool, uint32_t hugepages) {
+  uint64_t *pas = malloc(hugepages * sizeof(uint64_t));
+  void **vas = malloc(hugepages * sizeof(void *));
+  uintptr_t *translated = malloc(hugepages * sizeof(uintptr_t));
+  int page_bits = pool->geometry->hugepage_bits;
+
+  for (uint32_t i = 0; i < hugepages; i++) {
+    vas[i] = pool->start + ((size_t)i << page_bits);
+    translated[i] = -1;
+  }
+
+  if (open_pagemap_reader()) {
+    // The pool may reuse the addresses of an earlier mapping
+    pagemap_invalidate(pagemap_reader, pool->start, pool->bytes);
+    pagemap_translate(pagemap_reader, vas, translated, hugepages);
+  }
+
+  for (uint32_t i = 0; i < hugepages; i++) {
+    // Without CAP_SYS_ADMIN every frame number reads as 0
+    pas[i] = translated[i] == 0 ? (uint64_t)-1 : translated[i];
+  }
+
+  free(translated);
+  free(vas);
+
+  return pas;
+}
+
+// Map each saved hugepage onto the new hugepage with the same physical
+// address, marking it in confirmed, and the rest onto the unclaimed new
+// hugepages in order. Returns the new index of each saved hugepage.
+uint32_t *place_hugepages(uint64_t *saved, uint64_t *current,
+                          uint32_t hugepages, bool *confirmed) {
+  uint32_t *placement = malloc(hugepages * sizeof(uint32_t));
+  bool *claimed = calloc(hugepages, sizeof(bool));
+
+  for (uint32_t i = 0; i < hugepages; i++) {
+    confirmed[i] = false;
+    for (uint32_t j = 0; j < hugepages && saved[i] != (uint64_t)-1; j++) {
+      if (!claimed[j] && current[j] == saved[i]) {
+        placement[i] = j;
+        claimed[j] = confirmed[i] = true;
+        break;
+      }
+    }
+  }
+
+  uint32_t next = 0;
+  for (uint32_t i = 0; i < hugepages; i++) {
+    if (confirmed[i]) {
+      continue;
+    }
+    while (claimed[next]) {
+      next++;
+    }
+    placement[i] = next;
+    claimed[next] = true;
+  }
+
+  free(claimed);
+
+  return placement;
+}
+
+/*********************************************************************
+ * Saving
+ *********************************************************************/
+
+uint32_t pool_hugepages(HugepagePool *pool) {
+  return pool->bytes >> pool->geometry->hugepage_bits;
+}
+
+// Write the verified and rebuilt entries of atlas to path. The file is
+// written next to path and renamed over it, so a reader never sees a partial
+// cache. Returns false if it could not be written.
+bool save_eviction_atlas(EvictionAtlas *atlas, const char *path) {
+  size_t path_bytes = strlen(path) + 5;
+  char *tmp_path = malloc(path_bytes);
+  snprintf(tmp_path, path_bytes, "%s.tmp", path);
+
+  FILE *file = fopen(tmp_path, "wb");
+  if (file == NULL) {
+    perror("fopen atlas cache");
+    free(tmp_path);
+    return false;
+  }
+
+  AtlasCacheHeader header = {0};
+  memcpy(header.magic, ATLAS_CACHE_MAGIC, sizeof(ATLAS_CACHE_MAGIC));
+  header.version = ATLAS_CACHE_VERSION;
+  header.fingerprint = geometry_fingerprint(atlas->geometry);
+  snprintf(header.cpu, sizeof(header.cpu), "%s", atlas->geometry->name);
+  header.threshold = atlas->threshold;
+  header.created = time(NULL);
+  header.sets = atlas->sets;
+  header.slices = atlas->slices;
+  header.base_set = atlas->base_set;
+  header.pool_bytes = atlas->pool->bytes;
+  header.hugepages = pool_hugepages(atlas->pool);
+
+  uint64_t *pas = hugepage_pas(atlas->pool, header.hugepages);
+  fwrite(&header, sizeof(header), 1, file);
+  fwrite(pas, sizeof(uint64_t), header.hugepages, file);
+  free(pas);
+
+  for (int i = 0; i < atlas->sets * atlas->slices; i++) {
+    AtlasEntry *entry = &atlas->entries[i];
+    AtlasCacheEntry record = {ATLAS_MISSING, 0, 0};
+
+    if (entry->state == ATLAS_VERIFIED || entry->state == ATLAS_REBUILT) {
+      record.state = entry->state;
+      record.size = entry->lines->size;
+      record.victim = (uint8_t *)entry->victim - atlas->pool->start;
+    }
+    fwrite(&record, sizeof(record), 1, file);
+
+    for (uint32_t j = 0; j < record.size; j++) {
+      uint64_t offset =
+          (uint8_t *)entry->lines->cache_lines[j] - atlas->pool->start;
+      fwrite(&offset, sizeof(offset), 1, file);
+    }
+  }
+
+  bool ok = !ferror(file);
+  ok &= fclose(file) == 0;
+  if (ok && rename(tmp_path, path) != 0) {
+    perror("rename atlas cache");
+    ok = false;
+  }
+  if (!ok) {
+    remove(tmp_path);
+  }
+  free(tmp_path);
+
+  return ok;
+}
+
+/*********************************************************************
+ * Loading
+ *********************************************************************/
+
+// Whether header describes an atlas built on this machine with geometry
+bool atlas_cache_matches(AtlasCacheHeader *header, CacheGeometry *geometry,
+                         const char *path) {
+  if (memcmp(header->magic, ATLAS_CACHE_MAGIC, sizeof(ATLAS_CACHE_MAGIC)) ||
+      header->version != ATLAS_CACHE_VERSION) {
+    fprintf(stderr, "warning: %s is not an eviction atlas cache\n", path);
+    return false;
+  }
+
+  header->cpu[sizeof(header->cpu) - 1] = '\0';
+  if (header->fingerprint != geometry_fingerprint(geometry) ||
+      header->sets != 1 << geometry->set_bits ||
+      header->slices != geometry->slices) {
+    fprintf(stderr, "warning: %s was built for %s, ignoring it\n", path,
+            header->cpu);
+    return false;
+  }
+
+  return true;
+}
+
+// Read the entries of a cache file into atlas, moving each line onto its new
+// hugepage. Entries that lie only on confirmed hugepages keep their saved
+// state; the others are marked derived. Returns false on a short read, or on
+// an entry that save_eviction_atlas could not have written.
+bool read_atlas_entries(FILE *file, EvictionAtlas *atlas, uint32_t *placement,
+                        bool *confirmed) {
+  int page_bits = atlas->geometry->hugepage_bits;
+  uint64_t page_mask = ((uint64_t)1 << page_bits) - 1;
+  uint32_t hugepages = pool_hugepages(atlas->pool);
+  // Minimal sets have about ways lines; reductions never return twice that
+  uint32_t max_size = 2 * (atlas->geometry->ways + 1);
+
+  for (int i = 0; i < atlas->sets * atlas->slices; i++) {
+    AtlasCacheEntry record;
+    if (fread(&record, sizeof(record), 1, file) != 1) {
+      return false;
+    }
+    if (record.size == 0) {
+      continue;
+    }
+    // Only verified and rebuilt entries are saved
+    if ((record.state != ATLAS_VERIFIED && record.state != ATLAS_REBUILT) ||
+        record.size > max_size) {
+      return false;
+    }
+
+    AtlasEntry *entry = &atlas->entries[i];
+    entry->lines = new_cl_set();
+    reserve_cl_set(entry->lines, record.size);
+    bool moved = false;
+
+    for (uint32_t j = 0; j <= record.size; j++) {
+      uint64_t offset = record.victim;
+      if (j < record.size && fread(&offset, sizeof(offset), 1, file) != 1) {
+        return false;
+      }
+
+      uint64_t page = offset >> page_bits;
+      if (page >= hugepages) {
+        return false;
+      }
+      moved |= !confirmed[page];
+
+      CacheLine *cl = (CacheLine *)(atlas->pool->start +
+                                    ((uint64_t)placement[page] << page_bits) +
+                                    (offset & page_mask));
+      if (j < record.size) {
+        push_cache_line(entry->lines, cl);
+      } else {
+        entry->victim = cl;
+      }
+    }
+
+    entry->state = moved ? ATLAS_DERIVED : (AtlasState)record.state;
+  }
+
+  return true;
+}
+
+// Load an atlas saved by save_eviction_atlas into newly mapped hugepages,
+// verifying moved entries with threads threads and rebuilding the set indices
+// that fail. Returns NULL if path does not exist, was saved on another
+// machine or geometry, or cannot be mapped.
+EvictionAtlas *load_eviction_atlas(const char *path, CacheGeometry *geometry,
+                                   int threads) {
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    return NULL;
+  }
+
+  AtlasCacheHeader header;
+  if (fread(&header, sizeof(header), 1, file) != 1 ||
+      !atlas_cache_matches(&header, geometry, path)) {
+    fclose(file);
+    return NULL;
+  }
+
+  EvictionAtlas *atlas = new_eviction_atlas(geometry, header.base_set);
+  if (atlas == NULL) {
+    fclose(file);
+    return NULL;
+  }
+
+  bool ok = atlas->pool->bytes == header.pool_bytes &&
+            header.hugepages == pool_hugepages(atlas->pool);
+  uint64_t *saved = malloc(ok ? header.hugepages * sizeof(uint64_t) : 0);
+  bool *confirmed = malloc(ok ? header.hugepages * sizeof(bool) : 0);
+  uint32_t *placement = NULL;
+  ok = ok && fread(saved, sizeof(uint64_t), header.hugepages, file) ==
+                 header.hugepages;
+
+  if (ok) {
+    uint64_t *current = hugepage_pas(atlas->pool, header.hugepages);
+    placement = place_hugepages(saved, current, header.hugepages, confirmed);
+    free(current);
+    ok = read_atlas_entries(file, atlas, placement, confirmed);
+  }
+
+  free(placement);
+  free(confirmed);
+  free(saved);
+  fclose(file);
+
+  if (!ok) {
+    fprintf(stderr,
+            "warning: %s is truncated, corrupt or from another pool size\n",
+            path);
+    free_eviction_atlas(atlas);
+    return NULL;
+  }
+
+#ifndef __MEASURE__
+  printf("Loaded eviction atlas from %s (threshold %lu, now %lu).\n", path,
+         header.threshold, atlas->threshold);
+#endif
+
+  atlas->seconds[0] = seconds_since(&start);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  verify_eviction_atlas(atlas, threads);
+  atlas->seconds[2] = seconds_since(&start);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  rebuild_eviction_atlas(atlas);
+  atlas->seconds[3] = seconds_since(&start);
+
+  return atlas;
+}
+
+// Load the atlas cached at path, or build it from base_set and save it there
+// if there is no usable cache
+EvictionAtlas *cached_eviction_atlas(const char *path,
+                                     CacheGeometry *geometry, int base_set,
+                                     int threads) {
+  EvictionAtlas *atlas = load_eviction_atlas(path, geometry, threads);
+  if (atlas != NULL) {
+    // Keep the cache in step with rebuilt or moved entries
+    save_eviction_atlas(atlas, path);
+    return atlas;
+  }
+
+  atlas = build_eviction_atlas(geometry, base_set, threads);
+  if (atlas != NULL) {
+    save_eviction_atlas(atlas, path);
+  }
+
+  return atlas;
+}
@@ -0,0 +1,1292 @@
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <x86intrin.h>
+
+#include "../lib/atlas.h"
+#include "../lib/constants.h"
+#include "../lib/eviction.h"
+#include "../lib/l3pp.h"
+#include "../lib/pipeline.h"
+#include "../lib/probe_ring.h"
+#include "../lib/sender.h"
+#include "../lib/simulator.h"
+#include "../lib/traversal.h"
+#include "../lib/utils.h"
+
+// Number of times each benchmark is repeated
+#define BENCH_REPS 5
+
+unsigned int core_id = 0;
+
+/*********************************************************************
+ * CacheLineSet storage
+ *
+ * Replays the CacheLineSet operations of one get_minimal_set call (inflate to
+ * INITIAL_SIZE, then reduce2 rounds of BINS bins with 3 evict_and_time calls
+ * per bin) without touching memory, so only allocator and copying time is
+ * measured. The legacy_* functions are the previous realloc-per-push
+ * implementation, kept here for comparison.
+ *********************************************************************/
+
+void legacy_push(CacheLineSet *cl_set, CacheLine *cl) {
+  cl_set->size++;
+  cl_set->cache_lines =
+      reallocarray(cl_set->cache_lines, cl_set->size, sizeof(CacheLine));
+  cl_set->cache_lines[cl_set->size - 1] = cl;
+}
+
+CacheLine *legacy_remove(CacheLineSet *cl_set, int index) {
+  CacheLine *removed = cl_set->cache_lines[index];
+  CacheLine **new_cache_lines = calloc(cl_set->size - 1, sizeof(CacheLine *));
+
+  for (int i = 0; i < index; i++) {
+    new_cache_lines[i] = cl_set->cache_lines[i];
+  }
+  for (int i = index + 1; i < cl_set->size; i++) {
+    new_cache_lines[i - 1] = cl_set->cache_lines[i];
+  }
+
+  cl_set->size--;
+  free(cl_set->cache_lines);
+  cl_set->cache_lines = new_cache_lines;
+
+  return removed;
+}
+
+uint64_t replay_minimal_set(bool legacy) {
+  uint64_t t0 = __rdtscp(&core_id);
+
+  CacheLineSet *cl_set = new_cl_set();
+  CacheLineSet *reserve = new_cl_set();
+
+  for (int i = 0; i < INITIAL_SIZE; i++) {
+    CacheLine *cl = (CacheLine *)(uintptr_t)((i + 1) << PAGE_OFFSET_BITS);
+    legacy ? legacy_push(cl_set, cl) : push_cache_line(cl_set, cl);
+  }
+
+  // Every round, a quarter of the bins can be left out
+  while (cl_set->size > cache_geometry->ways) {
+    int step_size = MAX(cl_set->size / BINS, 1);
+    int num_bins = (cl_set->size + step_size - 1) / step_size;
+    CacheLineSet *set = new_cl_set();
+
+    for (int b = 0; b < num_bins; b++) {
+      set->size = 0;
+      if (!legacy) {
+        reserve_cl_set(set, cl_set->size);
+      }
+      for (int j = 0; j < cl_set->size; j++) {
+        if (j / step_size == b) {
+          continue;
+        }
+        legacy ? legacy_push(set, cl_set->cache_lines[j])
+               : push_cache_line(set, cl_set->cache_lines[j]);
+      }
+
+      // The copy made by each evict_and_time call
+      for (int k = 0; k < 3; k++) {
+        CacheLineSet *second = new_cl_set();
+        if (!legacy) {
+          reserve_cl_set(second, set->size);
+        }
+        for (int j = 0; j < set->size; j++) {
+          legacy ? legacy_push(second, set->cache_lines[j])
+                 : push_cache_line(second, set->cache_lines[j]);
+        }
+        free_cl_set(second);
+      }
+
+      if (legacy) {
+        free(set->cache_lines);
+        set->cache_lines = NULL;
+      }
+    }
+    free_cl_set(set);
+
+    for (int b = num_bins - 1; b >= 0; b -= 4) {
+      int low = b * step_size;
+      int high = MIN(low + step_size, cl_set->size);
+      if (cl_set->size - (high - low) < cache_geometry->ways) {
+        break;
+      }
+      for (int j = high - 1; j >= low; j--) {
+        if (legacy) {
+          legacy_push(reserve, legacy_remove(cl_set, j));
+        } else {
+          push_cache_line(reserve, cl_set->cache_lines[j]);
+        }
+      }
+      if (!legacy) {
+        remove_cache_line_range(cl_set, low, high);
+      }
+    }
+
+    if (num_bins < 4) {
+      break;
+    }
+  }
+
+  free_cl_set(cl_set);
+  free_cl_set(reserve);
+
+  return __rdtscp(&core_id) - t0;
+}
+
+void bench_cl_set_storage(void) {
+  NumList *legacy = new_num_list(BENCH_REPS);
+  NumList *amortized = new_num_list(BENCH_REPS);
+
+  for (int i = 0; i < BENCH_REPS; i++) {
+    push_num(legacy, replay_minimal_set(true));
+    push_num(amortized, replay_minimal_set(false));
+  }
+
+  printf("CacheLineSet storage cycles per get_minimal_set (%u lines):\n",
+         INITIAL_SIZE);
+  printf("  realloc per push: %lu\n", median_and_sort(legacy));
+  printf("  amortized:        %lu\n", median_and_sort(amortized));
+
+  free_num_list(legacy);
+  free_num_list(amortized);
+}
+
+/*********************************************************************
+ * Candidate allocation
+ *
+ * Time to hand out the INITIAL_SIZE candidate lines of one inflate, first
+ * from the heap as before and then from the candidate arena, both on first
+ * use and after the lines have been released for a retry.
+ *********************************************************************/
+
+uint64_t allocate_candidates(CacheLineSet *cl_set, uint8_t *victim,
+                             bool heap) {
+  uint64_t t0 = __rdtscp(&core_id);
+  for (int i = 0; i < INITIAL_SIZE; i++) {
+    if (heap) {
+      void *page = aligned_alloc(PAGE_BYTES, PAGE_BYTES);
+      memset(page, 0xFF, PAGE_BYTES);
+      push_cache_line(cl_set, (CacheLine *)page);
+    } else {
+      push_cache_line(cl_set, allocate_cache_line(victim));
+    }
+  }
+  return __rdtscp(&core_id) - t0;
+}
+
+void bench_candidate_arena(void) {
+  uint8_t victim;
+  CacheLineSet *cl_set = new_cl_set();
+
+  uint64_t heap = allocate_candidates(cl_set, &victim, true);
+  for (int i = 0; i < cl_set->size; i++) {
+    free(cl_set->cache_lines[i]);
+  }
+  cl_set->size = 0;
+
+  candidate_arena = new_candidate_arena(ARENA_PAGES, false);
+  uint64_t fresh = allocate_candidates(cl_set, &victim, false);
+  deep_free_cl_set(cl_set);
+  cl_set = new_cl_set();
+  uint64_t reused = allocate_candidates(cl_set, &victim, false);
+  deep_free_cl_set(cl_set);
+  free_candidate_arena(candidate_arena);
+
+  candidate_arena = new_candidate_arena(ARENA_PAGES, true);
+  cl_set = new_cl_set();
+  uint64_t populated = allocate_candidates(cl_set, &victim, false);
+  deep_free_cl_set(cl_set);
+  free_candidate_arena(candidate_arena);
+  candidate_arena = NULL;
+
+  printf("Cycles to allocate %u candidate lines:\n", INITIAL_SIZE);
+  printf("  aligned_alloc + memset: %lu\n", heap);
+  printf("  arena, first use:       %lu\n", fresh);
+  printf("  arena, reused:          %lu\n", reused);
+  printf("  arena, MAP_POPULATE:    %lu\n", populated);
+}
+
+/*********************************************************************
+ * Reduction
+ *
+ * Reduces the same INITIAL_SIZE-line set with reduce2 and with
+ * reduce_group_testing, first with repeated evict_and_time medians and then
+ * with sequential tests, reporting tests, samples and wall time. Needs real
+ * hardware; each reduction starts from its own copy of the set.
+ *********************************************************************/
+
+void run_reduction(const char *name, ReduceFunction reduce,
+                   CacheLineSet *initial, uint8_t *victim,
+                   uint64_t threshold) {
+  CacheLineSet *cl_set = new_cl_set();
+  reserve_cl_set(cl_set, initial->size);
+  for (int i = 0; i < initial->size; i++) {
+    push_cache_line(cl_set, initial->cache_lines[i]);
+  }
+  CacheLineSet *reserve = new_cl_set();
+
+  uint64_t tests = eviction_tests;
+  uint64_t samples = eviction_samples;
+  uint64_t t0 = __rdtscp(&core_id);
+  bool result = reduce(cl_set, reserve, victim, SAMPLES, threshold, BINS);
+  uint64_t cycles = __rdtscp(&core_id) - t0;
+
+  printf("  %-20s %-10s %s to %u lines, %lu tests, %lu samples, %lu cycles\n",
+         name, sequential_tests ? "sequential" : "median",
+         result ? "reduced" : "failed", cl_set->size, eviction_tests - tests,
+         eviction_samples - samples, cycles);
+
+  free_cl_set(reserve);
+  free_cl_set(cl_set);
+}
+
+void bench_reduction(void) {
+  uint8_t victim = 0x37;
+  uint64_t threshold = threshold_from_flush(&victim);
+
+  CacheLineSet *initial = new_cl_set();
+  for (int i = 0; i < INITIAL_SIZE; i++) {
+    push_cache_line(initial, allocate_cache_line(&victim));
+  }
+
+  printf("Reducing a %u-line set:\n", INITIAL_SIZE);
+  for (int i = 0; i < 2; i++) {
+    sequential_tests = i == 1;
+    run_reduction("reduce2", reduce2, initial, &victim, threshold);
+    run_reduction("reduce_group_testing", reduce_group_testing, initial,
+                  &victim, threshold);
+  }
+  sequential_tests = false;
+
+  deep_free_cl_set(initial);
+}
+
+/*********************************************************************
+ * Traversal
+ *
+ * Profiles every traversal kernel on a minimal eviction set (or on the last
+ * inflated set if reduction fails), for the current traversal_config.
+ *********************************************************************/
+
+void bench_traversal(void) {
+  uint8_t victim = 0x37;
+  uint64_t threshold = threshold_from_flush(&victim);
+  CacheLineSet *cl_set;
+
+  reduce_function = reduce_group_testing;
+  bool minimal = get_minimal_set(&victim, &cl_set, threshold);
+  reduce_function = reduce2;
+
+  printf("Traversal kernels on a %s set of %u lines, %u ways:\n",
+         minimal ? "minimal" : "non-minimal", cl_set->size,
+         traversal_config.ways);
+  profile_traversal_kernels(cl_set, &victim, threshold);
+
+  deep_free_cl_set(cl_set);
+}
+
+/*********************************************************************
+ * Pagemap
+ *
+ * Translates the INITIAL_SIZE lines of an inflate-sized set, first the way
+ * virt_to_phys_user did (open, pread and close for every line), then with
+ * pagemap_reader after invalidating it, and then again from its cache.
+ *********************************************************************/
+
+uintptr_t legacy_pointer_to_pa(void *va) {
+  char path[64];
+  uint64_t data = 0;
+
+  snprintf(path, sizeof(path), "/proc/%ju/pagemap", (uintmax_t)getpid());
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+  pread(fd, &data, sizeof(data),
+        ((uintptr_t)va >> PAGE_OFFSET_BITS) * sizeof(data));
+  close(fd);
+
+  return ((data & (((uint64_t)1 << 54) - 1)) << PAGE_OFFSET_BITS) |
+         ((uintptr_t)va & (PAGE_BYTES - 1));
+}
+
+void bench_pagemap(void) {
+  uint8_t victim = 0x37;
+  CacheLineSet *cl_set = new_cl_set();
+  uintptr_t *pas = malloc(INITIAL_SIZE * sizeof(uintptr_t));
+
+  for (int i = 0; i < INITIAL_SIZE; i++) {
+    push_cache_line(cl_set, allocate_cache_line(&victim));
+  }
+
+  uint64_t t0 = __rdtscp(&core_id);
+  for (int i = 0; i < cl_set->size; i++) {
+    pas[i] = legacy_pointer_to_pa(cl_set->cache_lines[i]);
+  }
+  uint64_t legacy = __rdtscp(&core_id) - t0;
+
+  cl_set_to_pas(cl_set, pas);
+  pagemap_invalidate_all(pagemap_reader);
+  uint64_t reads = pagemap_reader->reads;
+  t0 = __rdtscp(&core_id);
+  cl_set_to_pas(cl_set, pas);
+  uint64_t cold = __rdtscp(&core_id) - t0;
+  reads = pagemap_reader->reads - reads;
+
+  t0 = __rdtscp(&core_id);
+  cl_set_to_pas(cl_set, pas);
+  uint64_t warm = __rdtscp(&core_id) - t0;
+
+  printf("Cycles to translate %u lines:\n", INITIAL_SIZE);
+  printf("  open/pread/close per line: %lu\n", legacy);
+  printf("  batched, uncached:         %lu (%lu preads)\n", cold, reads);
+  printf("  batched, cached:           %lu\n", warm);
+
+  free(pas);
+  deep_free_cl_set(cl_set);
+}
+
+/*********************************************************************
+ * Candidate pipeline
+ *
+ * Cycles the measuring thread spends preparing candidates for one inflate
+ * (INITIAL_SIZE lines) and for the first BENCH_MATCHES allocate_matching calls
+ * of generate_sets, with the candidate arena and with a candidate pipeline on
+ * another core that has had time to fill its ring.
+ *********************************************************************/
+
+#define BENCH_MATCHES 64
+
+uint64_t prepare_candidates(uint8_t *victim) {
+  CacheLineSet *cl_set = new_cl_set();
+
+  uint64_t t0 = __rdtscp(&core_id);
+  for (int i = 0; i < INITIAL_SIZE; i++) {
+    push_cache_line(cl_set, allocate_cache_line(victim));
+  }
+  for (int i = 0; i < BENCH_MATCHES; i++) {
+    push_cache_line(cl_set,
+                    allocate_matching(victim, MATCHING_BITS, cache_geometry));
+  }
+  uint64_t cycles = __rdtscp(&core_id) - t0;
+
+  deep_free_cl_set(cl_set);
+  return cycles;
+}
+
+void bench_pipeline(void) {
+  uint8_t victim = 0x37;
+  uint64_t arena = prepare_candidates(&victim);
+
+  pin_measuring_thread();
+  int cpu = pick_helper_cpu();
+  candidate_pipeline = new_candidate_pipeline(PIPELINE_BATCH, cpu, true);
+  sleep(1);
+  uint64_t pipelined = prepare_candidates(&victim);
+
+  printf("Cycles to prepare %u candidates and %u matching lines:\n",
+         INITIAL_SIZE, BENCH_MATCHES);
+  printf("  candidate arena:    %lu\n", arena);
+  printf("  pipeline on CPU %d: %lu (%lu batches, %lu stalls)\n", cpu,
+         pipelined, candidate_pipeline->batches, candidate_pipeline->stalls);
+
+  free_candidate_pipeline(candidate_pipeline);
+  candidate_pipeline = NULL;
+}
+
+/*********************************************************************
+ * Slice hash
+ *
+ * Classifies BENCH_PAS random physical addresses with the previous
+ * get_bit-based i7-2600 hash, with pa_to_slice one address at a time, and
+ * with pas_to_slices in one batch, and checks that all three agree.
+ *********************************************************************/
+
+#define BENCH_PAS (1 << 20)
+
+int legacy_i7_2600_slice(uintptr_t pa) {
+  int h1 = get_bit(pa, 33) ^ get_bit(pa, 32) ^ get_bit(pa, 30) ^
+           get_bit(pa, 28) ^ get_bit(pa, 27) ^ get_bit(pa, 26) ^
+           get_bit(pa, 25) ^ get_bit(pa, 24) ^ get_bit(pa, 22) ^
+           get_bit(pa, 20) ^ get_bit(pa, 18) ^ get_bit(pa, 17) ^
+           get_bit(pa, 16) ^ get_bit(pa, 14) ^ get_bit(pa, 12) ^
+           get_bit(pa, 10) ^ get_bit(pa, 6);
+  int h2 = get_bit(pa, 34) ^ get_bit(pa, 33) ^ get_bit(pa, 31) ^
+           get_bit(pa, 29) ^ get_bit(pa, 28) ^ get_bit(pa, 26) ^
+           get_bit(pa, 24) ^ get_bit(pa, 23) ^ get_bit(pa, 22) ^
+           get_bit(pa, 21) ^ get_bit(pa, 20) ^ get_bit(pa, 19) ^
+           get_bit(pa, 17) ^ get_bit(pa, 15) ^ get_bit(pa, 13) ^
+           get_bit(pa, 11) ^ get_bit(pa, 7);
+
+  return (h1 << 1) + h2;
+}
+
+void bench_slice_hash(void) {
+  SliceHash *hash = find_slice_hash(0x2A, 4);
+  uintptr_t *pas = malloc(BENCH_PAS * sizeof(uintptr_t));
+  int *legacy = malloc(BENCH_PAS * sizeof(int));
+  int *single = malloc(BENCH_PAS * sizeof(int));
+  int *batch = malloc(BENCH_PAS * sizeof(int));
+
+  // 16 GB of physical memory, as on the i7-2600
+  for (int i = 0; i < BENCH_PAS; i++) {
+    pas[i] = (((uintptr_t)rand() << 31) ^ rand()) & ((1ULL << 34) - 1);
+  }
+
+  uint64_t t0 = __rdtscp(&core_id);
+  for (int i = 0; i < BENCH_PAS; i++) {
+    legacy[i] = legacy_i7_2600_slice(pas[i]);
+  }
+  uint64_t legacy_cycles = __rdtscp(&core_id) - t0;
+
+  t0 = __rdtscp(&core_id);
+  for (int i = 0; i < BENCH_PAS; i++) {
+    single[i] = pa_to_slice(hash, pas[i]);
+  }
+  uint64_t single_cycles = __rdtscp(&core_id) - t0;
+
+  t0 = __rdtscp(&core_id);
+  pas_to_slices(hash, pas, batch, BENCH_PAS);
+  uint64_t batch_cycles = __rdtscp(&core_id) - t0;
+
+  int mismatches = 0;
+  for (int i = 0; i < BENCH_PAS; i++) {
+    int swapped = ((single[i] & 1) << 1) | (single[i] >> 1);
+    mismatches += legacy[i] != swapped || single[i] != batch[i];
+  }
+
+  printf("Cycles per address to find the slice of %u addresses:\n",
+         BENCH_PAS);
+  printf("  get_bit:       %.2f\n", (double)legacy_cycles / BENCH_PAS);
+  printf("  pa_to_slice:   %.2f\n", (double)single_cycles / BENCH_PAS);
+  printf("  pas_to_slices: %.2f\n", (double)batch_cycles / BENCH_PAS);
+  printf("  mismatches:    %d\n", mismatches);
+
+  free(batch);
+  free(single);
+  free(legacy);
+  free(pas);
+}
+
+/*********************************************************************
+ * Timers
+ *
+ * Creates a timer with each backend and reports its resolution and
+ * overhead, the median of TIMER_CALIBRATION_SAMPLES cached and flushed loads
+ * after the overhead is subtracted, and the threshold estimate_threshold
+ * picks from them with its separation margin and misclassification rate.
+ *********************************************************************/
+
+void bench_timing(void) {
+  uint8_t *victim = aligned_alloc(PAGE_BYTES, PAGE_BYTES);
+  NumList *hits = new_num_list(TIMER_CALIBRATION_SAMPLES);
+  NumList *misses = new_num_list(TIMER_CALIBRATION_SAMPLES);
+  memset(victim, 0x37, PAGE_BYTES);
+
+  printf("%-16s %10s %9s %6s %6s %9s %6s %7s\n", "Backend", "resolution",
+         "overhead", "hit", "miss", "threshold", "margin", "errors");
+  for (int b = 0; b < NUM_TIMER_BACKENDS; b++) {
+    Timer *timer = new_timer(b);
+    if (timer == NULL) {
+      printf("%-16s unavailable\n", timer_backend_name(b));
+      continue;
+    }
+
+    clear_num_list(hits);
+    clear_num_list(misses);
+    for (int i = 0; i < TIMER_CALIBRATION_SAMPLES; i++) {
+      push_num(hits, timer_load(timer, victim));
+      _mm_clflush(victim);
+      push_num(misses, timer_load(timer, victim));
+    }
+
+    uint64_t hit = median_and_sort(hits);
+    uint64_t miss = median_and_sort(misses);
+    ThresholdEstimate estimate = estimate_threshold(hits, misses);
+
+    printf("%-16s %10lu %9lu %6lu %6lu %9lu %6.2f %6.1f%%\n",
+           timer_backend_name(b), timer->resolution, timer->overhead, hit,
+           miss, estimate.threshold, estimate.margin, 100 * estimate.error);
+    free_timer(timer);
+  }
+
+  free_num_list(misses);
+  free_num_list(hits);
+  free(victim);
+}
+
+/*********************************************************************
+ * Latency Histograms
+ *
+ * Compares the median of SAMPLES timings by median_and_sort, as
+ * evict_and_time used to take it, with clearing a LatencyHistogram,
+ * inserting the same timings and taking its median. The timings are
+ * synthetic hits, misses and rare interrupts. Also times one
+ * merge_latency_histograms and a million inserts into a streaming histogram.
+ *********************************************************************/
+
+#define HISTOGRAM_BENCH_BATCHES 10000
+
+uint64_t synthetic_timing(void) {
+  int r = rand() % 1000;
+  if (r == 0) {
+    return 5000 + rand() % 50000;
+  }
+  return r < 500 ? 40 + rand() % 40 : 250 + rand() % 150;
+}
+
+void bench_histogram(void) {
+  NumList *timings = new_num_list(SAMPLES);
+  LatencyHistogram *h = new_latency_histogram(0);
+  LatencyHistogram *other = new_latency_histogram(0);
+  uint64_t sort_cycles = 0, histogram_cycles = 0;
+  int mismatches = 0;
+
+  srand(1);
+  for (int batch = 0; batch < HISTOGRAM_BENCH_BATCHES; batch++) {
+    clear_num_list(timings);
+    for (int i = 0; i < SAMPLES; i++) {
+      push_num(timings, synthetic_timing());
+    }
+
+    uint64_t t0 = __rdtscp(&core_id);
+    clear_latency_histogram(h);
+    for (int i = 0; i < SAMPLES; i++) {
+      histogram_insert(h, timings->nums[i]);
+    }
+    uint64_t by_histogram = histogram_median(h);
+    uint64_t t1 = __rdtscp(&core_id);
+    uint64_t by_sort = median_and_sort(timings);
+    uint64_t t2 = __rdtscp(&core_id);
+
+    histogram_cycles += t1 - t0;
+    sort_cycles += t2 - t1;
+    mismatches += by_histogram != by_sort;
+  }
+
+  clear_latency_histogram(h);
+  uint64_t t0 = __rdtscp(&core_id);
+  for (int i = 0; i < 1000000; i++) {
+    histogram_insert(h, 40 + (i & 511));
+  }
+  uint64_t t1 = __rdtscp(&core_id);
+  merge_latency_histograms(other, h);
+  uint64_t t2 = __rdtscp(&core_id);
+
+  printf("Cycles per median of %d timings (%d batches):\n", SAMPLES,
+         HISTOGRAM_BENCH_BATCHES);
+  printf("  median_and_sort: %lu\n", sort_cycles / HISTOGRAM_BENCH_BATCHES);
+  printf("  histogram:       %lu\n",
+         histogram_cycles / HISTOGRAM_BENCH_BATCHES);
+  printf("  mismatches:      %d\n", mismatches);
+  printf("Cycles per streaming insert: %.2f\n", (t1 - t0) / 1e6);
+  printf("Cycles per merge (%d buckets): %lu\n", HISTOGRAM_BUCKETS, t2 - t1);
+  printf("Streaming p50 %lu p99 %lu, at least 300: %lu\n",
+         histogram_median(other), histogram_percentile(other, 99),
+         histogram_count_at_least(other, 300));
+
+  free_latency_histogram(other);
+  free_latency_histogram(h);
+  free_num_list(timings);
+}
+
+/*********************************************************************
+ * Probe Ring
+ *
+ * Pushes two windows of PROBES_PER_WINDOW synthetic probe outcomes (runs of
+ * hits at random intervals) through a ProbeRing of one window, so that it
+ * wraps, then counts the detections of the latest window by popcount.
+ * legacy_filter_and_count is the previous byte-per-probe filter_pp_results
+ * followed by a byte-wise count, kept here for comparison on the same
+ * outcomes.
+ *********************************************************************/
+
+uint64_t legacy_filter_and_count(uint8_t *results, uint64_t numBytes) {
+  int prev = 0;
+  for (uint64_t i = 0; i < numBytes; i++) {
+    if (prev == 1 && results[i] == 1) {
+      prev = 1;
+      results[i] = 0;
+    } else {
+      prev = results[i];
+    }
+  }
+
+  uint64_t count = 0;
+  for (uint64_t i = 0; i < numBytes; i++) {
+    count += results[i];
+  }
+  return count;
+}
+
+void bench_probe_ring(void) {
+  uint8_t *bytes = malloc(PROBES_PER_WINDOW);
+  ProbeRing *ring = new_probe_ring(PROBES_PER_WINDOW);
+
+  srand(1);
+  // One window of history so that the ring has wrapped
+  for (int i = 0; i < PROBES_PER_WINDOW; i++) {
+    probe_ring_push(ring, rand() % 4 == 0);
+  }
+  uint64_t first = ring->written;
+  int run = 0;
+  for (int i = 0; i < PROBES_PER_WINDOW; i++) {
+    if (run == 0 && rand() % 200 == 0) {
+      run = 1 + rand() % 8;
+    }
+    bytes[i] = run > 0;
+    probe_ring_push(ring, run > 0);
+    run -= run > 0;
+  }
+  uint64_t t1 = __rdtscp(&core_id);
+  uint64_t by_ring = probe_ring_count(ring, first, PROBES_PER_WINDOW, true);
+  uint64_t t2 = __rdtscp(&core_id);
+  uint64_t by_bytes = legacy_filter_and_count(bytes, PROBES_PER_WINDOW);
+  uint64_t t3 = __rdtscp(&core_id);
+
+  int mismatches = 0;
+  for (int i = 0; i < PROBES_PER_WINDOW; i += 64) {
+    uint64_t bits = probe_ring_detections(ring, first + i, 64);
+    for (int k = 0; k < 64; k++) {
+      mismatches += (bits >> k & 1) != bytes[i + k];
+    }
+  }
+
+  printf("Probe ring over %d probes:\n", PROBES_PER_WINDOW);
+  printf("  memory:               %lu KB (bytes: %d KB)\n",
+         ring->capacity / 8 / 1024, PROBES_PER_WINDOW / 1024);
+  printf("  filter and count:     %lu cycles (bytes: %lu)\n", t2 - t1,
+         t3 - t2);
+  printf("  detections:           %lu (bytes: %lu)\n", by_ring, by_bytes);
+  printf("  mismatches:           %d\n", mismatches);
+
+  free_probe_ring(ring);
+  free(bytes);
+}
+
+/*********************************************************************
+ * Trace Writer
+ *
+ * Appends TRACE_BENCH_RECORDS timestamps to a trace, one every
+ * TRACE_BENCH_GAP cycles (about one probe of a 16-way set), and reports the
+ * cycles spent appending, the longest append and how many records the writer
+ * thread could not keep up with. For comparison, the same records are written
+ * with flush_timestamps once per TRACE_BUFFER_RECORDS, as measure_keystroke
+ * used to after every window.
+ *********************************************************************/
+
+#define TRACE_BENCH_RECORDS (1024 * 1024)
+#define TRACE_BENCH_GAP 2000
+#define TRACE_BENCH_PATH "/tmp/bench.trace"
+#define TRACE_BENCH_LEGACY_PATH "/tmp/bench.bin"
+
+// Spin until the TSC passes until, standing in for a probe
+void spin_until(uint64_t until) {
+  while (__rdtscp(&core_id) < until) {
+  }
+}
+
+void bench_trace(void) {
+  TraceWriter *trace = open_trace_writer(TRACE_BENCH_PATH, 0, -1, 0);
+  if (trace == NULL) {
+    return;
+  }
+
+  uint64_t spent = 0, slowest = 0;
+  uint64_t next = __rdtscp(&core_id);
+  for (int i = 0; i < TRACE_BENCH_RECORDS; i++) {
+    spin_until(next += TRACE_BENCH_GAP);
+    uint64_t before = __rdtscp(&core_id);
+    trace_append(trace, before);
+    uint64_t cycles = __rdtscp(&core_id) - before;
+    spent += cycles;
+    slowest = MAX(slowest, cycles);
+  }
+  uint64_t dropped = __atomic_load_n(&trace->dropped, __ATOMIC_RELAXED);
+  close_trace_writer(trace);
+
+  uint64_t *records = malloc(TRACE_BUFFER_RECORDS * sizeof(uint64_t));
+  uint64_t legacy_spent = 0, legacy_slowest = 0;
+  unlink(TRACE_BENCH_LEGACY_PATH);
+  next = __rdtscp(&core_id);
+  for (int i = 0; i < TRACE_BENCH_RECORDS; i += TRACE_BUFFER_RECORDS) {
+    for (int j = 0; j < TRACE_BUFFER_RECORDS; j++) {
+      spin_until(next += TRACE_BENCH_GAP);
+      // Timed the same way as trace_append, so both include the rdtscp pair
+      uint64_t before = __rdtscp(&core_id);
+      records[j] = before;
+      legacy_spent += __rdtscp(&core_id) - before;
+    }
+    uint64_t before = __rdtscp(&core_id);
+    flush_timestamps(records, TRACE_BUFFER_RECORDS, TRACE_BENCH_LEGACY_PATH);
+    uint64_t cycles = __rdtscp(&core_id) - before;
+    legacy_spent += cycles;
+    legacy_slowest = MAX(legacy_slowest, cycles);
+  }
+
+  printf("Trace writer, %d records %d cycles apart:\n", TRACE_BENCH_RECORDS,
+         TRACE_BENCH_GAP);
+  printf("  cycles per record: %.2f (flush_timestamps: %.2f)\n",
+         (double)spent / TRACE_BENCH_RECORDS,
+         (double)legacy_spent / TRACE_BENCH_RECORDS);
+  printf("  longest stall:     %lu cycles (flush_timestamps: %lu)\n",
+         slowest, legacy_slowest);
+  printf("  dropped:           %lu\n", dropped);
+
+  free(records);
+  unlink(TRACE_BENCH_LEGACY_PATH);
+}
+
+/*********************************************************************
+ * Probe Modes
+ *
+ * Runs profile_probe_modes on a set of PROBE_BENCH_WAYS lines at the same
+ * page offset. They need not be congruent: the flushes stand in for a victim
+ * evicting one line, so this measures the cost and accuracy of each probe on
+ * any machine.
+ *********************************************************************/
+
+#define PROBE_BENCH_WAYS 16
+#define PROBE_BENCH_PROBES 100000
+
+void bench_probe_modes(void) {
+  uint8_t *pages = aligned_alloc(PAGE_BYTES, PROBE_BENCH_WAYS * PAGE_BYTES);
+  CacheLineSet *cl_set = new_cl_set();
+  for (int i = 0; i < PROBE_BENCH_WAYS; i++) {
+    push_cache_line(cl_set, (CacheLine *)(pages + i * PAGE_BYTES + 0x240));
+  }
+  // In a random order, so the stride prefetcher cannot run ahead of probe
+  shuffle_lines(cl_set);
+  EvictionSet *es = new_eviction_set(cl_set);
+
+  profile_probe_modes(es, PROBE_BENCH_PROBES);
+
+  free(es);
+  free_cl_set(cl_set);
+  free(pages);
+}
+
+/*********************************************************************
+ * Probe Accuracy
+ *
+ * Probes the set of a line that a Sender accesses from another core, in every
+ * probe mode and at thresholds around the calibrated one, and scores the
+ * detections against the accesses the sender logged. The first detection
+ * within ACCURACY_WINDOW cycles after an access is a true positive, and every
+ * other detection is a false positive; the negatives are the probes that
+ * should not have detected anything. Results are printed and written to
+ * ACCURACY_CSV and ACCURACY_JSON. Needs real hardware with two physical
+ * cores; on one, the sender and the prober take turns.
+ *********************************************************************/
+
+#define ACCURACY_PROBES 200000
+// Half the sender's shortest gap, so each detection matches one access
+#define ACCURACY_WINDOW (SENDER_SHORT_GAP / 2)
+#define ACCURACY_LOG (1 << 20)
+#define ACCURACY_CSV "probe_accuracy.csv"
+#define ACCURACY_JSON "probe_accuracy.json"
+
+// Thresholds tried, in percent of the calibrated threshold of each mode
+int accuracy_scales[] = {70, 85, 100, 115, 130};
+
+typedef struct {
+  ProbeMode mode;
+  int threshold;
+  uint64_t probes;
+  double probes_per_second;
+  // Sender accesses that could be detected before the probing ended
+  uint64_t accesses;
+  uint64_t detections;
+  uint64_t true_positives;
+  uint64_t false_positives;
+  // Median cycles from an access to its detection
+  uint64_t median_latency;
+} ProbeAccuracy;
+
+double accuracy_ratio(uint64_t count, uint64_t total) {
+  return total == 0 ? 0 : (double)count / total;
+}
+
+// Probes that should not have detected anything
+uint64_t accuracy_negatives(ProbeAccuracy *result) {
+  return result->probes > result->accesses ? result->probes - result->accesses
+                                           : 0;
+}
+
+// Match the size detections to the accesses sender logged between start and
+// end
+void score_detections(ProbeAccuracy *result, Sender *sender, uint64_t start,
+                      uint64_t end, uint64_t *detections, uint64_t size) {
+  uint64_t *accesses = sender->timestamps;
+  uint64_t last = end - ACCURACY_WINDOW;
+  NumList *latencies = new_num_list(size + 1);
+  uint64_t a = 0;
+  // Index of the access matched last, plus one
+  uint64_t matched = 0;
+
+  for (uint64_t i = 0; i < sender->length; i++) {
+    result->accesses += accesses[i] >= start && accesses[i] <= last;
+  }
+
+  for (uint64_t d = 0; d < size; d++) {
+    while (a < sender->length && accesses[a] <= detections[d]) {
+      a++;
+    }
+    // Latest access before the detection
+    bool near = a > 0 && accesses[a - 1] >= start &&
+                detections[d] - accesses[a - 1] < ACCURACY_WINDOW;
+    if (near && accesses[a - 1] > last) {
+      // Its access is not counted
+      continue;
+    }
+    result->detections++;
+    if (near && matched != a) {
+      push_num(latencies, detections[d] - accesses[a - 1]);
+      result->true_positives++;
+      matched = a;
+    } else {
+      result->false_positives++;
+    }
+  }
+
+  result->median_latency = median_and_sort(latencies);
+  free_num_list(latencies);
+}
+
+ProbeAccuracy run_probe_accuracy(EvictionSet *es, uint8_t *target,
+                                 ProbeRing *ring, uint64_t *detections,
+                                 int threshold, double tsc_hz) {
+  ProbeAccuracy result = {.mode = probe_mode,
+                          .threshold = threshold,
+                          .probes = ACCURACY_PROBES};
+  uint64_t size;
+
+  Sender *sender = start_sender(target, ACCURACY_LOG);
+  if (sender == NULL) {
+    return result;
+  }
+  clear_probe_ring(ring);
+  uint64_t start = __rdtscp(&core_id);
+  prime_probe(es, ring, ACCURACY_PROBES, detections, ACCURACY_PROBES, &size,
+              threshold);
+  uint64_t end = __rdtscp(&core_id);
+  stop_sender(sender);
+
+  result.probes_per_second = ACCURACY_PROBES / ((end - start) / tsc_hz);
+  score_detections(&result, sender, start, end, detections, size);
+  free_sender(sender);
+
+  return result;
+}
+
+void write_probe_accuracy(ProbeAccuracy *results, int count) {
+  FILE *csv = fopen(ACCURACY_CSV, "w");
+  FILE *json = fopen(ACCURACY_JSON, "w");
+  if (csv == NULL || json == NULL) {
+    perror("probe accuracy results");
+    if (csv != NULL) {
+      fclose(csv);
+    }
+    if (json != NULL) {
+      fclose(json);
+    }
+    return;
+  }
+
+  fprintf(csv, "mode,threshold,probes,probes_per_second,accesses,detections,"
+               "true_positives,false_positives,precision,recall,"
+               "false_positive_rate,median_latency\n");
+  fprintf(json, "[\n");
+  for (int i = 0; i < count; i++) {
+    ProbeAccuracy *r = &results[i];
+    double precision = accuracy_ratio(r->true_positives, r->detections);
+    double recall = accuracy_ratio(r->true_positives, r->accesses);
+    double fpr = accuracy_ratio(r->false_positives, accuracy_negatives(r));
+
+    fprintf(csv, "%s,%d,%lu,%.0f,%lu,%lu,%lu,%lu,%.4f,%.4f,%.6f,%lu\n",
+            probe_mode_name(r->mode), r->threshold, r->probes,
+            r->probes_per_second, r->accesses, r->detections,
+            r->true_positives, r->false_positives, precision, recall, fpr,
+            r->median_latency);
+    fprintf(json,
+            "  {\"mode\": \"%s\", \"threshold\": %d, \"probes\": %lu, "
+            "\"probes_per_second\": %.0f, \"accesses\": %lu, "
+            "\"detections\": %lu, \"true_positives\": %lu, "
+            "\"false_positives\": %lu, \"precision\": %.4f, "
+            "\"recall\": %.4f, \"false_positive_rate\": %.6f, "
+            "\"median_latency\": %lu}%s\n",
+            probe_mode_name(r->mode), r->threshold, r->probes,
+            r->probes_per_second, r->accesses, r->detections,
+            r->true_positives, r->false_positives, precision, recall, fpr,
+            r->median_latency, i + 1 < count ? "," : "");
+  }
+  fprintf(json, "]\n");
+
+  fclose(csv);
+  fclose(json);
+}
+
+void bench_probe_accuracy(void) {
+  int scales = sizeof(accuracy_scales) / sizeof(int);
+  int count = NUM_PROBE_MODES * scales;
+  ProbeAccuracy *results = calloc(count, sizeof(ProbeAccuracy));
+  uint64_t *detections = malloc(ACCURACY_PROBES * sizeof(uint64_t));
+  ProbeRing *ring = new_probe_ring(ACCURACY_PROBES);
+  ProbeMode mode = probe_mode;
+  uint64_t interval = recalibration_interval;
+  double tsc_hz = measure_tsc_hz();
+
+  // Keep the prober on this core, so the sender is pinned to another one
+  cpu_set_t cpus, previous;
+  sched_getaffinity(0, sizeof(previous), &previous);
+  CPU_ZERO(&cpus);
+  CPU_SET(sched_getcpu(), &cpus);
+  sched_setaffinity(0, sizeof(cpus), &cpus);
+
+  uint8_t *target = aligned_alloc(PAGE_BYTES, PAGE_BYTES);
+  memset(target, 0x37, PAGE_BYTES);
+  uint64_t flush_threshold = threshold_from_flush(target);
+  CacheLineSet *cl_set;
+  bool minimal = get_minimal_set(target, &cl_set, flush_threshold);
+  EvictionSet *es = new_eviction_set(cl_set);
+
+  printf("Probing a %s set of %u lines, sender %s:\n",
+         minimal ? "minimal" : "non-minimal", cl_set->size,
+         pick_helper_cpu() >= 0 ? "on another core" : "on the same core");
+  printf("%-10s %9s %12s %9s %9s %9s %8s\n", "mode", "threshold",
+         "probes/s", "precision", "recall", "fpr", "latency");
+
+  // The threshold must stay the one being measured
+  recalibration_interval = 0;
+  for (int m = 0; m < NUM_PROBE_MODES; m++) {
+    probe_mode = m;
+    int calibrated = threshold_for_probe(es, m);
+    for (int s = 0; s < scales; s++) {
+      ProbeAccuracy *r = &results[m * scales + s];
+      int threshold = calibrated * accuracy_scales[s] / 100;
+      *r = run_probe_accuracy(es, target, ring, detections, threshold,
+                              tsc_hz);
+      printf("%-10s %9d %12.0f %9.4f %9.4f %9.6f %8lu\n",
+             probe_mode_name(m), threshold, r->probes_per_second,
+             accuracy_ratio(r->true_positives, r->detections),
+             accuracy_ratio(r->true_positives, r->accesses),
+             accuracy_ratio(r->false_positives, accuracy_negatives(r)),
+             r->median_latency);
+    }
+  }
+  recalibration_interval = interval;
+  probe_mode = mode;
+
+  write_probe_accuracy(results, count);
+  printf("Wrote %s and %s\n", ACCURACY_CSV, ACCURACY_JSON);
+
+  sched_setaffinity(0, sizeof(previous), &previous);
+  free(es);
+  deep_free_cl_set(cl_set);
+  free(target);
+  free_probe_ring(ring);
+  free(detections);
+  free(results);
+}
+
+/*********************************************************************
+ * Simulator
+ *
+ * Inflates a set on the simulated i7-2600 with every replacement policy and
+ * reduces it with reduce2 and reduce_group_testing using sequential tests,
+ * and with LRU also using medians, which take minutes. Then runs
+ * generate_sets and get_all_slices_eviction_sets on it with LRU. Every run
+ * starts from an empty cache and the same rand() seed, so the counts are exact
+ * and repeat on any machine.
+ *********************************************************************/
+
+#define SIMULATOR_SEED 1
+#define SIMULATOR_SETS 4
+// Page offset of the victim, which is in a page of its own so that its set
+// does not depend on where the stack is
+#define SIMULATOR_VICTIM_OFFSET 0x240
+
+// Lines of cl_set in the same LLC set and slice as the victim
+int simulated_congruent(SimulatedCache *cache, CacheLineSet *cl_set,
+                        uint8_t *victim) {
+  uintptr_t victim_pa = simulated_translate(cache, victim);
+  int victim_set = geometry_set_index(cache->config.geometry, victim_pa);
+  int victim_slice = simulated_slice(cache, victim_pa);
+  int congruent = 0;
+
+  for (int i = 0; i < cl_set->size; i++) {
+    uintptr_t pa = simulated_translate(cache, cl_set->cache_lines[i]);
+    congruent += geometry_set_index(cache->config.geometry, pa) == victim_set &&
+                 simulated_slice(cache, pa) == victim_slice;
+  }
+
+  return congruent;
+}
+
+void run_simulated_reduction(SimulatedCache *cache, const char *name,
+                             ReduceFunction reduce, CacheLineSet *initial,
+                             uint8_t *victim, uint64_t threshold) {
+  CacheLineSet *cl_set = new_cl_set();
+  reserve_cl_set(cl_set, initial->size);
+  for (int i = 0; i < initial->size; i++) {
+    push_cache_line(cl_set, initial->cache_lines[i]);
+  }
+  CacheLineSet *reserve = new_cl_set();
+
+  reset_simulated_cache(cache);
+  srand(SIMULATOR_SEED);
+  uint64_t tests = eviction_tests;
+  uint64_t samples = eviction_samples;
+  bool result = reduce(cl_set, reserve, victim, SAMPLES, threshold, BINS);
+
+  printf("  %-20s %-10s %s to %u lines (%u congruent), %lu tests, %lu "
+         "samples, %lu loads\n",
+         name, sequential_tests ? "sequential" : "median",
+         result ? "reduced" : "failed", cl_set->size,
+         simulated_congruent(cache, cl_set, victim), eviction_tests - tests,
+         eviction_samples - samples, cache->stats.loads);
+
+  free_cl_set(reserve);
+  free_cl_set(cl_set);
+}
+
+void simulate_reductions(SimulatorConfig config, bool medians) {
+  uint8_t *page = aligned_alloc(PAGE_BYTES, PAGE_BYTES);
+  uint8_t *victim = page + SIMULATOR_VICTIM_OFFSET;
+  SimulatedCache *cache = new_simulated_cache(config);
+  use_simulated_cache(cache);
+
+  srand(SIMULATOR_SEED);
+  uint64_t threshold = threshold_from_flush(victim);
+  uint64_t tests = eviction_tests;
+  reset_simulated_cache(cache);
+  CacheLineSet *initial =
+      inflate(victim, INITIAL_SIZE, SAMPLES, INITIAL_THRESHOLD);
+
+  printf("%s: inflated to %u lines (%u congruent), %lu tests, %lu loads\n",
+         replacement_policy_name(config.policy), initial->size,
+         simulated_congruent(cache, initial, victim), eviction_tests - tests,
+         cache->stats.loads);
+  for (int i = medians ? 0 : 1; i < 2; i++) {
+    sequential_tests = i == 1;
+    run_simulated_reduction(cache, "reduce2", reduce2, initial, victim,
+                            threshold);
+    run_simulated_reduction(cache, "reduce_group_testing",
+                            reduce_group_testing, initial, victim, threshold);
+  }
+  sequential_tests = false;
+
+  deep_free_cl_set(initial);
+  use_hardware_memory();
+  free_simulated_cache(cache);
+  free(page);
+}
+
+// generate_sets for SIMULATOR_SETS sets, then get_all_slices_eviction_sets on
+// a mapping simulated with hugepages, both reducing with sequential tests
+void simulate_generate_sets(SimulatorConfig config) {
+  uint8_t *page = aligned_alloc(PAGE_BYTES, PAGE_BYTES);
+  SimulatedCache *cache = new_simulated_cache(config);
+  use_simulated_cache(cache);
+  srand(SIMULATOR_SEED);
+  sequential_tests = true;
+
+  uint64_t tests = eviction_tests;
+  CacheLineSet **sets =
+      generate_sets(SIMULATOR_SETS, page + SIMULATOR_VICTIM_OFFSET);
+  printf("generate_sets: %s, %lu tests, %lu loads\n",
+         sets != NULL ? "done" : "failed", eviction_tests - tests,
+         cache->stats.loads);
+  for (int i = 0; sets != NULL && i < SIMULATOR_SETS; i++) {
+    deep_free_cl_set(sets[i]);
+  }
+  free(sets);
+
+  CacheGeometry *geometry = config.geometry;
+  size_t bytes = geometry->ways * geometry_set_stride(geometry);
+  uint8_t *mapping = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  simulate_hugepages(cache, mapping, bytes);
+
+  reset_simulated_cache(cache);
+  tests = eviction_tests;
+  int found;
+  EvictionSet **es_list =
+      get_all_slices_eviction_sets(mapping, 428, geometry, &found);
+  printf("get_all_slices_eviction_sets: %d of %d slices, %lu tests, "
+         "%lu loads\n",
+         found, geometry->slices, eviction_tests - tests, cache->stats.loads);
+  free_es_list(es_list, geometry);
+
+  munmap(mapping, bytes);
+  sequential_tests = false;
+  use_hardware_memory();
+  free_simulated_cache(cache);
+  free(page);
+}
+
+void bench_simulator(void) {
+  SimulatorConfig config = everglades_simulator;
+
+  for (int p = 0; p < NUM_REPLACEMENT_POLICIES; p++) {
+    config.policy = p;
+    simulate_reductions(config, p == REPLACE_LRU);
+  }
+
+  config.policy = REPLACE_LRU;
+  simulate_generate_sets(config);
+}
+
+/*********************************************************************
+ * Simulator Noise
+ *
+ * Runs get_minimal_set with each reduction, using sequential tests, for
+ * NOISE_VICTIMS victims on the simulated i7-2600 with LRU, at multiples of
+ * unit_noise. Reports how many victims got a set and how many of those are
+ * minimal and congruent, with the tests, samples and retries it took, to
+ * compare what noise costs each reduction.
+ *********************************************************************/
+
+#define NOISE_VICTIMS 3
+// Distance between the victims, which puts each in a different set
+#define NOISE_VICTIM_STRIDE 0x400
+#define NOISE_LEVELS 5
+
+double noise_levels[NOISE_LEVELS] = {0, 0.5, 1, 2, 4};
+
+void simulate_noisy_reduction(SimulatorConfig config, const char *name,
+                              ReduceFunction reduce) {
+  uint8_t *page = aligned_alloc(PAGE_BYTES, PAGE_BYTES);
+  SimulatedCache *cache = new_simulated_cache(config);
+  use_simulated_cache(cache);
+  srand(SIMULATOR_SEED);
+  reduce_function = reduce;
+  sequential_tests = true;
+
+  uint64_t threshold = threshold_from_flush(page + SIMULATOR_VICTIM_OFFSET);
+  uint64_t tests = eviction_tests;
+  uint64_t samples = eviction_samples;
+  uint64_t retries = reduction_retries;
+  int found = 0, minimal = 0;
+
+  for (int v = 0; v < NOISE_VICTIMS; v++) {
+    uint8_t *victim =
+        page + SIMULATOR_VICTIM_OFFSET + v * NOISE_VICTIM_STRIDE;
+    CacheLineSet *cl_set;
+    if (get_minimal_set(victim, &cl_set, threshold)) {
+      found++;
+      minimal += cl_set->size == config.geometry->ways &&
+                 simulated_congruent(cache, cl_set, victim) == cl_set->size;
+    }
+    deep_free_cl_set(cl_set);
+  }
+
+  printf("%-20s %d/%d found, %d minimal, %lu tests, %lu samples, %lu "
+         "retries, %lu noise loads, %lu outliers, %lu remaps\n",
+         name, found, NOISE_VICTIMS, minimal, eviction_tests - tests,
+         eviction_samples - samples, reduction_retries - retries,
+         cache->stats.noise_loads, cache->stats.outliers,
+         cache->stats.remaps);
+
+  sequential_tests = false;
+  reduce_function = reduce2;
+  use_hardware_memory();
+  free_simulated_cache(cache);
+  free(page);
+}
+
+void bench_simulator_noise(void) {
+  SimulatorConfig config = everglades_simulator;
+
+  for (int l = 0; l < NOISE_LEVELS; l++) {
+    config.noise = scale_noise(unit_noise, noise_levels[l]);
+    printf("Noise level %.1f:\n", noise_levels[l]);
+    simulate_noisy_reduction(config, "reduce2", reduce2);
+    simulate_noisy_reduction(config, "reduce_group_testing",
+                             reduce_group_testing);
+  }
+}
+
+/*********************************************************************
+ * Eviction atlas
+ *
+ * Builds a full atlas on the simulated i7-2600 and prints its coverage and
+ * the time of each phase. The pool is mapped through the simulator, so no
+ * real hugepages are needed. The simulated cache is not thread-safe, so
+ * verification runs on one thread.
+ *********************************************************************/
+
+#define ATLAS_BASE_SET 428
+
+void bench_atlas(void) {
+  SimulatedCache *cache = new_simulated_cache(everglades_simulator);
+  use_simulated_cache(cache);
+  srand(SIMULATOR_SEED);
+  sequential_tests = true;
+
+  EvictionAtlas *atlas = new_eviction_atlas(cache_geometry, ATLAS_BASE_SET);
+  if (atlas == NULL) {
+    printf("could not map the atlas pool\n");
+  } else {
+    reset_simulated_cache(cache);
+    uint64_t tests = eviction_tests;
+    fill_eviction_atlas(atlas, 1);
+    print_atlas_coverage(atlas);
+    printf("  %lu tests, %lu loads\n", eviction_tests - tests,
+           cache->stats.loads);
+    free_eviction_atlas(atlas);
+  }
+
+  sequential_tests = false;
+  use_hardware_memory();
+  free_simulated_cache(cache);
+}
+
+/*********************************************************************
+ * Driver
+ *********************************************************************/
+
+typedef struct {
+  const char *name;
+  void (*run)(void);
+} Benchmark;
+
+Benchmark benchmarks[] = {
+    {"cl_set_storage", bench_cl_set_storage},
+    {"candidate_arena", bench_candidate_arena},
+    {"reduction", bench_reduction},
+    {"traversal", bench_traversal},
+    {"pagemap", bench_pagemap},
+    {"pipeline", bench_pipeline},
+    {"slice_hash", bench_slice_hash},
+    {"timing", bench_timing},
+    {"histogram", bench_histogram},
+    {"probe_ring", bench_probe_ring},
+    {"trace", bench_trace},
+    {"probe_modes", bench_probe_modes},
+    {"probe_accuracy", bench_probe_accuracy},
+    {"simulator", bench_simulator},
+    {"simulator_noise", bench_simulator_noise},
+    {"atlas", bench_atlas},
+};
+
+int main(int argc, char **argv) {
+  int count = sizeof(benchmarks) / sizeof(Benchmark);
+
+  init_cache_geometry();
+
+  for (int i = 0; i < count; i++) {
+    if (argc > 1 && strcmp(argv[1], benchmarks[i].name) != 0) {
+      continue;
+    }
+    benchmarks[i].run();
+  }
+
+  return 0;
+}
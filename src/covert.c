@@ -0,0 +1,480 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <x86intrin.h>
+
+#include "../lib/constants.h"
+#include "../lib/covert.h"
+#include "../lib/l3pp.h"
+#include "../lib/timing.h"
+
+uint64_t covert_sweep_cycles[COVERT_SWEEP_STEPS] = {2500,  5000,  10000,
+                                                    20000, 40000, 80000};
+
+/*********************************************************************
+ * Framing
+ *********************************************************************/
+
+uint16_t crc16_ccitt(uint8_t *bytes, int length) {
+  uint16_t crc = 0xFFFF;
+
+  for (int i = 0; i < length; i++) {
+    crc ^= bytes[i] << 8;
+    for (int bit = 0; bit < 8; bit++) {
+      crc = crc & 0x8000 ? crc << 1 ^ 0x1021 : crc << 1;
+    }
+  }
+
+  return crc;
+}
+
+// The payload every frame carries, so the receiver knows what was sent
+void covert_test_payload(uint8_t *payload) {
+  uint64_t state = COVERT_PAYLOAD_SEED;
+
+  for (int i = 0; i < COVERT_PAYLOAD_BYTES; i++) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    payload[i] = state;
+  }
+}
+
+uint64_t covert_epoch_symbol_cycles(uint64_t epoch, uint64_t symbol_cycles,
+                                    bool sweep) {
+  return sweep ? covert_sweep_cycles[epoch % COVERT_SWEEP_STEPS]
+               : symbol_cycles;
+}
+
+// Symbol k of the preamble and sync word
+bool covert_pattern(int k) {
+  return k < COVERT_PREAMBLE_BITS
+             ? !(k & 1)
+             : COVERT_SYNC_WORD >> (k - COVERT_PREAMBLE_BITS) & 1;
+}
+
+// Symbols of the frame after the sync word
+int covert_body_bits(CovertConfig *config) {
+  return COVERT_FRAME_BYTES * 2 * (config->fec ? 7 : 4);
+}
+
+// Write nibble to symbols as a Hamming(7,4) codeword p1 p2 d1 p3 d2 d3 d4
+void hamming_encode(uint8_t nibble, uint8_t *symbols) {
+  bool d1 = nibble & 1, d2 = nibble >> 1 & 1;
+  bool d3 = nibble >> 2 & 1, d4 = nibble >> 3 & 1;
+
+  symbols[0] = d1 ^ d2 ^ d4;
+  symbols[1] = d1 ^ d3 ^ d4;
+  symbols[2] = d1;
+  symbols[3] = d2 ^ d3 ^ d4;
+  symbols[4] = d2;
+  symbols[5] = d3;
+  symbols[6] = d4;
+}
+
+// Nibble of a Hamming(7,4) codeword, after correcting one flipped symbol
+uint8_t hamming_decode(uint8_t *symbols) {
+  uint8_t c[8];
+  for (int i = 0; i < 7; i++) {
+    c[i + 1] = symbols[i];
+  }
+
+  int syndrome = (c[1] ^ c[3] ^ c[5] ^ c[7]) |
+                 (c[2] ^ c[3] ^ c[6] ^ c[7]) << 1 |
+                 (c[4] ^ c[5] ^ c[6] ^ c[7]) << 2;
+  if (syndrome != 0) {
+    c[syndrome] ^= 1;
+  }
+
+  return c[3] | c[5] << 1 | c[6] << 2 | c[7] << 3;
+}
+
+// Write the symbols of a frame with sequence and payload to symbols, which
+// must hold COVERT_MAX_FRAME_BITS. Returns the number of symbols.
+int covert_encode_frame(CovertConfig *config, uint8_t sequence,
+                        uint8_t *payload, uint8_t *symbols) {
+  uint8_t frame[COVERT_FRAME_BYTES];
+  frame[0] = sequence;
+  memcpy(&frame[1], payload, COVERT_PAYLOAD_BYTES);
+  uint16_t crc = crc16_ccitt(frame, 1 + COVERT_PAYLOAD_BYTES);
+  frame[1 + COVERT_PAYLOAD_BYTES] = crc & 0xFF;
+  frame[2 + COVERT_PAYLOAD_BYTES] = crc >> 8;
+
+  int n = 0;
+  for (int k = 0; k < COVERT_PREAMBLE_BITS + 16; k++) {
+    symbols[n++] = covert_pattern(k);
+  }
+  for (int i = 0; i < COVERT_FRAME_BYTES * 2; i++) {
+    uint8_t nibble = frame[i / 2] >> (i % 2 * 4) & 0xF;
+    if (config->fec) {
+      hamming_encode(nibble, &symbols[n]);
+      n += 7;
+    } else {
+      for (int bit = 0; bit < 4; bit++) {
+        symbols[n++] = nibble >> bit & 1;
+      }
+    }
+  }
+
+  return n;
+}
+
+// Read the frame back from the symbols after the sync word
+void covert_decode_body(CovertConfig *config, uint8_t *symbols,
+                        uint8_t *frame) {
+  memset(frame, 0, COVERT_FRAME_BYTES);
+
+  int n = 0;
+  for (int i = 0; i < COVERT_FRAME_BYTES * 2; i++) {
+    uint8_t nibble = 0;
+    if (config->fec) {
+      nibble = hamming_decode(&symbols[n]);
+      n += 7;
+    } else {
+      for (int bit = 0; bit < 4; bit++) {
+        nibble |= symbols[n++] << bit;
+      }
+    }
+    frame[i / 2] |= nibble << (i % 2 * 4);
+  }
+}
+
+/*********************************************************************
+ * Sender
+ *********************************************************************/
+
+// Send length symbols, the first starting at start. The schedule is fixed
+// from start, so a late symbol does not delay the ones after it.
+void covert_send(uint8_t *target, CovertConfig *config, uint8_t *symbols,
+                 int length, uint64_t start) {
+  unsigned int core_id = 0;
+
+  for (int i = 0; i < length; i++) {
+    uint64_t end = start + (i + 1) * config->symbol_cycles;
+    while (__rdtscp(&core_id) < end) {
+      if (symbols[i]) {
+        (void)*(volatile uint8_t *)target;
+      }
+    }
+  }
+}
+
+// Send numbered frames of the test payload through target, as many as fit in
+// each epoch, until attack_finished is set
+void covert_send_epochs(uint8_t *target, uint64_t symbol_cycles, bool fec,
+                        bool sweep) {
+  unsigned int core_id = 0;
+  uint8_t payload[COVERT_PAYLOAD_BYTES];
+  uint8_t symbols[COVERT_MAX_FRAME_BITS];
+  uint8_t sequence = 0;
+
+  covert_test_payload(payload);
+
+  while (!attack_finished) {
+    uint64_t now = __rdtscp(&core_id);
+    uint64_t epoch = now / COVERT_EPOCH_CYCLES;
+    uint64_t epoch_end = (epoch + 1) * COVERT_EPOCH_CYCLES;
+    CovertConfig config = {
+        covert_epoch_symbol_cycles(epoch, symbol_cycles, sweep), fec};
+
+    int length = covert_encode_frame(&config, sequence, payload, symbols);
+    if (now + length * config.symbol_cycles > epoch_end) {
+      while (__rdtscp(&core_id) < epoch_end)
+        ;
+      continue;
+    }
+    covert_send(target, &config, symbols, length, now);
+    sequence++;
+  }
+}
+
+/*********************************************************************
+ * Receiver
+ *********************************************************************/
+
+CovertRecording *new_covert_recording(void) {
+  CovertRecording *recording = malloc(sizeof(CovertRecording));
+  recording->times = new_num_list(PROBES_PER_WINDOW);
+  recording->hits = new_num_list(PROBES_PER_WINDOW + 1);
+  clear_covert_recording(recording);
+
+  return recording;
+}
+
+void clear_covert_recording(CovertRecording *recording) {
+  recording->times->length = 0;
+  recording->hits->length = 0;
+  push_num(recording->hits, 0);
+}
+
+void free_covert_recording(CovertRecording *recording) {
+  free_num_list(recording->times);
+  free_num_list(recording->hits);
+  free(recording);
+}
+
+// Probe es with probe_mode until the TSC reaches until, adding every probe to
+// recording
+void covert_listen(EvictionSet *es, int threshold, uint64_t until,
+                   CovertRecording *recording) {
+  unsigned int core_id = 0;
+  uint64_t hits = recording->hits->nums[recording->hits->length - 1];
+  bool backward = false;
+
+  access_set(es);
+
+  uint64_t now = __rdtscp(&core_id);
+  while (now < until) {
+    hits += probe_with_mode(es, threshold, &backward);
+    now = __rdtscp(&core_id);
+    push_num(recording->times, now);
+    push_num(recording->hits, hits);
+  }
+}
+
+// Index of the first probe that ended at or after time
+uint64_t covert_probe_at(CovertRecording *recording, uint64_t time) {
+  uint64_t low = 0, high = recording->times->length;
+
+  while (low < high) {
+    uint64_t middle = low + (high - low) / 2;
+    if (recording->times->nums[middle] < time) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+
+  return low;
+}
+
+// Fraction of the probes that ended between from and to that hit, or 0 if
+// there were none
+double covert_hit_rate(CovertRecording *recording, uint64_t from,
+                       uint64_t to) {
+  uint64_t first = covert_probe_at(recording, from);
+  uint64_t last = covert_probe_at(recording, to);
+  if (last == first) {
+    return 0;
+  }
+
+  uint64_t *hits = recording->hits->nums;
+  return (double)(hits[last] - hits[first]) / (last - first);
+}
+
+// Pearson correlation of the hit rates of the symbols from start with the
+// preamble and sync word, 1 for a perfect match however weak the signal. Sets
+// level to the midpoint of the mean rates of its ones and zeros.
+double covert_correlate(CovertRecording *recording, uint64_t symbol_cycles,
+                        uint64_t start, double *level) {
+  int length = COVERT_PREAMBLE_BITS + 16;
+  double rates[COVERT_PREAMBLE_BITS + 16];
+  double mean = 0, pattern_mean = 0;
+
+  for (int k = 0; k < length; k++) {
+    uint64_t from = start + k * symbol_cycles;
+    rates[k] = covert_hit_rate(recording, from, from + symbol_cycles);
+    mean += rates[k] / length;
+    pattern_mean += (double)covert_pattern(k) / length;
+  }
+
+  double covariance = 0, variance = 0, pattern_variance = 0;
+  double ones = 0, zeros = 0;
+  for (int k = 0; k < length; k++) {
+    double pattern = covert_pattern(k) - pattern_mean;
+    covariance += (rates[k] - mean) * pattern;
+    variance += (rates[k] - mean) * (rates[k] - mean);
+    pattern_variance += pattern * pattern;
+    if (covert_pattern(k)) {
+      ones += rates[k];
+    } else {
+      zeros += rates[k];
+    }
+  }
+
+  int one_count = pattern_mean * length + 0.5;
+  *level = (ones / one_count + zeros / (length - one_count)) / 2;
+  if (variance == 0) {
+    return 0;
+  }
+  return covariance / sqrt(variance * pattern_variance);
+}
+
+// Find and decode every frame in recording, adding them to stats
+void covert_decode(CovertRecording *recording, CovertConfig *config,
+                   CovertStats *stats) {
+  if (recording->times->length == 0) {
+    return;
+  }
+
+  uint64_t symbol_cycles = config->symbol_cycles;
+  uint64_t step = MAX(symbol_cycles / COVERT_PHASE_STEPS, 1);
+  uint64_t frame_cycles =
+      (COVERT_PREAMBLE_BITS + 16 + covert_body_bits(config)) * symbol_cycles;
+  uint64_t first = recording->times->nums[0];
+  uint64_t last = recording->times->nums[recording->times->length - 1];
+  uint8_t expected[COVERT_PAYLOAD_BYTES];
+  uint8_t symbols[COVERT_MAX_FRAME_BITS];
+  uint8_t frame[COVERT_FRAME_BYTES];
+
+  covert_test_payload(expected);
+  stats->cycles += last - first;
+
+  uint64_t start = first;
+  while (start + COVERT_REFINE_SYMBOLS * symbol_cycles + frame_cycles <=
+         last) {
+    double level;
+    if (covert_correlate(recording, symbol_cycles, start, &level) <
+        COVERT_MIN_CORRELATION) {
+      start += step;
+      continue;
+    }
+
+    // The best offset nearby is the frame's
+    uint64_t best = start;
+    double best_correlation = -1;
+    for (uint64_t offset = start;
+         offset < start + COVERT_REFINE_SYMBOLS * symbol_cycles;
+         offset += step) {
+      double offset_level;
+      double correlation =
+          covert_correlate(recording, symbol_cycles, offset, &offset_level);
+      if (correlation > best_correlation) {
+        best = offset;
+        best_correlation = correlation;
+        level = offset_level;
+      }
+    }
+
+    uint64_t body = best + (COVERT_PREAMBLE_BITS + 16) * symbol_cycles;
+    for (int i = 0; i < covert_body_bits(config); i++) {
+      uint64_t from = body + i * symbol_cycles;
+      symbols[i] =
+          covert_hit_rate(recording, from, from + symbol_cycles) > level;
+    }
+    covert_decode_body(config, symbols, frame);
+
+    uint16_t crc = frame[1 + COVERT_PAYLOAD_BYTES] |
+                   frame[2 + COVERT_PAYLOAD_BYTES] << 8;
+    stats->frames++;
+    stats->good_frames += crc == crc16_ccitt(frame, 1 + COVERT_PAYLOAD_BYTES);
+    for (int i = 0; i < COVERT_PAYLOAD_BYTES; i++) {
+      stats->bit_errors += __builtin_popcount(frame[1 + i] ^ expected[i]);
+    }
+    stats->bits += COVERT_PAYLOAD_BYTES * 8;
+
+    start = best + frame_cycles;
+  }
+}
+
+void print_covert_stats(CovertConfig *config, CovertStats *stats,
+                        double tsc_hz) {
+  double seconds = stats->cycles / tsc_hz;
+  uint64_t good_bits = stats->good_frames * COVERT_PAYLOAD_BYTES * 8;
+  double goodput = seconds == 0 ? 0 : good_bits / seconds;
+  double ber = stats->bits == 0 ? 0 : (double)stats->bit_errors / stats->bits;
+
+  printf("%12lu %4s %10.0f %8lu %8lu %12.0f %10.6f\n", config->symbol_cycles,
+         config->fec ? "yes" : "no", tsc_hz / config->symbol_cycles,
+         stats->frames, stats->good_frames, goodput, ber);
+}
+
+// Index of the set in es_list the sender is using, the one whose probes hit
+// most often over COVERT_SEARCH_CYCLES
+int covert_find_sender(EvictionSet **es_list, int count, int threshold) {
+  unsigned int core_id = 0;
+  CovertRecording *recording = new_covert_recording();
+  double best_rate = -1;
+  int best = 0;
+
+  for (int i = 0; i < count; i++) {
+    clear_covert_recording(recording);
+    uint64_t start = __rdtscp(&core_id);
+    covert_listen(es_list[i], threshold, start + COVERT_SEARCH_CYCLES,
+                  recording);
+    double rate = covert_hit_rate(recording, start, UINT64_MAX);
+#ifndef __MEASURE__
+    printf("Set %d: %.4f of probes hit\n", i, rate);
+#endif
+    if (rate > best_rate) {
+      best_rate = rate;
+      best = i;
+    }
+  }
+
+  free_covert_recording(recording);
+  return best;
+}
+
+// Listen to whole epochs on es and print the frames found in each: every
+// step of the sweep once if sweep, or COVERT_EPOCHS epochs and their total
+void covert_receive_epochs(EvictionSet *es, int threshold,
+                           uint64_t symbol_cycles, bool fec, bool sweep) {
+  unsigned int core_id = 0;
+  double tsc_hz = measure_tsc_hz();
+  CovertRecording *recording = new_covert_recording();
+  CovertStats total = {0};
+  bool received[COVERT_SWEEP_STEPS] = {false};
+  int epochs = sweep ? COVERT_SWEEP_STEPS : COVERT_EPOCHS;
+
+  printf("%12s %4s %10s %8s %8s %12s %10s\n", "cycles/bit", "fec", "raw bit/s",
+         "frames", "good", "goodput", "BER");
+  for (int done = 0; done < epochs;) {
+    uint64_t epoch = __rdtscp(&core_id) / COVERT_EPOCH_CYCLES + 1;
+    CovertConfig config = {
+        covert_epoch_symbol_cycles(epoch, symbol_cycles, sweep), fec};
+    while (__rdtscp(&core_id) < epoch * COVERT_EPOCH_CYCLES)
+      ;
+    // Epochs skipped while decoding come around again later in the sweep
+    if (sweep && received[epoch % COVERT_SWEEP_STEPS]) {
+      continue;
+    }
+    received[epoch % COVERT_SWEEP_STEPS] = true;
+
+    clear_covert_recording(recording);
+    covert_listen(es, threshold, (epoch + 1) * COVERT_EPOCH_CYCLES, recording);
+
+    CovertStats stats = {0};
+    covert_decode(recording, &config, &stats);
+    print_covert_stats(&config, &stats, tsc_hz);
+    total.frames += stats.frames;
+    total.good_frames += stats.good_frames;
+    total.bits += stats.bits;
+    total.bit_errors += stats.bit_errors;
+    total.cycles += stats.cycles;
+    done++;
+  }
+
+  if (!sweep) {
+    CovertConfig config = {symbol_cycles, fec};
+    printf("Total:\n");
+    print_covert_stats(&config, &total, tsc_hz);
+  }
+  free_covert_recording(recording);
+}
+
+// Read "covert [cycles/bit] [fec]" or "sweep [fec]" from the arguments of
+// main. Returns false if they are neither.
+bool parse_covert_args(int argc, char **argv, uint64_t *symbol_cycles,
+                       bool *fec, bool *sweep) {
+  if (argc < 2 ||
+      (strcmp(argv[1], "covert") != 0 && strcmp(argv[1], "sweep") != 0)) {
+    return false;
+  }
+
+  *symbol_cycles = COVERT_SYMBOL_CYCLES;
+  *fec = false;
+  *sweep = strcmp(argv[1], "sweep") == 0;
+  for (int i = 2; i < argc; i++) {
+    if (strcmp(argv[i], "fec") == 0) {
+      *fec = true;
+    } else if (atoll(argv[i]) > 0) {
+      *symbol_cycles = atoll(argv[i]);
+    }
+  }
+
+  return true;
+}
@@ -1,5 +1,6 @@
 #define _GNU_SOURCE
 #include <assert.h>
+#include <math.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -8,9 +9,10 @@
 #include <sys/mman.h>
 #include <x86intrin.h>
 
-#include "../lib/address_translation.h"
 #include "../lib/constants.h"
 #include "../lib/eviction.h"
+#include "../lib/memory.h"
+#include "../lib/traversal.h"
 #include "../lib/utils.h"
 
 /*********************************************************************
@@ -21,6 +23,26 @@
 // thread)
 bool attack_finished = false;
 
+CandidateArena *candidate_arena = NULL;
+
+HugepagePool *hugepage_pool = NULL;
+
+uint64_t eviction_tests = 0;
+
+uint64_t eviction_samples = 0;
+
+uint64_t reduction_retries = 0;
+
+bool sequential_tests = false;
+
+size_t inflate_budget = INFLATE_BUDGET;
+
+ReduceFunction reduce_function = reduce2;
+
+PagemapReader *pagemap_reader = NULL;
+
+CandidatePipeline *candidate_pipeline = NULL;
+
 /*********************************************************************
  * Address Translation
  *
@@ -29,54 +51,41 @@ bool attack_finished = false;
  *
  *********************************************************************/
 
-// Translate virtual address to physical addresses by reading the page map
+bool open_pagemap_reader(void) {
+  if (pagemap_reader == NULL) {
+    pagemap_reader = new_pagemap_reader(0);
+  }
+  return pagemap_reader != NULL;
+}
+
+// Translate a virtual address to a physical address with memory_backend
 uintptr_t pointer_to_pa(void *va) {
-  uintptr_t pa = 0;
+  return memory_backend->translate(memory_backend, va);
+}
 
-  if (virt_to_phys_user(&pa, getpid(), (uintptr_t)va)) {
-    fprintf(stderr, "error: virt_to_phys_user\n");
-    return -1;
-  };
+// Whether pa is a real physical address. Without CAP_SYS_ADMIN, pagemap reads
+// every frame number as 0, leaving only the page offset.
+bool pa_available(uintptr_t pa) {
+  return pa != (uintptr_t)-1 && pa >> PAGE_OFFSET_BITS != 0;
+}
 
-  return pa;
+// Translate every line of cl_set into pas, with batched pagemap reads on
+// hardware. Returns the number of lines translated; the others get
+// (uintptr_t)-1.
+int cl_set_to_pas(CacheLineSet *cl_set, uintptr_t *pas) {
+  return memory_backend->translate_lines(
+      memory_backend, (void **)cl_set->cache_lines, pas, cl_set->size);
 }
 
-// Determine the cache set of a physical address by reading bits [6, 16)
-int pa_to_set(uintptr_t pa, int machine) {
-  if (machine == EVERGLADES)
-    return (pa >> LINE_OFFSET_BITS) & ((1 << EVERGLADES_CACHE_SET_BITS) - 1);
-  else
-    return (pa >> LINE_OFFSET_BITS) & ((1 << ACADIA_CACHE_SET_BITS) - 1);
+// Determine the cache set of a physical address by reading its set index bits
+int pa_to_set(uintptr_t pa, CacheGeometry *geometry) {
+  return geometry_set_index(geometry, pa);
 }
 
+// Slice of pa on the i7-2600, numbered with the first hash bit as the high bit
 int get_i7_2600_slice(uintptr_t pa) {
-
-  /* Practical Timing Side Channel Attacks Against Kernel Space ASLR */
-  // int h2 = get_bit(pa, 31) ^ get_bit(pa, 29) ^ get_bit(pa, 28) ^
-  //          get_bit(pa, 26) ^ get_bit(pa, 24) ^ get_bit(pa, 23) ^
-  //          get_bit(pa, 22) ^ get_bit(pa, 21) ^ get_bit(pa, 20) ^
-  //          get_bit(pa, 19) ^ get_bit(pa, 17);
-  // int h1 = get_bit(pa, 31) ^ get_bit(pa, 30) ^ get_bit(pa, 29) ^
-  //          get_bit(pa, 27) ^ get_bit(pa, 25) ^ get_bit(pa, 23) ^
-  //          get_bit(pa, 21) ^ get_bit(pa, 19) ^ get_bit(pa, 18);
-
-  /* Reverse Engineering Intel Last-Level Cache Complex Addressing Using
-   * Performance Counters */
-
-  int h1 = get_bit(pa, 33) ^ get_bit(pa, 32) ^ get_bit(pa, 30) ^
-           get_bit(pa, 28) ^ get_bit(pa, 27) ^ get_bit(pa, 26) ^
-           get_bit(pa, 25) ^ get_bit(pa, 24) ^ get_bit(pa, 22) ^
-           get_bit(pa, 20) ^ get_bit(pa, 18) ^ get_bit(pa, 17) ^
-           get_bit(pa, 16) ^ get_bit(pa, 14) ^ get_bit(pa, 12) ^
-           get_bit(pa, 10) ^ get_bit(pa, 6);
-  int h2 = get_bit(pa, 34) ^ get_bit(pa, 33) ^ get_bit(pa, 31) ^
-           get_bit(pa, 29) ^ get_bit(pa, 28) ^ get_bit(pa, 26) ^
-           get_bit(pa, 24) ^ get_bit(pa, 23) ^ get_bit(pa, 22) ^
-           get_bit(pa, 21) ^ get_bit(pa, 20) ^ get_bit(pa, 19) ^
-           get_bit(pa, 17) ^ get_bit(pa, 15) ^ get_bit(pa, 13) ^
-           get_bit(pa, 11) ^ get_bit(pa, 7);
-
-  return (h1 << 1) + h2;
+  int slice = pa_to_slice(find_slice_hash(0x2A, 4), pa);
+  return ((slice & 1) << 1) | (slice >> 1);
 }
 
 CacheLine *align_to_page(CacheLine *va) {
@@ -104,75 +113,188 @@ CacheLine *align_to_victim(CacheLine *va, uint8_t *victim) {
  * Timing
  *********************************************************************/
 
-// Times a memory access to the given byte pointer
+// Times a memory access to the given byte pointer, with load_timer on
+// hardware
 uint64_t time_load(volatile uint8_t *victim) {
-  int core_id = 0;
-  _mm_mfence();
-  uint64_t t0 = __rdtscp(&core_id);
-  _mm_lfence();
-  volatile uint8_t x = *victim;
-  uint64_t t1 = __rdtscp(&core_id);
-  _mm_lfence();
-
-  return t1 - t0;
+  return memory_backend->time_load(memory_backend, victim);
 }
 
-// Calculates the cache hit threshold by timing a memory access both with and
-// without evicting it. If cl_set isn't an eviction set for victim, this won't
-// work.
-uint64_t threshold_from_evict(CacheLineSet *cl_set, uint8_t *victim) {
-  CacheLineSet *empty_set = new_cl_set();
-  NumList *timings = new_num_list(SAMPLES);
-  // Accessing an empty eviction set should leave victim cached
-  uint64_t t_cached = evict_and_time(empty_set, victim, timings, false);
-  free_cl_set(empty_set);
-  free_num_list(timings);
-  // Accessing a real eviction set should force victim out of the cache
-  NumList *timings2 = new_num_list(SAMPLES);
-  uint64_t t_evicted = evict_and_time(cl_set, victim, timings2, true);
-  free_num_list(timings2);
-  uint64_t threshold = (t_cached + t_evicted) / 2;
+// Split hits and misses with Otsu's method: histogram both, and cut where the
+// variance between the two classes of the combined histogram is largest.
+// Empty bins between the peaks all give the same variance, so the cut is put
+// in the middle of them. Timings above twice the median miss are left out of
+// the histogram as interrupts.
+ThresholdEstimate estimate_threshold(NumList *hits, NumList *misses) {
+  ThresholdEstimate estimate = {0};
+  uint64_t hit_bins[THRESHOLD_BINS] = {0};
+  uint64_t miss_bins[THRESHOLD_BINS] = {0};
+
+  uint64_t range = 2 * median_and_sort(misses) + 1;
+  uint64_t width = (range + THRESHOLD_BINS - 1) / THRESHOLD_BINS;
+  for (int i = 0; i < hits->length; i++) {
+    if (hits->nums[i] < range) {
+      hit_bins[hits->nums[i] / width]++;
+    }
+  }
+  for (int i = 0; i < misses->length; i++) {
+    if (misses->nums[i] < range) {
+      miss_bins[misses->nums[i] / width]++;
+    }
+  }
 
-  if (threshold < 90 || threshold > 150) {
-    return threshold_from_evict(cl_set, victim);
+  double total = 0, total_sum = 0;
+  for (int b = 0; b < THRESHOLD_BINS; b++) {
+    total += hit_bins[b] + miss_bins[b];
+    total_sum += (double)b * (hit_bins[b] + miss_bins[b]);
   }
 
-#ifndef __MEASURE__
-  printf("Calculated threshold of %lu with Evict+Reload.\n", threshold);
-#endif
+  double best = -1;
+  int first = 0, last = 0;
+  double below = 0, below_sum = 0;
+  for (int b = 0; b < THRESHOLD_BINS - 1; b++) {
+    below += hit_bins[b] + miss_bins[b];
+    below_sum += (double)b * (hit_bins[b] + miss_bins[b]);
+    if (below == 0 || below == total) {
+      continue;
+    }
 
-  return threshold;
-}
+    double above = total - below;
+    double gap = (total_sum - below_sum) / above - below_sum / below;
+    double variance = below * above * gap * gap;
+    if (variance > best) {
+      best = variance;
+      first = last = b;
+    } else if (variance == best) {
+      last = b;
+    }
+  }
 
-// Calculates the cache hit threshold by timing a memory access both with and
-// without flushing it.
-uint64_t threshold_from_flush(uint8_t *victim) {
-  NumList *timings = new_num_list(SAMPLES);
+  // Without both classes in range, fall back to halfway between the medians
+  estimate.threshold = (median_and_sort(hits) + range / 2) / 2;
+  if (best >= 0) {
+    int cut = (first + last) / 2 + 1;
+    estimate.threshold = cut * width;
+
+    // Class statistics in bins, with a floor of one bin on the spread
+    double count[2] = {0}, sum[2] = {0}, squares[2] = {0};
+    for (int b = 0; b < THRESHOLD_BINS; b++) {
+      int c = b >= cut;
+      double n = hit_bins[b] + miss_bins[b];
+      count[c] += n;
+      sum[c] += n * b;
+      squares[c] += n * b * b;
+    }
+    double spread = 0;
+    for (int c = 0; c < 2; c++) {
+      double m = sum[c] / count[c];
+      spread += sqrt(MAX(squares[c] / count[c] - m * m, 0));
+    }
+    estimate.margin =
+        (sum[1] / count[1] - sum[0] / count[0]) / MAX(spread, 1.0);
+  }
 
-  for (int i = 0; i < SAMPLES; i++) {
-    volatile uint8_t x = *victim;
-    push_num(timings, time_load(victim));
+  uint64_t errors = 0;
+  for (int i = 0; i < hits->length; i++) {
+    errors += hits->nums[i] >= estimate.threshold;
   }
+  for (int i = 0; i < misses->length; i++) {
+    errors += misses->nums[i] < estimate.threshold;
+  }
+  estimate.error = (double)errors / (hits->length + misses->length);
 
-  uint64_t t_cached = median_and_sort(timings);
-  clear_num_list(timings);
+  return estimate;
+}
 
-  for (int i = 0; i < SAMPLES; i++) {
-    _mm_clflush(victim);
-    push_num(timings, time_load(victim));
+// Estimate the threshold from samples cached and flushed loads of victim
+ThresholdEstimate estimate_flush_threshold(uint8_t *victim, int samples) {
+  NumList *hits = new_num_list(samples);
+  NumList *misses = new_num_list(samples);
+
+  for (int i = 0; i < samples; i++) {
+    load_line(victim);
+    push_num(hits, time_load(victim));
+    flush_line(victim);
+    push_num(misses, time_load(victim));
   }
 
-  uint64_t t_flushed = median_and_sort(timings);
+  ThresholdEstimate estimate = estimate_threshold(hits, misses);
+
+  free_num_list(misses);
+  free_num_list(hits);
 
-  uint64_t threshold = (t_cached + t_flushed) / 2;
+  return estimate;
+}
 
+// Keep the better separated of two estimates
+void keep_best_estimate(ThresholdEstimate *best, ThresholdEstimate estimate,
+                        int attempt) {
+  if (attempt == 0 || estimate.margin > best->margin) {
+    *best = estimate;
+  }
+}
+
+void report_threshold(ThresholdEstimate estimate, int attempts,
+                      const char *method) {
+  if (estimate.margin < THRESHOLD_MIN_MARGIN) {
+    fprintf(stderr,
+            "warning: hits and misses are poorly separated after %d "
+            "attempts (margin %.2f)\n",
+            attempts, estimate.margin);
+  }
 #ifndef __MEASURE__
-  printf("Calculated threshold of %lu with Flush+Reload.\n", threshold);
+  printf("Calculated threshold of %lu with %s (margin %.2f, %.1f%% "
+         "misclassified).\n",
+         estimate.threshold, method, estimate.margin, 100 * estimate.error);
 #endif
+}
+
+// Calculates the cache hit threshold by timing a memory access both with and
+// without evicting it. If cl_set isn't an eviction set for victim, the margin
+// stays low and this gives up after THRESHOLD_RETRIES attempts.
+uint64_t threshold_from_evict(CacheLineSet *cl_set, uint8_t *victim) {
+  CacheLineSet *empty_set = new_cl_set();
+  EvictionScratch *scratch = new_eviction_scratch(2 * cl_set->size);
+  NumList *hits = new_num_list(SAMPLES);
+  NumList *misses = new_num_list(SAMPLES);
+  ThresholdEstimate best = {0};
+  int attempt = 0;
+
+  do {
+    clear_num_list(hits);
+    clear_num_list(misses);
+    // Accessing an empty eviction set should leave victim cached
+    evict_and_time_scratch(empty_set, victim, hits, false, scratch);
+    // Accessing a real eviction set should force victim out of the cache
+    evict_and_time_scratch(cl_set, victim, misses, true, scratch);
+    keep_best_estimate(&best, estimate_threshold(hits, misses), attempt);
+    attempt++;
+  } while (best.margin < THRESHOLD_MIN_MARGIN && attempt < THRESHOLD_RETRIES);
+
+  free_num_list(misses);
+  free_num_list(hits);
+  free_eviction_scratch(scratch);
+  free_cl_set(empty_set);
+
+  report_threshold(best, attempt, "Evict+Reload");
+
+  return best.threshold;
+}
+
+// Calculates the cache hit threshold by timing a memory access both with and
+// without flushing it.
+uint64_t threshold_from_flush(uint8_t *victim) {
+  ThresholdEstimate best = {0};
+  int attempt = 0;
+
+  do {
+    keep_best_estimate(&best, estimate_flush_threshold(victim, SAMPLES),
+                       attempt);
+    attempt++;
+  } while (best.margin < THRESHOLD_MIN_MARGIN && attempt < THRESHOLD_RETRIES);
 
-  // assert(threshold > 90 && threshold < 150);
+  report_threshold(best, attempt, "Flush+Reload");
 
-  return threshold;
+  return best.threshold;
 }
 
 /*********************************************************************
@@ -181,12 +303,244 @@ uint64_t threshold_from_flush(uint8_t *victim) {
 
 void print_cache_line(CacheLine *cl) {
   printf("%12p => ", cl);
-  printf("0x%013lx ", pointer_to_pa(cl));
-  printf("{ %u }\n", pa_to_set(pointer_to_pa(cl), EVERGLADES));
+  uintptr_t pa = pointer_to_pa(cl);
+  printf("0x%013lx ", pa);
+  printf("{ %u }\n", pa_to_set(pa, cache_geometry));
+}
+
+// Reserve num_pages candidate pages with a single mmap. With populate, every
+// page is faulted in up front so handing out a line never page faults.
+CandidateArena *new_candidate_arena(int num_pages, bool populate) {
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+  if (populate) {
+    flags |= MAP_POPULATE;
+  }
+
+  void *start = mmap(NULL, (size_t)num_pages * PAGE_BYTES,
+                     PROT_READ | PROT_WRITE, flags, -1, 0);
+  if (start == MAP_FAILED) {
+    perror("mmap candidate arena");
+    return NULL;
+  }
+
+  CandidateArena *arena = malloc(sizeof(CandidateArena));
+  arena->start = start;
+  arena->num_pages = num_pages;
+  arena->next_page = 0;
+  arena->free_pages = calloc(num_pages, sizeof(int));
+  arena->free_count = 0;
+
+  return arena;
+}
+
+void free_candidate_arena(CandidateArena *arena) {
+  munmap(arena->start, (size_t)arena->num_pages * PAGE_BYTES);
+  free(arena->free_pages);
+  free(arena);
+}
+
+// Make every page of the arena available again. Only call this once none of
+// the lines handed out are in use anymore.
+void reset_candidate_arena(CandidateArena *arena) {
+  arena->next_page = 0;
+  arena->free_count = 0;
+}
+
+bool arena_contains(CandidateArena *arena, void *va) {
+  return arena != NULL && (uint8_t *)va >= arena->start &&
+         (uint8_t *)va < arena->start + (size_t)arena->num_pages * PAGE_BYTES;
+}
+
+// Hand out a victim-aligned line from the arena, preferring released pages.
+// Returns NULL once every page is in use.
+CacheLine *arena_allocate_line(CandidateArena *arena, uint8_t *victim) {
+  uint8_t *page;
+
+  if (arena->free_count > 0) {
+    page = arena->start +
+           (size_t)arena->free_pages[--arena->free_count] * PAGE_BYTES;
+  } else if (arena->next_page < arena->num_pages) {
+    page = arena->start + (size_t)arena->next_page++ * PAGE_BYTES;
+    // Write to the page so it gets its own frame instead of the zero page
+    *(volatile uint8_t *)page = 0xFF;
+  } else {
+    return NULL;
+  }
+
+  return align_to_victim((CacheLine *)page, victim);
+}
+
+void arena_release_line(CandidateArena *arena, CacheLine *cl) {
+  int page = ((uint8_t *)cl - arena->start) >> PAGE_OFFSET_BITS;
+  arena->free_pages[arena->free_count++] = page;
 }
 
-// Allocate an aligned page and initialize it
+// Map bytes of hugepages (rounded up to whole hugepages) to take candidates
+// from. Returns NULL if no hugepages are available.
+HugepagePool *new_hugepage_pool(size_t bytes, CacheGeometry *geometry) {
+  size_t page_bytes = (size_t)1 << geometry->hugepage_bits;
+  bytes = (bytes + page_bytes - 1) & ~(page_bytes - 1);
+
+  void *start = memory_backend->map_hugepages(memory_backend, bytes);
+  if (start == NULL) {
+    return NULL;
+  }
+
+  // Fault in every hugepage so it has a physical address
+  for (size_t offset = 0; offset < bytes; offset += page_bytes) {
+    *((volatile uint8_t *)start + offset) = 0xFF;
+  }
+
+  size_t lines = bytes >> geometry->line_bits;
+
+  HugepagePool *pool = malloc(sizeof(HugepagePool));
+  pool->start = start;
+  pool->bytes = bytes;
+  pool->geometry = geometry;
+  pool->in_use = calloc((lines + 63) / 64, sizeof(uint64_t));
+
+  return pool;
+}
+
+void free_hugepage_pool(HugepagePool *pool) {
+  memory_backend->unmap_hugepages(memory_backend, pool->start, pool->bytes);
+  free(pool->in_use);
+  free(pool);
+}
+
+bool hugepage_pool_contains(HugepagePool *pool, void *va) {
+  return pool != NULL && (uint8_t *)va >= pool->start &&
+         (uint8_t *)va < pool->start + pool->bytes;
+}
+
+// Append to cl_set up to count lines from the hugepage-aligned region [start,
+// start + bytes) whose physical set index is set, skipping lines marked in
+// in_use (if not NULL) and marking the ones taken. If the set index fits in
+// the hugepage offset, every stride'th line matches and no translation is
+// needed; otherwise each hugepage holds at most one match, found by reading
+// its physical address. Returns the number of lines appended.
+int collect_hugepage_lines(CacheLineSet *cl_set, uint8_t *start, size_t bytes,
+                           CacheGeometry *geometry, int set, int count,
+                           uint64_t *in_use) {
+  uintptr_t stride = geometry_set_stride(geometry);
+  uintptr_t page_bytes = (uintptr_t)1 << geometry->hugepage_bits;
+  uintptr_t step = MIN(stride, page_bytes);
+  uintptr_t offset = ((uintptr_t)set << geometry->line_bits) & (step - 1);
+  int added = 0;
+
+  for (uintptr_t va = offset; va < bytes && added < count; va += step) {
+    if (stride > page_bytes) {
+      uintptr_t pa = pointer_to_pa(start + va);
+      if (!pa_available(pa) || geometry_set_index(geometry, pa) != set) {
+        continue;
+      }
+    }
+
+    size_t line = va >> geometry->line_bits;
+    if (in_use != NULL) {
+      if (in_use[line / 64] & (1ULL << (line % 64))) {
+        continue;
+      }
+      in_use[line / 64] |= 1ULL << (line % 64);
+    }
+
+    push_cache_line(cl_set, (CacheLine *)(start + va));
+    added++;
+  }
+
+  return added;
+}
+
+// Append up to count lines with physical set index set from a hugepage
+// mapping, without any bookkeeping
+int hugepage_set_lines(CacheLineSet *cl_set, uint8_t *start, size_t bytes,
+                       CacheGeometry *geometry, int set, int count) {
+  return collect_hugepage_lines(cl_set, start, bytes, geometry, set, count,
+                                NULL);
+}
+
+// Split cl_set into hash->slices sets by the slice of each line's physical
+// address. Returns NULL if the physical addresses are not available.
+CacheLineSet **cl_set_slices(CacheLineSet *cl_set, SliceHash *hash) {
+  uintptr_t *pas = malloc(cl_set->size * sizeof(uintptr_t));
+  int *slices = malloc(cl_set->size * sizeof(int));
+  CacheLineSet **buckets = NULL;
+  bool translated = cl_set_to_pas(cl_set, pas) == cl_set->size;
+
+  for (int i = 0; translated && i < cl_set->size; i++) {
+    translated = pa_available(pas[i]);
+  }
+
+  if (translated) {
+    pas_to_slices(hash, pas, slices, cl_set->size);
+    buckets = malloc(hash->slices * sizeof(CacheLineSet *));
+    for (int slice = 0; slice < hash->slices; slice++) {
+      buckets[slice] = new_cl_set();
+      reserve_cl_set(buckets[slice], cl_set->size / hash->slices);
+    }
+    for (int i = 0; i < cl_set->size; i++) {
+      push_cache_line(buckets[slices[i]], cl_set->cache_lines[i]);
+    }
+  }
+
+  free(slices);
+  free(pas);
+
+  return buckets;
+}
+
+// Set index of the victim, read from its offset if it lies in the pool and the
+// set index fits in a hugepage, and from pagemap otherwise. Returns -1 if the
+// physical address is unavailable (including a frame number of 0, which would
+// leave only the page offset), so that inflate falls back to 4 KiB pages.
+int hugepage_victim_set(HugepagePool *pool, uint8_t *victim) {
+  CacheGeometry *geometry = pool->geometry;
+
+  uintptr_t page_bytes = (uintptr_t)1 << geometry->hugepage_bits;
+
+  if (hugepage_pool_contains(pool, victim) &&
+      geometry_set_stride(geometry) <= page_bytes) {
+    return geometry_set_index(geometry, victim - pool->start);
+  }
+
+  uintptr_t pa = pointer_to_pa(victim);
+  if (!pa_available(pa)) {
+    return -1;
+  }
+
+  return geometry_set_index(geometry, pa);
+}
+
+// Take up to max_lines unused lines with the given set index from the pool.
+// They stay reserved until released with free_cache_line.
+CacheLineSet *hugepage_candidates(HugepagePool *pool, int set, int max_lines) {
+  CacheLineSet *cl_set = new_cl_set();
+  collect_hugepage_lines(cl_set, pool->start, pool->bytes, pool->geometry, set,
+                         max_lines, pool->in_use);
+
+  return cl_set;
+}
+
+// Allocate a candidate line aligned to the victim, from the candidate pipeline
+// if there is one, then from the candidate arena if it has room and from the
+// heap otherwise
 CacheLine *allocate_cache_line(uint8_t *victim) {
+  if (candidate_pipeline != NULL) {
+    return align_to_victim(
+        (CacheLine *)pipeline_take_page(candidate_pipeline, NULL), victim);
+  }
+
+  if (candidate_arena == NULL) {
+    candidate_arena = new_candidate_arena(ARENA_PAGES, false);
+  }
+
+  if (candidate_arena != NULL) {
+    CacheLine *cl = arena_allocate_line(candidate_arena, victim);
+    if (cl != NULL) {
+      return cl;
+    }
+  }
+
   void *new_page = aligned_alloc(PAGE_BYTES, PAGE_BYTES);
   memset(new_page, 0xFF, PAGE_BYTES);
 
@@ -197,35 +551,82 @@ CacheLineSet *new_cl_set(void) {
   CacheLineSet *cl_set = malloc(sizeof(CacheLineSet));
   cl_set->cache_lines = NULL;
   cl_set->size = 0;
+  cl_set->capacity = 0;
 
   return cl_set;
 }
 
-void push_cache_line(CacheLineSet *cl_set, CacheLine *cl) {
-  cl_set->size++;
+// Make sure the set can hold at least capacity cache lines without
+// reallocating
+void reserve_cl_set(CacheLineSet *cl_set, int capacity) {
+  if (capacity <= cl_set->capacity) {
+    return;
+  }
+
   cl_set->cache_lines =
-      reallocarray(cl_set->cache_lines, cl_set->size, sizeof(CacheLine));
-  cl_set->cache_lines[cl_set->size - 1] = cl;
+      reallocarray(cl_set->cache_lines, capacity, sizeof(CacheLine *));
+  cl_set->capacity = capacity;
 }
 
-// Free a cache line set without freeing the individual cache lines
-void free_cl_set(CacheLineSet *cl_set) {
-  if (cl_set->size > 0) {
+// Release any capacity beyond the current size of the set
+void shrink_cl_set(CacheLineSet *cl_set) {
+  if (cl_set->size == cl_set->capacity) {
+    return;
+  }
+
+  if (cl_set->size == 0) {
     free(cl_set->cache_lines);
+    cl_set->cache_lines = NULL;
+  } else {
+    cl_set->cache_lines =
+        reallocarray(cl_set->cache_lines, cl_set->size, sizeof(CacheLine *));
   }
+  cl_set->capacity = cl_set->size;
+}
 
+// Append a cache line, doubling the capacity whenever the set is full
+void push_cache_line(CacheLineSet *cl_set, CacheLine *cl) {
+  if (cl_set->size == cl_set->capacity) {
+    reserve_cl_set(cl_set, MAX(2 * cl_set->capacity, 16));
+  }
+  cl_set->cache_lines[cl_set->size++] = cl;
+}
+
+// Free a cache line set without freeing the individual cache lines
+void free_cl_set(CacheLineSet *cl_set) {
+  free(cl_set->cache_lines);
   free(cl_set);
 }
 
+// Free the page of a cache line from allocate_cache_line. Lines from the
+// candidate arena or the hugepage pool are returned to them rather than freed.
+void free_cache_line(CacheLine *cl) {
+  if (hugepage_pool_contains(hugepage_pool, cl)) {
+    size_t line = ((uint8_t *)cl - hugepage_pool->start) >>
+                  hugepage_pool->geometry->line_bits;
+    hugepage_pool->in_use[line / 64] &= ~(1ULL << (line % 64));
+    return;
+  }
+
+  CacheLine *page_aligned = align_to_page(cl);
+  if (arena_contains(candidate_arena, page_aligned)) {
+    arena_release_line(candidate_arena, page_aligned);
+  } else {
+    // The allocator may give the page back to the kernel, so its cached
+    // translation could go stale
+    if (pagemap_reader != NULL) {
+      pagemap_invalidate(pagemap_reader, page_aligned, PAGE_BYTES);
+    }
+    free(page_aligned);
+  }
+}
+
 // Free a cache line set and the individual cache lines
 void deep_free_cl_set(CacheLineSet *cl_set) {
-  if (cl_set->size > 0) {
-    for (int i = 0; i < cl_set->size; i++) {
-      CacheLine *page_aligned = align_to_page(cl_set->cache_lines[i]);
-      free(page_aligned);
-    }
-    free(cl_set->cache_lines);
+  for (int i = 0; i < cl_set->size; i++) {
+    free_cache_line(cl_set->cache_lines[i]);
   }
+  free(cl_set->cache_lines);
   free(cl_set);
 }
 
@@ -235,17 +636,15 @@ void print_cl_set(CacheLineSet *cl_set) {
   }
 }
 
-// Remove the last cache line from the set of cache lines and return it
+// Remove the last cache line from the set of cache lines and return it. The
+// capacity is kept so that the set can be refilled without reallocating.
 CacheLine *pop_cache_line(CacheLineSet *cl_set) {
-  // Get last CacheLine from CacheLineSet and resize list
-  CacheLine *cl = cl_set->cache_lines[cl_set->size - 1];
   cl_set->size--;
-  cl_set->cache_lines =
-      reallocarray(cl_set->cache_lines, cl_set->size, sizeof(CacheLine));
-  return cl;
+  return cl_set->cache_lines[cl_set->size];
 }
 
-// Remove the cache line at the given index and return it
+// Remove the cache line at the given index and return it, preserving the
+// order of the remaining cache lines
 CacheLine *remove_cache_line(CacheLineSet *cl_set, int index) {
   if (index < 0 || index >= cl_set->size) {
     printf("Invalid index into CacheLineSet: %u for size %u\n", index,
@@ -254,68 +653,145 @@ CacheLine *remove_cache_line(CacheLineSet *cl_set, int index) {
   }
   CacheLine *removed = cl_set->cache_lines[index];
 
-  // Copy cache lines over to new location
-  CacheLine **new_cache_lines = calloc(cl_set->size - 1, sizeof(CacheLine *));
+  memmove(&cl_set->cache_lines[index], &cl_set->cache_lines[index + 1],
+          (cl_set->size - index - 1) * sizeof(CacheLine *));
+  cl_set->size--;
 
-  for (int i = 0; i < index; i++) {
-    new_cache_lines[i] = cl_set->cache_lines[i];
-  }
+  return removed;
+}
 
-  for (int i = index + 1; i < cl_set->size; i++) {
-    new_cache_lines[i - 1] = cl_set->cache_lines[i];
+// Remove the cache line at the given index in O(1) by moving the last cache
+// line into its place. The order of the remaining cache lines is not kept.
+CacheLine *swap_remove_cache_line(CacheLineSet *cl_set, int index) {
+  if (index < 0 || index >= cl_set->size) {
+    printf("Invalid index into CacheLineSet: %u for size %u\n", index,
+           cl_set->size);
+    return NULL;
   }
+  CacheLine *removed = cl_set->cache_lines[index];
 
   cl_set->size--;
-  free(cl_set->cache_lines);
-  cl_set->cache_lines = new_cache_lines;
+  cl_set->cache_lines[index] = cl_set->cache_lines[cl_set->size];
 
   return removed;
 }
 
+// Remove the cache lines in [low, high) with a single move, preserving the
+// order of the remaining cache lines
+void remove_cache_line_range(CacheLineSet *cl_set, int low, int high) {
+  if (low < 0 || high > cl_set->size || low > high) {
+    printf("Invalid range into CacheLineSet: [%u, %u) for size %u\n", low,
+           high, cl_set->size);
+    return;
+  }
+
+  memmove(&cl_set->cache_lines[low], &cl_set->cache_lines[high],
+          (cl_set->size - high) * sizeof(CacheLine *));
+  cl_set->size -= high - low;
+}
+
 // Randomly shuffle a set of cache lines in place
 void shuffle_lines(CacheLineSet *cl_set) {
   for (int i = 0; i < cl_set->size - 1; i++) {
     int j = (rand() % (cl_set->size - i)) + i;
-    CacheLine **temp = malloc(sizeof(CacheLine *));
-    memcpy(temp, &(cl_set->cache_lines[i]), sizeof(CacheLine *));
-    memcpy(&(cl_set->cache_lines[i]), &(cl_set->cache_lines[j]),
-           sizeof(CacheLine *));
-    memcpy(&(cl_set->cache_lines[j]), temp, sizeof(CacheLine *));
-    free(temp);
+    CacheLine *temp = cl_set->cache_lines[i];
+    cl_set->cache_lines[i] = cl_set->cache_lines[j];
+    cl_set->cache_lines[j] = temp;
   }
 }
 
 // Generate an eviction set (CacheLineSet) for the victim, of at most max_size
+// lines, or of at most inflate_budget bytes of candidate pages if max_size is
+// 0. If hugepage_pool is set, candidates are pool lines with the victim's set
+// index rather than fresh pages. The set doubles in size until it evicts, and
+// is then bisected back down between the last two sizes to the shortest prefix
+// that still evicts (within 1/INFLATE_RESOLUTION of its size). Prefixes are
+// tested in place, so bisecting never copies or reallocates the set. A size
+// only counts as evicting if every repetition evicts, so tests of sizes that
+// do not evict stop at their first miss.
 CacheLineSet *inflate(uint8_t *victim, int max_size, int samples,
                       uint64_t threshold) {
+  int limit = max_size > 0 ? max_size : (int)(inflate_budget / PAGE_BYTES);
+
+  // Lines with the victim's full set index, if there is a hugepage pool
+  CacheLineSet *candidates = NULL;
+  int set = (hugepage_pool != NULL) ? hugepage_victim_set(hugepage_pool, victim)
+                                    : -1;
+  if (set >= 0) {
+    candidates = hugepage_candidates(hugepage_pool, set, limit + 1);
+
+    // The victim's own line can't be part of its eviction set
+    for (int i = 0; i < candidates->size; i++) {
+      if ((uintptr_t)candidates->cache_lines[i] ==
+          ((uintptr_t)victim & ~(uintptr_t)(CACHE_LINE_BYTES - 1))) {
+        free_cache_line(swap_remove_cache_line(candidates, i));
+        break;
+      }
+    }
+    limit = MIN(limit, candidates->size);
+  }
+
   CacheLineSet *cl_set = new_cl_set();
+  EvictionScratch *scratch = new_eviction_scratch(MIN(limit, INITIAL_SIZE));
+  NumList *timings = new_num_list(samples);
+
+  // Largest size known not to evict and smallest size known to evict
+  int not_evicting = 0;
+  int evicting = 0;
 
-  while (cl_set->size < max_size) {
+  while (cl_set->size < limit) {
     // Double the size of the cache line set, starting at 16
-    int current_size = cl_set->size;
-    for (int i = current_size; i < MAX(2 * current_size, 16); i++) {
-      push_cache_line(cl_set, allocate_cache_line(victim));
+    int target = MIN(MAX(2 * cl_set->size, 16), limit);
+    reserve_cl_set(cl_set, target);
+    while (cl_set->size < target) {
+      push_cache_line(cl_set, candidates != NULL
+                                  ? candidates->cache_lines[cl_set->size]
+                                  : allocate_cache_line(victim));
     }
 
-    int strikes = 0;
-
-    // Check if it's an eviction set
-    for (int i = 0; i < 5; i++) {
-      NumList *timings = new_num_list(samples);
-      uint64_t timing = evict_and_time(cl_set, victim, timings, false);
+    // Check if it's an eviction set. If it is, stop growing
+    if (evicts_all(cl_set, victim, threshold, 5, true, timings, scratch)) {
+      evicting = cl_set->size;
+      break;
+    }
+    not_evicting = cl_set->size;
+  }
 
-      if (timing >= threshold) {
-        strikes++;
+  if (evicting == 0) {
+#ifndef __MEASURE__
+    printf("Warning: %u candidate lines still don't evict the victim.\n",
+           cl_set->size);
+#endif
+  } else {
+    while (evicting - not_evicting >
+           MAX(not_evicting / INFLATE_RESOLUTION, 16)) {
+      int middle = not_evicting + (evicting - not_evicting) / 2;
+      CacheLineSet prefix = {cl_set->cache_lines, middle, middle};
+
+      if (evicts_all(&prefix, victim, threshold, 5, true, timings, scratch)) {
+        evicting = middle;
+      } else {
+        not_evicting = middle;
       }
-      free_num_list(timings);
     }
 
-    // If it is, break and return the set
-    if (strikes >= 5) {
-      break;
+    for (int i = evicting; i < cl_set->size; i++) {
+      free_cache_line(cl_set->cache_lines[i]);
+    }
+    cl_set->size = evicting;
+  }
+
+  // Return the candidates that were never added
+  if (candidates != NULL) {
+    for (int i = cl_set->size; i < candidates->size; i++) {
+      free_cache_line(candidates->cache_lines[i]);
     }
+    free_cl_set(candidates);
   }
 
+  free_num_list(timings);
+  free_eviction_scratch(scratch);
+
 #ifndef __MEASURE__
   printf("Generated initial eviction set of size %u.\n", cl_set->size);
 #endif
@@ -333,8 +809,9 @@ void print_eviction_set(CacheLineSet *cl_set) {
   }
 }
 
-// Construct an intrusive linked list from each cache line in the set
-EvictionSet *new_eviction_set(CacheLineSet *cl_set) {
+// Link each cache line in the set into an intrusive linked list, filling in an
+// existing EvictionSet
+void link_eviction_set(EvictionSet *es, CacheLineSet *cl_set) {
   CacheLine *head = NULL;
   CacheLine *tail = NULL;
 
@@ -357,11 +834,16 @@ EvictionSet *new_eviction_set(CacheLineSet *cl_set) {
     }
   }
 
-  EvictionSet *es = malloc(sizeof(EvictionSet));
   es->cache_lines = cl_set;
   es->head = head;
   es->tail = tail;
   es->size = cl_set->size;
+}
+
+// Construct an intrusive linked list from each cache line in the set
+EvictionSet *new_eviction_set(CacheLineSet *cl_set) {
+  EvictionSet *es = malloc(sizeof(EvictionSet));
+  link_eviction_set(es, cl_set);
 
   return es;
 }
@@ -372,46 +854,10 @@ void deep_free_es(EvictionSet *es) {
   free(es);
 }
 
-// Access each of the cache lines in an eviction set
+// Access each of the cache lines in an eviction set with the selected
+// traversal kernel (see lib/traversal.h)
 void access_set(EvictionSet *es) {
-
-  if (es->size < 8) {
-    return;
-  }
-
-  // Perform access pattern twice
-  for (int i = 0; i < 2; i++) {
-    CacheLine *iter = es->head;
-    CacheLine *lagging_iter = es->head;
-
-    // Forwards dual-chasing over the linked list of cache lines
-    // lagging_iter lags 8 cache lines behind iter
-    for (int j = 0; j < 8; j++) {
-      iter = iter->next;
-    }
-
-    for (int j = 0; j < es->size; j++) {
-      if (j < es->size - 8) {
-        iter = iter->next;
-      }
-      lagging_iter = lagging_iter->next;
-    }
-
-    // Repeat the same pattern but in reverse
-    iter = es->tail;
-    lagging_iter = es->tail;
-
-    for (int j = 0; j < 8; j++) {
-      iter = iter->previous;
-    }
-
-    for (int j = 0; j < es->size; j++) {
-      if (j < es->size - 8) {
-        iter = iter->previous;
-      }
-      lagging_iter = lagging_iter->previous;
-    }
-  }
+  memory_backend->access_set(memory_backend, es);
 }
 
 // Access an eviction set repeatedly until attack_finished is set
@@ -433,40 +879,134 @@ void *access_loop(void *in) {
 
 // Evict the victim and time the access
 uint64_t evict_and_time_once(EvictionSet *es, uint8_t *victim) {
-  volatile uint8_t x = *victim;
+  load_line(victim);
   access_set(es);
   return time_load(victim);
 }
 
-// Repeatedly evict the victim and time the access, returning the median timing
-uint64_t evict_and_time(CacheLineSet *cl_set, uint8_t *victim, NumList *timings,
-                        bool use_siblings) {
-  // Construct new set of cache lines
-  CacheLineSet *second = new_cl_set();
+// Allocate scratch space for evict_and_time_scratch, with room for capacity
+// cache lines (twice the size of the largest set when using siblings). It
+// grows if a larger set is passed in later.
+EvictionScratch *new_eviction_scratch(int capacity) {
+  EvictionScratch *scratch = malloc(sizeof(EvictionScratch));
+  scratch->lines = new_cl_set();
+  reserve_cl_set(scratch->lines, capacity);
+  scratch->latencies = new_latency_histogram(0);
+
+  return scratch;
+}
+
+void free_eviction_scratch(EvictionScratch *scratch) {
+  free_cl_set(scratch->lines);
+  free_latency_histogram(scratch->latencies);
+  free(scratch);
+}
+
+// Copy cl_set (and the sibling of each line, if use_siblings) into the
+// scratch permutation
+void load_eviction_scratch(CacheLineSet *cl_set, bool use_siblings,
+                           EvictionScratch *scratch) {
+  CacheLineSet *second = scratch->lines;
+  second->size = 0;
+  reserve_cl_set(second, use_siblings ? 2 * cl_set->size : cl_set->size);
 
   for (int i = 0; i < cl_set->size; i++) {
     CacheLine *cl = cl_set->cache_lines[i];
-    push_cache_line(second, cl);
+    second->cache_lines[second->size++] = cl;
 
     // It includes all old cache lines, as well as the immediately
     // preceding/subsequent (sibling) lines
     if (use_siblings) {
       CacheLine *sibling = (CacheLine *)(((uintptr_t)cl) ^ 0x40);
-      push_cache_line(second, sibling);
+      second->cache_lines[second->size++] = sibling;
     }
   }
+}
+
+// Randomly shuffle the scratch permutation, relink it, and time the victim
+uint64_t sample_eviction_scratch(uint8_t *victim, EvictionScratch *scratch) {
+  eviction_samples++;
+  shuffle_lines(scratch->lines);
+  link_eviction_set(&scratch->es, scratch->lines);
+  return evict_and_time_once(&scratch->es, victim);
+}
+
+// Repeatedly evict the victim and time the access, returning the median
+// timing. The set is copied into the scratch permutation once; each sample
+// then shuffles and relinks it in place without allocating. The timings are
+// appended to timings in the order they were taken.
+uint64_t evict_and_time_scratch(CacheLineSet *cl_set, uint8_t *victim,
+                                NumList *timings, bool use_siblings,
+                                EvictionScratch *scratch) {
+  eviction_tests++;
+  load_eviction_scratch(cl_set, use_siblings, scratch);
+  clear_latency_histogram(scratch->latencies);
 
-  // Randomly shuffle cache lines, generate eviction set, and time the victim
   for (int i = 0; i < timings->capacity; i++) {
-    shuffle_lines(second);
-    EvictionSet *es = new_eviction_set(second);
-    push_num(timings, evict_and_time_once(es, victim));
-    free(es);
+    uint64_t t = sample_eviction_scratch(victim, scratch);
+    push_num(timings, t);
+    histogram_insert(scratch->latencies, t);
+  }
+
+  return histogram_median(scratch->latencies);
+}
+
+// Decide whether cl_set evicts the victim with Wald's sequential probability
+// ratio test. Each sample is a Bernoulli trial (evicted if the reload is at
+// least threshold) and the test weighs "evicts with probability SPRT_P1"
+// against "evicts with probability SPRT_P0", stopping as soon as either is
+// accepted with error probability 1 - confidence. Gives up after
+// SPRT_MAX_SAMPLES and picks the more likely hypothesis. The number of
+// samples taken is stored in samples_used unless it is NULL.
+bool is_eviction_set_scratch(CacheLineSet *cl_set, uint8_t *victim,
+                             uint64_t threshold, double confidence,
+                             EvictionScratch *scratch, int *samples_used) {
+  eviction_tests++;
+  load_eviction_scratch(cl_set, false, scratch);
+
+  double error = 1 - confidence;
+  double accept = log((1 - error) / error);
+  double reject = log(error / (1 - error));
+  double evicted_step = log(SPRT_P1 / SPRT_P0);
+  double cached_step = log((1 - SPRT_P1) / (1 - SPRT_P0));
+
+  double llr = 0;
+  int samples = 0;
+
+  while (samples < SPRT_MAX_SAMPLES && llr < accept && llr > reject) {
+    uint64_t t = sample_eviction_scratch(victim, scratch);
+    llr += (t >= threshold) ? evicted_step : cached_step;
+    samples++;
+  }
+
+  if (samples_used != NULL) {
+    *samples_used = samples;
   }
 
-  free_cl_set(second);
+  return llr > 0;
+}
+
+// Same as is_eviction_set_scratch, using temporary scratch space
+bool is_eviction_set(CacheLineSet *cl_set, uint8_t *victim, uint64_t threshold,
+                     double confidence) {
+  EvictionScratch *scratch = new_eviction_scratch(cl_set->size);
+  bool result = is_eviction_set_scratch(cl_set, victim, threshold, confidence,
+                                        scratch, NULL);
+  free_eviction_scratch(scratch);
+
+  return result;
+}
+
+// Same as evict_and_time_scratch, using temporary scratch space
+uint64_t evict_and_time(CacheLineSet *cl_set, uint8_t *victim, NumList *timings,
+                        bool use_siblings) {
+  EvictionScratch *scratch =
+      new_eviction_scratch(use_siblings ? 2 * cl_set->size : cl_set->size);
+  uint64_t median =
+      evict_and_time_scratch(cl_set, victim, timings, use_siblings, scratch);
+  free_eviction_scratch(scratch);
 
-  return median_and_sort(timings);
+  return median;
 }
 
 // Reduce an eviction set to its minimal subset
@@ -478,6 +1018,10 @@ bool reduce2(CacheLineSet *cl_set, CacheLineSet *reserve, uint8_t *victim,
 
   int failures = 0;
 
+  // Measurement buffers shared by every test in this reduction
+  EvictionScratch *scratch = new_eviction_scratch(cl_set->size + reserve->size);
+  NumList *timings = new_num_list(samples);
+
   // Continue until we fail to reduce 5 times in a row, while the working set is
   // an eviction set
   while (strikes < 5) {
@@ -497,6 +1041,10 @@ bool reduce2(CacheLineSet *cl_set, CacheLineSet *reserve, uint8_t *victim,
 
     RangeList *best_ranges = new_range_list();
 
+    // Scratch set reused for every bin, sized once for the whole round
+    CacheLineSet *set = new_cl_set();
+    reserve_cl_set(set, cl_set->size);
+
     // Iterate through all bins to see which ones are fine to leave out
     for (int i = 0; i < starts->length; i++) {
       if (cl_set->size == INITIAL_SIZE && i % (starts->length / 8) == 0) {
@@ -508,7 +1056,7 @@ bool reduce2(CacheLineSet *cl_set, CacheLineSet *reserve, uint8_t *victim,
       int end = ends->nums[i];
 
       Range *r = new_range(start, end);
-      CacheLineSet *set = new_cl_set();
+      set->size = 0;
 
       for (int j = 0; j < cl_set->size; j++) {
         CacheLine *cl = cl_set->cache_lines[j];
@@ -533,20 +1081,8 @@ bool reduce2(CacheLineSet *cl_set, CacheLineSet *reserve, uint8_t *victim,
         push_cache_line(set, cl);
       }
 
-      int strikes2 = 0;
-
-      for (int j = 0; j < 3; j++) {
-        NumList *timings = new_num_list(samples);
-        uint64_t timing = evict_and_time(set, victim, timings, false);
-
-        if (timing >= threshold) {
-          strikes2++;
-        }
-        free_num_list(timings);
-      }
-
       // If the smaller set doesn't evict 3/3 times, move on
-      if (strikes2 < 3) {
+      if (!evicts_all(set, victim, threshold, 3, false, timings, scratch)) {
         free(r);
         continue;
       }
@@ -555,6 +1091,7 @@ bool reduce2(CacheLineSet *cl_set, CacheLineSet *reserve, uint8_t *victim,
       push_range(best_ranges, r);
     }
 
+    free_cl_set(set);
     free_num_list(starts);
     free_num_list(ends);
 
@@ -570,28 +1107,18 @@ bool reduce2(CacheLineSet *cl_set, CacheLineSet *reserve, uint8_t *victim,
         Range *best_range = best_ranges->ranges[i];
 
         for (int j = best_range->high - 1; j >= best_range->low; j--) {
-          push_cache_line(reserve, remove_cache_line(cl_set, j));
+          push_cache_line(reserve, cl_set->cache_lines[j]);
         }
+        remove_cache_line_range(cl_set, best_range->low, best_range->high);
       }
 #ifndef __MEASURE__
       // printf("Attempting to reduce to size %u...\n", cl_set->size);
 #endif
     }
-
-    int strikes2 = 0;
+    free_range_list(best_ranges);
 
     // Test if current working set is an eviction set
-    for (int i = 0; i < 5; i++) {
-      NumList *timings = new_num_list(samples);
-      uint64_t timing = evict_and_time(cl_set, victim, timings, false);
-
-      if (timing >= threshold) {
-        strikes2++;
-      }
-      free_num_list(timings);
-    }
-
-    if (strikes2 >= 5) {
+    if (evicts_all(cl_set, victim, threshold, 5, false, timings, scratch)) {
 #ifndef __MEASURE__
       // printf("Success! Reduced eviction set to size %u.\n", cl_set->size);
 #endif
@@ -602,6 +1129,8 @@ bool reduce2(CacheLineSet *cl_set, CacheLineSet *reserve, uint8_t *victim,
     failures++;
     if (failures >= 10) {
       printf("Failed to reduce. Generating new initial set.\n");
+      free_num_list(timings);
+      free_eviction_scratch(scratch);
       return false;
     }
 #endif
@@ -615,20 +1144,8 @@ bool reduce2(CacheLineSet *cl_set, CacheLineSet *reserve, uint8_t *victim,
         push_cache_line(cl_set, pop_cache_line(reserve));
       }
 
-      int strikes2 = 0;
-
       // Test if the working set is an eviction set
-      for (int i = 0; i < 5; i++) {
-        NumList *timings = new_num_list(samples);
-        uint64_t timing = evict_and_time(cl_set, victim, timings, false);
-
-        if (timing >= threshold) {
-          strikes2++;
-        }
-        free_num_list(timings);
-      }
-
-      if (strikes2 >= 5) {
+      if (evicts_all(cl_set, victim, threshold, 5, false, timings, scratch)) {
         break;
       }
     }
@@ -637,10 +1154,136 @@ bool reduce2(CacheLineSet *cl_set, CacheLineSet *reserve, uint8_t *victim,
     // printf("Added back lines. Set now has size %u.\n", cl_set->size);
 #endif
   }
+  free_num_list(timings);
+  free_eviction_scratch(scratch);
+
   // Successfully reduced
   return true;
 }
 
+// Test whether cl_set evicts the victim in all of reps repetitions of
+// evict_and_time. With early_termination, stop at the first repetition that
+// doesn't evict. If sequential_tests is set, is_eviction_set_scratch decides
+// instead.
+bool evicts_all(CacheLineSet *cl_set, uint8_t *victim, uint64_t threshold,
+                int reps, bool early_termination, NumList *timings,
+                EvictionScratch *scratch) {
+  if (sequential_tests) {
+    return is_eviction_set_scratch(cl_set, victim, threshold, SPRT_CONFIDENCE,
+                                   scratch, NULL);
+  }
+
+  int strikes = 0;
+
+  for (int i = 0; i < reps; i++) {
+    clear_num_list(timings);
+    uint64_t timing =
+        evict_and_time_scratch(cl_set, victim, timings, false, scratch);
+
+    if (timing >= threshold) {
+      strikes++;
+    } else if (early_termination) {
+      return false;
+    }
+  }
+
+  return strikes == reps;
+}
+
+// Reduce an eviction set to its minimal subset with threshold group testing
+// (Vila et al., Theory and Practice of Finding Eviction Sets, Algorithm 2).
+// The set is split into groups; the first group whose removal still leaves an
+// eviction set is moved to reserve, until only cache_geometry->ways lines are
+// left. With groups >= ways + 1, some group never holds a congruent line, so
+// each round removes at least 1/groups of the set. If noise made a needed
+// group disappear and no group can be removed, the most recently removed group
+// is put back (backtracking).
+bool reduce_group_testing_ex(CacheLineSet *cl_set, CacheLineSet *reserve,
+                             uint8_t *victim, int samples, uint64_t threshold,
+                             int groups, bool early_termination,
+                             int max_backtracks) {
+  EvictionScratch *scratch = new_eviction_scratch(cl_set->size + reserve->size);
+  NumList *timings = new_num_list(samples);
+  CacheLineSet *set = new_cl_set();
+  reserve_cl_set(set, cl_set->size);
+
+  // Sizes of the groups moved to reserve, most recent last
+  NumList *removed = new_num_list(64);
+  int backtracks = 0;
+  bool result = true;
+
+  while (cl_set->size > cache_geometry->ways) {
+    int num_groups = MIN(groups, cl_set->size);
+    bool reduced = false;
+
+    for (int i = 0; i < num_groups; i++) {
+      int low = (int)((int64_t)cl_set->size * i / num_groups);
+      int high = (int)((int64_t)cl_set->size * (i + 1) / num_groups);
+
+      // Everything except [low, high)
+      set->size = 0;
+      memcpy(set->cache_lines, cl_set->cache_lines, low * sizeof(CacheLine *));
+      memcpy(set->cache_lines + low, cl_set->cache_lines + high,
+             (cl_set->size - high) * sizeof(CacheLine *));
+      set->size = cl_set->size - (high - low);
+
+      if (!evicts_all(set, victim, threshold, 3, early_termination, timings,
+                      scratch)) {
+        continue;
+      }
+
+      for (int j = high - 1; j >= low; j--) {
+        push_cache_line(reserve, cl_set->cache_lines[j]);
+      }
+      remove_cache_line_range(cl_set, low, high);
+      push_num(removed, high - low);
+      reduced = true;
+      break;
+    }
+
+    if (reduced) {
+      continue;
+    }
+
+    // No group could be left out, so put back the last group removed
+    if (removed->length == 0 || backtracks >= max_backtracks) {
+#ifndef __MEASURE__
+      printf("Failed to reduce. Generating new initial set.\n");
+#endif
+      result = false;
+      break;
+    }
+    backtracks++;
+    int restore = pop_num(removed);
+    for (int j = 0; j < restore; j++) {
+      push_cache_line(cl_set, pop_cache_line(reserve));
+    }
+  }
+
+  // Confirm the final set still evicts
+  if (result && !evicts_all(cl_set, victim, threshold, 5, early_termination,
+                            timings, scratch)) {
+    result = false;
+  }
+
+  free_num_list(removed);
+  free_cl_set(set);
+  free_num_list(timings);
+  free_eviction_scratch(scratch);
+
+  return result;
+}
+
+// reduce_group_testing_ex with early termination and GROUP_TESTING_BACKTRACKS
+// backtracks, using at most bins groups. Has the same signature as reduce2.
+bool reduce_group_testing(CacheLineSet *cl_set, CacheLineSet *reserve,
+                          uint8_t *victim, int samples, uint64_t threshold,
+                          int bins) {
+  return reduce_group_testing_ex(cl_set, reserve, victim, samples, threshold,
+                                 MIN(bins, cache_geometry->ways + 1), true,
+                                 GROUP_TESTING_BACKTRACKS);
+}
+
 // Generate a minimal eviction set for a victim
 EvictionSet *generate_set(uint8_t *victim) {
 // Generate initial large eviction set
@@ -669,15 +1312,7 @@ EvictionSet *generate_set(uint8_t *victim) {
   deep_free_cl_set(reserve);
 
   // Measure how often the minimal set evicts the victim
-  int count = 0;
-  for (int i = 0; i < SAMPLES; i++) {
-    NumList *timings = new_num_list(SAMPLES);
-    uint64_t t = evict_and_time(cl_set, victim, timings, false);
-    if (t >= threshold) {
-      count++;
-    }
-    free_num_list(timings);
-  }
+  int count = evict_time_multi(cl_set, victim, threshold, false);
 
 #ifndef __MEASURE__
   printf("Final eviction rate: %u/%u\n", count, SAMPLES);
@@ -703,7 +1338,8 @@ bool get_minimal_set(uint8_t *victim, CacheLineSet **cl_set,
 
   int tries = 0;
 
-  while (!reduce2(*cl_set, reserve, victim, SAMPLES, threshold, BINS)) {
+  while (!reduce_function(*cl_set, reserve, victim, SAMPLES, threshold,
+                          BINS)) {
     if (tries > 2) {
       return false;
     }
@@ -713,6 +1349,7 @@ bool get_minimal_set(uint8_t *victim, CacheLineSet **cl_set,
     deep_free_cl_set(reserve);
     reserve = new_cl_set();
     tries++;
+    reduction_retries++;
   }
   printf("Successfully reduced to size %u.\n", (*cl_set)->size);
   deep_free_cl_set(reserve);
@@ -723,14 +1360,18 @@ bool get_minimal_set(uint8_t *victim, CacheLineSet **cl_set,
 int evict_time_multi(CacheLineSet *cl_set, uint8_t *victim, uint64_t threshold,
                      bool use_siblings) {
   int count = 0;
+  EvictionScratch *scratch = new_eviction_scratch(2 * cl_set->size);
+  NumList *timings = new_num_list(SAMPLES);
   for (int i = 0; i < SAMPLES; i++) {
-    NumList *timings = new_num_list(SAMPLES);
-    uint64_t t = evict_and_time(cl_set, victim, timings, use_siblings);
+    clear_num_list(timings);
+    uint64_t t =
+        evict_and_time_scratch(cl_set, victim, timings, use_siblings, scratch);
     if (t >= threshold) {
       count++;
     }
-    free_num_list(timings);
   }
+  free_num_list(timings);
+  free_eviction_scratch(scratch);
 
   return count;
 }
@@ -760,15 +1401,24 @@ int same_cache_set(uint8_t *cl1, uint8_t *cl2, CacheLineSet *cl_set,
   }
 }
 
-bool match_cache_set(uint8_t *cl1, uint8_t *cl2, int num_bits) {
-  int set1 = pa_to_set(pointer_to_pa(cl1), EVERGLADES);
-  int set2 = pa_to_set(pointer_to_pa(cl2), EVERGLADES);
+// Whether the low num_bits of the set indices of two physical addresses match
+bool match_pa_sets(uintptr_t pa1, uintptr_t pa2, int num_bits,
+                   CacheGeometry *geometry) {
+  int mask = (1 << num_bits) - 1;
+  return (pa_to_set(pa1, geometry) & mask) ==
+         (pa_to_set(pa2, geometry) & mask);
+}
 
-  for (int i = 0; i < num_bits; i++) {
-    if ((set1 & 1) == (set2 & 1)) {
-      set1 >>= 1;
-      set2 >>= 1;
-    } else {
+bool match_cache_set(uint8_t *cl1, uint8_t *cl2, int num_bits,
+                     CacheGeometry *geometry) {
+  return match_pa_sets(pointer_to_pa(cl1), pointer_to_pa(cl2), num_bits,
+                       geometry);
+}
+
+bool all_same_cache_set(CacheLineSet *cl_set, CacheGeometry *geometry) {
+  int set = pa_to_set(pointer_to_pa(cl_set->cache_lines[0]), geometry);
+  for (int i = 1; i < cl_set->size; i++) {
+    if (pa_to_set(pointer_to_pa(cl_set->cache_lines[i]), geometry) != set) {
       return false;
     }
   }
@@ -776,48 +1426,65 @@ bool match_cache_set(uint8_t *cl1, uint8_t *cl2, int num_bits) {
   return true;
 }
 
-bool all_same_cache_set(CacheLineSet *cl_set) {
-  int set = pa_to_set(pointer_to_pa(cl_set->cache_lines[0]), EVERGLADES);
-  for (int i = 1; i < cl_set->size; i++) {
-    if (pa_to_set(pointer_to_pa(cl_set->cache_lines[i]), EVERGLADES) != set) {
-      return false;
-    }
+// allocate_cache_line, also returning the physical address of the line. Uses
+// the address read by the candidate pipeline if it translated the page.
+CacheLine *allocate_translated_line(uint8_t *victim, uintptr_t *pa) {
+  if (candidate_pipeline != NULL) {
+    uintptr_t page_pa;
+    uint8_t *page = pipeline_take_page(candidate_pipeline, &page_pa);
+    CacheLine *cl = align_to_victim((CacheLine *)page, victim);
+    *pa = (page_pa != (uintptr_t)-1) ? page_pa + ((uint8_t *)cl - page)
+                                     : pointer_to_pa(cl);
+    return cl;
   }
 
-  return true;
+  CacheLine *cl = allocate_cache_line(victim);
+  *pa = pointer_to_pa(cl);
+  return cl;
 }
 
-CacheLine *allocate_matching(uint8_t *victim, int matching_bits) {
-  void *new_page = aligned_alloc(PAGE_BYTES, PAGE_BYTES);
-  CacheLine *aligned_page = align_to_victim((CacheLine *)new_page, victim);
+CacheLine *allocate_matching(uint8_t *victim, int matching_bits,
+                             CacheGeometry *geometry) {
+  uintptr_t victim_pa = pointer_to_pa(victim);
+  uintptr_t pa;
+  CacheLine *aligned_page = allocate_translated_line(victim, &pa);
 
   CacheLineSet *reserve = new_cl_set();
 
-  while (!match_cache_set((uint8_t *)aligned_page, (uint8_t *)victim,
-                          matching_bits)) {
-    push_cache_line(reserve, new_page);
-    new_page = aligned_alloc(PAGE_BYTES, PAGE_BYTES);
-    aligned_page = align_to_victim((CacheLine *)new_page, victim);
+  // Hold on to non-matching pages until a match is found so they aren't
+  // handed out again
+  while (!match_pa_sets(pa, victim_pa, matching_bits, geometry)) {
+    push_cache_line(reserve, aligned_page);
+    aligned_page = allocate_translated_line(victim, &pa);
   }
 
-  memset(new_page, 0xFF, PAGE_BYTES);
-
   deep_free_cl_set(reserve);
 
   return aligned_page;
 }
 
+// Append the physical address of every line of cl_set to nl
+void push_cl_set_pas(NumList *nl, CacheLineSet *cl_set) {
+  uintptr_t pas[cl_set->size];
+  cl_set_to_pas(cl_set, pas);
+
+  for (int i = 0; i < cl_set->size; i++) {
+    push_num(nl, pas[i]);
+  }
+}
+
 CacheLineSet **generate_sets(int num_sets, uint8_t *victim_page_offset) {
   // Compute eviction threshold
   uint8_t dummy;
   CacheLineSet *initial_set =
       inflate(&dummy, INITIAL_SIZE, SAMPLES, INITIAL_THRESHOLD);
   uint64_t threshold = threshold_from_evict(initial_set, &dummy);
+  deep_free_cl_set(initial_set);
 
   // Allocate the first cache line
   CacheLineSet *unique_lines = new_cl_set();
-  push_cache_line(unique_lines,
-                  allocate_matching(victim_page_offset, MATCHING_BITS));
+  push_cache_line(unique_lines, allocate_matching(victim_page_offset,
+                                                MATCHING_BITS, cache_geometry));
 
   // Stores a minimal eviction set for each unique cache line we generate
   CacheLineSet **probe_sets = calloc(num_sets, sizeof(CacheLineSet *));
@@ -832,13 +1499,10 @@ CacheLineSet **generate_sets(int num_sets, uint8_t *victim_page_offset) {
   // Save physical addresses to makes sure they don't change
   NumList *pas[num_sets];
   for (int i = 0; i < num_sets; i++) {
-    pas[i] = new_num_list(ACADIA_ASSOCIATIVITY);
+    pas[i] = new_num_list(cache_geometry->ways);
   }
 
-  for (int i = 0; i < probe_sets[0]->size; i++) {
-    uintptr_t pa = pointer_to_pa(probe_sets[0]->cache_lines[i]);
-    push_num(pas[0], pa);
-  }
+  push_cl_set_pas(pas[0], probe_sets[0]);
 
   uintptr_t victim_pa = pointer_to_pa(victim_page_offset);
 
@@ -851,7 +1515,8 @@ CacheLineSet **generate_sets(int num_sets, uint8_t *victim_page_offset) {
 
     printf("[ Set %u ]\n", unique_lines->size);
 
-    CacheLine *cl_new = allocate_matching(victim_page_offset, MATCHING_BITS);
+    CacheLine *cl_new =
+        allocate_matching(victim_page_offset, MATCHING_BITS, cache_geometry);
 
     bool unique = true;
 
@@ -887,17 +1552,17 @@ CacheLineSet **generate_sets(int num_sets, uint8_t *victim_page_offset) {
       printf("Found unique line %u: \n", unique_lines->size - 1);
 
       print_cache_line(cl_new);
-      CacheLineSet **new_cl_set;
-      if (!get_minimal_set((uint8_t *)cl_new, new_cl_set, threshold)) {
+      CacheLineSet *minimal_set;
+      if (!get_minimal_set((uint8_t *)cl_new, &minimal_set, threshold)) {
         printf("Reduction failed repeatedly. Choosing new cache line\n");
         CacheLine *last_cl = pop_cache_line(unique_lines);
         push_cache_line(problem_lines, last_cl);
-        deep_free_cl_set(*new_cl_set);
+        deep_free_cl_set(minimal_set);
         continue;
       }
-      probe_sets[unique_lines->size - 1] = *new_cl_set;
+      probe_sets[unique_lines->size - 1] = minimal_set;
 
-      push_num(eviction_rates, evict_time_multi(*new_cl_set, victim_page_offset,
+      push_num(eviction_rates, evict_time_multi(minimal_set, victim_page_offset,
                                                 threshold, false));
       printf("Victim eviction rates for each generated set:\n");
       for (int i = 0; i < eviction_rates->length; i++) {
@@ -907,17 +1572,19 @@ CacheLineSet **generate_sets(int num_sets, uint8_t *victim_page_offset) {
       }
 
       // Save physical addresses from new eviction set
-      for (int i = 0; i < (*new_cl_set)->size; i++) {
-        uintptr_t pa = pointer_to_pa((*new_cl_set)->cache_lines[i]);
-        push_num(pas[unique_lines->size - 1], (uint64_t)pa);
-      }
+      push_cl_set_pas(pas[unique_lines->size - 1], minimal_set);
 
-      // Check that physical addresses didn't change
+      // Check that physical addresses didn't change, reading every page again
+      if (pagemap_reader != NULL) {
+        pagemap_invalidate_all(pagemap_reader);
+      }
       for (int i = 0; i < unique_lines->size; i++) {
         // printf("Checking on eviction set %u\n", i);
+        uintptr_t new_pas[probe_sets[i]->size];
+        cl_set_to_pas(probe_sets[i], new_pas);
         for (int j = 0; j < pas[i]->length; j++) {
           uint64_t old_pa = pas[i]->nums[j];
-          uint64_t new_pa = pointer_to_pa(probe_sets[i]->cache_lines[j]);
+          uint64_t new_pa = new_pas[j];
           if (old_pa != new_pa) {
             printf("Set %u element %u old PA: %lx new PA: %lx\n", i, j, old_pa,
                    new_pa);
@@ -0,0 +1,339 @@
+#define _GNU_SOURCE
+#include <cpuid.h>
+#include <dirent.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../lib/constants.h"
+#include "../lib/geometry.h"
+#include "../lib/traversal.h"
+#include "../lib/utils.h"
+
+CacheGeometry acadia_geometry = {
+    "Coffee Lake i7-9750H", LINE_OFFSET_BITS,   ACADIA_CACHE_SET_BITS,
+    ACADIA_ASSOCIATIVITY,   ACADIA_NUM_SLICES, HUGE_PAGE_OFFSET_BITS,
+    true};
+
+CacheGeometry everglades_geometry = {
+    "Sandy Bridge i7-2600", LINE_OFFSET_BITS,       EVERGLADES_CACHE_SET_BITS,
+    EVERGLADES_ASSOCIATIVITY, EVERGLADES_NUM_SLICES, HUGE_PAGE_OFFSET_BITS,
+    true};
+
+CacheGeometry *cache_geometry = &everglades_geometry;
+
+int slices_override = 0;
+
+// Filled in by init_cache_geometry
+CacheGeometry detected_geometry;
+char detected_name[49];
+
+// Cache set index of a physical address within its slice
+int geometry_set_index(CacheGeometry *geometry, uintptr_t pa) {
+  return (pa >> geometry->line_bits) & ((1 << geometry->set_bits) - 1);
+}
+
+// Distance between consecutive addresses with the same set index
+uintptr_t geometry_set_stride(CacheGeometry *geometry) {
+  return (uintptr_t)1 << (geometry->line_bits + geometry->set_bits);
+}
+
+// Capacity of the whole LLC, over all slices
+size_t geometry_llc_bytes(CacheGeometry *geometry) {
+  return (size_t)geometry->ways * geometry->slices *
+         geometry_set_stride(geometry);
+}
+
+/*********************************************************************
+ * Detection
+ *
+ * The LLC parameters come from the deterministic cache parameters leaf
+ * (CPUID leaf 4 on Intel, 0x8000001D on AMD), falling back to
+ * /sys/devices/system/cpu/cpu0/cache. Neither reports the number of slices.
+ * Each slice has its own CBo (client) or CHA (server) uncore PMU, so the
+ * slices are counted in /sys/bus/event_source/devices. Without those PMUs, as
+ * in most VMs, we fall back to one slice per physical core, which only holds
+ * for older client parts, so slices_override or LLC_SLICES should be set.
+ *********************************************************************/
+
+int floor_log2(uint64_t x) {
+  int bits = 0;
+  while (x >>= 1) {
+    bits++;
+  }
+  return bits;
+}
+
+// Find the level 3 cache in a deterministic cache parameters leaf
+bool cpuid_llc(unsigned int leaf, int *line_bytes, int *ways, int *sets,
+               bool *inclusive) {
+  unsigned int eax, ebx, ecx, edx;
+
+  for (unsigned int i = 0; __get_cpuid_count(leaf, i, &eax, &ebx, &ecx, &edx);
+       i++) {
+    // Cache type 0 ends the list
+    if ((eax & 0x1F) == 0) {
+      break;
+    }
+    if (((eax >> 5) & 0x7) != 3) {
+      continue;
+    }
+
+    *line_bytes = (ebx & 0xFFF) + 1;
+    *ways = ((ebx >> 22) & 0x3FF) + 1;
+    *sets = ecx + 1;
+    *inclusive = edx & 0x2;
+    return true;
+  }
+
+  return false;
+}
+
+int read_sysfs_int(const char *path) {
+  FILE *file = fopen(path, "r");
+  int value = -1;
+
+  if (file == NULL) {
+    return -1;
+  }
+  if (fscanf(file, "%d", &value) != 1) {
+    value = -1;
+  }
+  fclose(file);
+
+  return value;
+}
+
+// Find the level 3 cache in sysfs
+bool sysfs_llc(int *line_bytes, int *ways, int *sets) {
+  char path[128];
+  const char *base = "/sys/devices/system/cpu/cpu0/cache/index";
+
+  for (int i = 0;; i++) {
+    snprintf(path, sizeof(path), "%s%d/level", base, i);
+    int level = read_sysfs_int(path);
+    if (level < 0) {
+      return false;
+    }
+    if (level != 3) {
+      continue;
+    }
+
+    snprintf(path, sizeof(path), "%s%d/coherency_line_size", base, i);
+    *line_bytes = read_sysfs_int(path);
+    snprintf(path, sizeof(path), "%s%d/ways_of_associativity", base, i);
+    *ways = read_sysfs_int(path);
+    snprintf(path, sizeof(path), "%s%d/number_of_sets", base, i);
+    *sets = read_sysfs_int(path);
+
+    return *line_bytes > 0 && *ways > 0 && *sets > 0;
+  }
+}
+
+// Physical cores per package, from the logical processor counts of the SMT
+// and core levels of CPUID leaf 0xB
+int cpuid_cores(void) {
+  unsigned int eax, ebx, ecx, edx;
+  int threads_per_core = 1;
+  int threads_per_package = 0;
+
+  for (unsigned int i = 0; __get_cpuid_count(0xB, i, &eax, &ebx, &ecx, &edx);
+       i++) {
+    int level_type = (ecx >> 8) & 0xFF;
+    if (level_type == 0) {
+      break;
+    }
+    if (level_type == 1) {
+      threads_per_core = MAX(ebx & 0xFFFF, 1);
+    } else if (level_type == 2) {
+      threads_per_package = ebx & 0xFFFF;
+    }
+  }
+
+  if (threads_per_package == 0) {
+    threads_per_package = sysconf(_SC_NPROCESSORS_ONLN);
+  }
+
+  return MAX(threads_per_package / threads_per_core, 1);
+}
+
+// Number of CBo or CHA uncore PMUs, one per LLC slice, or 0 if perf exposes
+// none of them
+int uncore_slices(void) {
+  DIR *dir = opendir("/sys/bus/event_source/devices");
+  struct dirent *entry;
+  int cbos = 0, chas = 0;
+
+  if (dir == NULL) {
+    return 0;
+  }
+  while ((entry = readdir(dir)) != NULL) {
+    if (strncmp(entry->d_name, "uncore_cbox_", 12) == 0) {
+      cbos++;
+    } else if (strncmp(entry->d_name, "uncore_cha_", 11) == 0) {
+      chas++;
+    }
+  }
+  closedir(dir);
+
+  return chas ? chas : cbos;
+}
+
+// Number of LLC slices: slices_override, then LLC_SLICES, then the uncore
+// PMUs, then the physical cores
+int detect_slices(void) {
+  const char *env = getenv("LLC_SLICES");
+
+  if (slices_override > 0) {
+    return slices_override;
+  }
+  if (env != NULL && atoi(env) > 0) {
+    return atoi(env);
+  }
+
+  int slices = uncore_slices();
+  if (slices > 0) {
+    return slices;
+  }
+
+  slices = cpuid_cores();
+  fprintf(stderr,
+          "warning: no CBo/CHA uncore PMUs, assuming one LLC slice per core "
+          "(%d); set LLC_SLICES if that is wrong\n",
+          slices);
+  return slices;
+}
+
+// Huge page size from /proc/meminfo, or -1
+int meminfo_hugepage_bits(void) {
+  FILE *file = fopen("/proc/meminfo", "r");
+  char line[128];
+  unsigned long kilobytes = 0;
+
+  if (file == NULL) {
+    return -1;
+  }
+  while (fgets(line, sizeof(line), file) != NULL) {
+    if (sscanf(line, "Hugepagesize: %lu kB", &kilobytes) == 1) {
+      break;
+    }
+  }
+  fclose(file);
+
+  return kilobytes ? floor_log2(kilobytes) + 10 : -1;
+}
+
+// Processor brand string, from CPUID leaves 0x80000002 to 0x80000004
+void cpuid_brand(char *brand) {
+  unsigned int *words = (unsigned int *)brand;
+
+  brand[0] = '\0';
+  for (unsigned int i = 0; i < 3; i++) {
+    if (!__get_cpuid(0x80000002 + i, &words[4 * i], &words[4 * i + 1],
+                     &words[4 * i + 2], &words[4 * i + 3])) {
+      brand[0] = '\0';
+      return;
+    }
+  }
+  brand[48] = '\0';
+}
+
+// Fill geometry with the parameters of this machine's LLC. Returns false if
+// no level 3 cache is reported, or if its sets do not split into a power of
+// two per slice, leaving geometry unchanged.
+bool detect_cache_geometry(CacheGeometry *geometry) {
+  int line_bytes, ways, sets;
+  bool inclusive = false;
+
+  if (!cpuid_llc(4, &line_bytes, &ways, &sets, &inclusive) &&
+      !cpuid_llc(0x8000001D, &line_bytes, &ways, &sets, &inclusive) &&
+      !sysfs_llc(&line_bytes, &ways, &sets)) {
+    return false;
+  }
+
+  int slices = detect_slices();
+  int hugepage_bits = meminfo_hugepage_bits();
+
+  // A wrong slice count would silently give every set index a wrong mask
+  if (sets % slices != 0 || (sets / slices & (sets / slices - 1)) != 0) {
+    fprintf(stderr,
+            "error: %d LLC sets do not split into a power of two per slice "
+            "over %d slices\n",
+            sets, slices);
+    return false;
+  }
+
+  cpuid_brand(detected_name);
+  geometry->name = detected_name[0] ? detected_name : "unknown";
+  geometry->line_bits = floor_log2(line_bytes);
+  geometry->set_bits = floor_log2(sets / slices);
+  geometry->ways = ways;
+  geometry->slices = slices;
+  geometry->hugepage_bits =
+      hugepage_bits > 0 ? hugepage_bits : HUGE_PAGE_OFFSET_BITS;
+  geometry->inclusive = inclusive;
+
+  return true;
+}
+
+// Hash identifying this processor (CPUID signature and brand string) and the
+// given geometry, so results measured under one can be told apart from another
+uint64_t geometry_fingerprint(CacheGeometry *geometry) {
+  unsigned int eax = 0, ebx, ecx, edx;
+  char brand[49];
+  uint64_t hash = 0xCBF29CE484222325ULL;
+
+  __get_cpuid(1, &eax, &ebx, &ecx, &edx);
+  cpuid_brand(brand);
+
+  int fields[] = {(int)eax,
+                  geometry->line_bits,
+                  geometry->set_bits,
+                  geometry->ways,
+                  geometry->slices,
+                  geometry->hugepage_bits,
+                  geometry->inclusive};
+  uint8_t *bytes = (uint8_t *)fields;
+
+  // FNV-1a over the fields, then the brand string
+  for (size_t i = 0; i < sizeof(fields); i++) {
+    hash = (hash ^ bytes[i]) * 0x100000001B3ULL;
+  }
+  for (char *c = brand; *c; c++) {
+    hash = (hash ^ (uint8_t)*c) * 0x100000001B3ULL;
+  }
+
+  return hash;
+}
+
+// Detect the LLC geometry and point cache_geometry at it, and select the
+// traversal kernel for its associativity. Keeps the previous cache_geometry if
+// detection fails.
+CacheGeometry *init_cache_geometry(void) {
+  if (detect_cache_geometry(&detected_geometry)) {
+    cache_geometry = &detected_geometry;
+  } else {
+    fprintf(stderr, "warning: could not detect the LLC, assuming %s\n",
+            cache_geometry->name);
+  }
+  use_traversal_ways(cache_geometry->ways);
+
+#ifndef __MEASURE__
+  print_cache_geometry(cache_geometry);
+#endif
+
+  return cache_geometry;
+}
+
+void print_cache_geometry(CacheGeometry *geometry) {
+  printf("%s: %d slices x %d sets x %d ways x %d B lines (%zu KB, %s), "
+         "%d KB huge pages\n",
+         geometry->name, geometry->slices, 1 << geometry->set_bits,
+         geometry->ways, 1 << geometry->line_bits,
+         geometry_llc_bytes(geometry) >> 10,
+         geometry->inclusive ? "inclusive" : "non-inclusive",
+         1 << (geometry->hugepage_bits - 10));
+}
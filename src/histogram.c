@@ -0,0 +1,171 @@
+#define _GNU_SOURCE
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <x86intrin.h>
+
+#include "../lib/histogram.h"
+#include "../lib/utils.h"
+
+/*********************************************************************
+ * Allocation
+ *********************************************************************/
+
+LatencyHistogram *new_latency_histogram(int shift) {
+  LatencyHistogram *h = aligned_alloc(32, sizeof(LatencyHistogram));
+  h->shift = shift;
+  clear_latency_histogram(h);
+
+  return h;
+}
+
+void clear_latency_histogram(LatencyHistogram *h) {
+  memset(h->buckets, 0, sizeof(h->buckets));
+  h->count = 0;
+  h->min = UINT64_MAX;
+  h->max = 0;
+  h->sum = 0;
+  h->squares = 0;
+}
+
+void free_latency_histogram(LatencyHistogram *h) { free(h); }
+
+// Smallest shift at which max still falls below the last bucket
+int histogram_shift_for(uint64_t max) {
+  int shift = 0;
+  while (max >> shift >= HISTOGRAM_BUCKETS - 1) {
+    shift++;
+  }
+
+  return shift;
+}
+
+/*********************************************************************
+ * Insertion
+ *********************************************************************/
+
+void histogram_insert(LatencyHistogram *h, uint64_t ticks) {
+  uint64_t bucket = ticks >> h->shift;
+  h->buckets[MIN(bucket, HISTOGRAM_BUCKETS - 1)]++;
+  h->count++;
+  h->min = MIN(h->min, ticks);
+  h->max = MAX(h->max, ticks);
+  h->sum += ticks;
+  h->squares += (double)ticks * ticks;
+}
+
+void histogram_insert_num_list(LatencyHistogram *h, NumList *nl) {
+  for (int i = 0; i < nl->length; i++) {
+    histogram_insert(h, nl->nums[i]);
+  }
+}
+
+__attribute__((target("avx2"))) void merge_buckets_avx2(uint64_t *into,
+                                                         uint64_t *from) {
+  for (int i = 0; i < HISTOGRAM_BUCKETS; i += 4) {
+    __m256i a = _mm256_load_si256((__m256i *)&into[i]);
+    __m256i b = _mm256_load_si256((__m256i *)&from[i]);
+    _mm256_store_si256((__m256i *)&into[i], _mm256_add_epi64(a, b));
+  }
+}
+
+void merge_buckets_sse2(uint64_t *into, uint64_t *from) {
+  for (int i = 0; i < HISTOGRAM_BUCKETS; i += 2) {
+    __m128i a = _mm_load_si128((__m128i *)&into[i]);
+    __m128i b = _mm_load_si128((__m128i *)&from[i]);
+    _mm_store_si128((__m128i *)&into[i], _mm_add_epi64(a, b));
+  }
+}
+
+// Add the timings of from to into. Returns false, leaving into unchanged, if
+// their buckets have different widths.
+bool merge_latency_histograms(LatencyHistogram *into, LatencyHistogram *from) {
+  if (into->shift != from->shift) {
+    return false;
+  }
+
+  if (__builtin_cpu_supports("avx2")) {
+    merge_buckets_avx2(into->buckets, from->buckets);
+  } else {
+    merge_buckets_sse2(into->buckets, from->buckets);
+  }
+  into->count += from->count;
+  into->min = MIN(into->min, from->min);
+  into->max = MAX(into->max, from->max);
+  into->sum += from->sum;
+  into->squares += from->squares;
+
+  return true;
+}
+
+/*********************************************************************
+ * Statistics
+ *********************************************************************/
+
+// The timing at 0-based rank in sorted order
+uint64_t histogram_rank(LatencyHistogram *h, uint64_t rank) {
+  if (h->count == 0) {
+    return 0;
+  }
+
+  uint64_t seen = 0;
+  for (int b = 0; b < HISTOGRAM_BUCKETS - 1; b++) {
+    seen += h->buckets[b];
+    if (seen > rank) {
+      return MAX((uint64_t)b << h->shift, h->min);
+    }
+  }
+
+  return h->max;
+}
+
+// Same rank as median_and_sort
+uint64_t histogram_median(LatencyHistogram *h) {
+  return histogram_rank(h, h->count / 2);
+}
+
+uint64_t histogram_percentile(LatencyHistogram *h, double percentile) {
+  uint64_t rank = h->count * percentile / 100;
+  return histogram_rank(h, MIN(rank, h->count - 1));
+}
+
+// Timings of at least threshold, rounded down to the start of its bucket.
+// Past the last bucket, either all or none of it is counted depending on max.
+uint64_t histogram_count_at_least(LatencyHistogram *h, uint64_t threshold) {
+  uint64_t first = threshold >> h->shift;
+  if (first >= HISTOGRAM_BUCKETS - 1) {
+    return h->max >= threshold ? h->buckets[HISTOGRAM_BUCKETS - 1] : 0;
+  }
+
+  uint64_t count = 0;
+  for (int b = first; b < HISTOGRAM_BUCKETS; b++) {
+    count += h->buckets[b];
+  }
+
+  return count;
+}
+
+double histogram_mean(LatencyHistogram *h) {
+  return h->count == 0 ? 0 : (double)h->sum / h->count;
+}
+
+// Sample standard deviation, as in print_stats
+double histogram_stddev(LatencyHistogram *h) {
+  if (h->count < 2) {
+    return 0;
+  }
+
+  double mean = histogram_mean(h);
+  double variance = (h->squares - h->count * mean * mean) / (h->count - 1);
+  return sqrt(MAX(variance, 0));
+}
+
+void print_histogram_stats(LatencyHistogram *h) {
+  printf("Median: %lu Mean: %.2f Standard deviation: %.2f Minimum: %lu "
+         "Maximum: %lu\n",
+         histogram_median(h), histogram_mean(h), histogram_stddev(h),
+         h->count == 0 ? 0 : h->min, h->max);
+}
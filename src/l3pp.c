@@ -1,12 +1,39 @@
 #include "../lib/l3pp.h"
 #include "../lib/constants.h"
 #include "../lib/eviction.h"
+#include "../lib/memory.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <x86intrin.h>
+
+uint64_t recalibration_interval = RECALIBRATION_INTERVAL;
+
+ThresholdEstimate last_recalibration = {0};
+
+LatencyHistogram *probe_latencies = NULL;
+
+TraceWriter *probe_trace = NULL;
+
+ProbeMode probe_mode = PROBE_PER_LINE;
+
+const char *probe_mode_name(ProbeMode mode) {
+  switch (mode) {
+  case PROBE_PER_LINE:
+    return "per line";
+  case PROBE_TRAVERSAL:
+    return "traversal";
+  default:
+    return "unknown";
+  }
+}
 
 uint8_t probe(EvictionSet *es, int threshold) {
   CacheLine *iter = es->head;
   for (int i = 0; i < es->size; i++) {
     uint64_t time = time_load((uint8_t *)iter);
+    if (probe_latencies != NULL) {
+      histogram_insert(probe_latencies, time);
+    }
     if (time > threshold) {
       return 1;
     }
@@ -15,61 +42,191 @@ uint8_t probe(EvictionSet *es, int threshold) {
   return 0;
 }
 
-void prime_probe(EvictionSet *es, uint8_t associativity, uint8_t *hit_times,
-                 uint64_t numBytes, uint64_t *detect_timestamps, uint64_t *size,
-                 int threshold) {
-  // TODO: numBytes * 8 to store data efficiently
-  unsigned int core_id = 0;
+// Time one traversal of es, forward or backward, which also primes it
+uint8_t probe_traversal(EvictionSet *es, int threshold, bool backward) {
+  uint64_t time = time_traversal(backward ? es->tail : es->head, backward);
+  if (probe_latencies != NULL) {
+    histogram_insert(probe_latencies, time);
+  }
+  return time > threshold;
+}
 
-  int times[associativity];
-  for (int i = 0; i < numBytes; i++)
-    hit_times[i] = 0;
+// Probe es with probe_mode. backward alternates the direction of traversals,
+// and should start false after access_set.
+bool probe_with_mode(EvictionSet *es, int threshold, bool *backward) {
+  if (probe_mode != PROBE_TRAVERSAL) {
+    return probe(es, threshold);
+  }
+
+  bool hit = probe_traversal(es, threshold, *backward);
+  *backward = !*backward;
+  return hit;
+}
 
-  for (int i = 0; i < associativity; i++) {
-    times[i] = 0;
+// Estimate the threshold of a probe of es in mode from samples probes of the
+// primed set and samples probes with one of its lines flushed. Traversals
+// alternate between forward and backward as in prime_probe, each after a
+// traversal the other way, as the previous probe would have left the set.
+ThresholdEstimate estimate_probe_threshold(EvictionSet *es, ProbeMode mode,
+                                           int samples) {
+  if (mode == PROBE_PER_LINE) {
+    return estimate_flush_threshold((uint8_t *)es->head, samples);
   }
 
+  NumList *hits = new_num_list(samples);
+  NumList *misses = new_num_list(samples);
+  CacheLine *line = es->head;
+
+  for (int i = 0; i < samples; i++) {
+    bool backward = i & 1;
+    CacheLine *start = backward ? es->tail : es->head;
+    CacheLine *previous = backward ? es->head : es->tail;
+
+    access_set(es);
+    time_traversal(previous, !backward);
+    push_num(hits, time_traversal(start, backward));
+
+    access_set(es);
+    time_traversal(previous, !backward);
+    flush_line((uint8_t *)line);
+    _mm_mfence();
+    push_num(misses, time_traversal(start, backward));
+    line = line->next != NULL ? line->next : es->head;
+  }
+
+  ThresholdEstimate estimate = estimate_threshold(hits, misses);
+
+  free_num_list(misses);
+  free_num_list(hits);
+
+  return estimate;
+}
+
+// Calculates the threshold of a probe of es in mode, retrying poorly
+// separated estimates up to THRESHOLD_RETRIES times
+int threshold_for_probe(EvictionSet *es, ProbeMode mode) {
+  ThresholdEstimate best = {0};
+  int attempt = 0;
+
+  do {
+    keep_best_estimate(&best, estimate_probe_threshold(es, mode, SAMPLES),
+                       attempt);
+    attempt++;
+  } while (best.margin < THRESHOLD_MIN_MARGIN && attempt < THRESHOLD_RETRIES);
+
+  report_threshold(best, attempt, probe_mode_name(mode));
+
+  return best.threshold;
+}
+
+// Estimate the threshold of probe_mode again and prime es again. The old
+// threshold is kept if hits and misses are poorly separated.
+void recalibrate_threshold(EvictionSet *es, int *threshold) {
+  last_recalibration =
+      estimate_probe_threshold(es, probe_mode, RECALIBRATION_SAMPLES);
+  if (last_recalibration.margin >= THRESHOLD_MIN_MARGIN) {
+    *threshold = last_recalibration.threshold;
+  }
   access_set(es);
+}
 
-  int prev = 0;
+void prime_probe(EvictionSet *es, ProbeRing *ring, uint64_t probes,
+                 uint64_t *detect_timestamps, uint64_t max_detections,
+                 uint64_t *size, int threshold) {
+  unsigned int core_id = 0;
   uint64_t hit_count = 0;
-  for (int i = 0; i < numBytes; i++) {
-    hit_times[i] = probe(es, threshold);
-    if (hit_times[i] == 1 && prev == 1) {
-      hit_times[i] = 0; // filtering out duplicate detections
-      prev = 1;
-    } else if (hit_times[i] == 1) {
-      detect_timestamps[hit_count] =
-          __rdtscp(&core_id); // get timestamp for the detection
+  uint64_t until_recalibration = recalibration_interval;
+  // A run of hits carried over from the last session is not a new detection
+  bool prev = ring->written > 0 && probe_ring_get(ring, ring->written - 1);
+  // Traversals alternate direction, starting forward after access_set
+  bool backward = false;
+
+  access_set(es);
+
+  for (uint64_t i = 0; probes == 0 ? !attack_finished : i < probes; i++) {
+    if (recalibration_interval != 0 && --until_recalibration == 0) {
+      recalibrate_threshold(es, &threshold);
+      until_recalibration = recalibration_interval;
+    }
+
+    bool hit = probe_with_mode(es, threshold, &backward);
+    probe_ring_push(ring, hit);
+    if (hit && !prev) {
+      // get timestamp for the detection
+      uint64_t timestamp = __rdtscp(&core_id);
+      if (hit_count < max_detections) {
+        detect_timestamps[hit_count] = timestamp;
+      }
+      if (probe_trace != NULL) {
+        trace_append(probe_trace, timestamp);
+      }
       hit_count++;
-      prev = 1;
-    } else {
-      prev = 0;
     }
+    prev = hit;
   }
-  *size = hit_count;
+  *size = MIN(hit_count, max_detections);
 }
 
-void filter_pp_results(uint8_t *results, uint64_t numBytes) {
-  int prev = 0;
-  for (int i = 0; i < numBytes; i++) {
-    if (prev == 1 && results[i] == 1) {
-      prev = 1;
-      results[i] = 0;
-    } else {
-      prev = results[i];
+void print_probe_result(ProbeRing *ring, uint64_t width, uint64_t height) {
+  uint64_t start = ring->written - MIN(ring->written, width * height);
+  for (int i = 0; i < height; i++) {
+    for (uint64_t j = 0; j < width; j += 64) {
+      int n = MIN(width - j, 64);
+      uint64_t bits = probe_ring_detections(ring, start + i * width + j, n);
+      for (int k = 0; k < n; k++) {
+        putchar('0' + (bits >> k & 1));
+      }
     }
+    printf("\n");
   }
 }
 
-void print_probe_result(uint8_t *results, uint64_t numBytes, uint64_t width,
-                        uint64_t height) {
-  for (int i = 0; i < height; i++) {
-    for (int j = 0; j < width; j++) {
-      printf("%d", results[numBytes - width * height + i * width + j]);
+// For every probe mode, probe es probes times, flushing a random line of es
+// before every PROFILE_EVENT_INTERVAL-th probe, and report the threshold,
+// probes per second and how often the probe disagrees with the flushes
+void profile_probe_modes(EvictionSet *es, uint64_t probes) {
+  unsigned int core_id = 0;
+  ProbeMode mode = probe_mode;
+  double tsc_hz = measure_tsc_hz();
+  int thresholds[NUM_PROBE_MODES];
+
+  for (int m = 0; m < NUM_PROBE_MODES; m++) {
+    probe_mode = m;
+    thresholds[m] = threshold_for_probe(es, m);
+  }
+
+  printf("%-10s %9s %12s %8s %8s\n", "mode", "threshold", "probes/s",
+         "missed", "false");
+  for (int m = 0; m < NUM_PROBE_MODES; m++) {
+    int threshold = thresholds[m];
+    uint64_t cycles = 0, events = 0, missed = 0, false_hits = 0;
+    bool backward = false;
+
+    access_set(es);
+    for (uint64_t i = 0; i < probes; i++) {
+      bool event = i % PROFILE_EVENT_INTERVAL == 0;
+      if (event) {
+        flush_line(
+            (uint8_t *)es->cache_lines->cache_lines[rand() % es->size]);
+        _mm_mfence();
+        events++;
+      }
+
+      uint64_t t0 = __rdtscp(&core_id);
+      bool hit = m == PROBE_TRAVERSAL ? probe_traversal(es, threshold, backward)
+                                      : probe(es, threshold);
+      cycles += __rdtscp(&core_id) - t0;
+      backward = !backward;
+
+      missed += event && !hit;
+      false_hits += !event && hit;
     }
-    printf("\n");
+
+    printf("%-10s %9d %12.0f %7.2f%% %7.2f%%\n", probe_mode_name(m),
+           threshold, probes / (cycles / tsc_hz), 100.0 * missed / events,
+           100.0 * false_hits / (probes - events));
   }
+  probe_mode = mode;
 }
 
 void flush_timestamps(uint64_t *timestamps, int size, char *filePath) {
@@ -79,42 +236,37 @@ void flush_timestamps(uint64_t *timestamps, int size, char *filePath) {
   fclose(file);
 }
 
-uint16_t get_slice_hit_count(uint8_t *results, uint64_t numBytes,
-                             uint64_t width, uint64_t height) {
-  uint16_t count = 0;
-  for (int i = 0; i < height; i++) {
-    for (int j = 0; j < width; j++) {
-      count += results[numBytes - width * height + i * width + j];
-    }
-  }
-  return count;
+uint16_t get_slice_hit_count(ProbeRing *ring, uint64_t width,
+                             uint64_t height) {
+  uint64_t length = MIN(ring->written, width * height);
+  return probe_ring_count(ring, ring->written - length, length, true);
 }
 
-CacheLineSet *hugepage_inflate(void *mmap_start, int size, int set) {
+// Lines in a hugepage mapping of at least size hugepages-worth of set stride
+// that share the full set index set
+CacheLineSet *hugepage_inflate(void *mmap_start, int size, int set,
+                               CacheGeometry *geometry) {
   CacheLineSet *cl_set = new_cl_set();
-  for (int i = 0; i < size; i++) {
-    CacheLine *line =
-        (CacheLine *)(mmap_start + (set << LINE_OFFSET_BITS) +
-                      ((1 << EVERGLADES_CACHE_SET_BITS) << LINE_OFFSET_BITS) *
-                          i);
-    push_cache_line(cl_set, line);
-  }
+  hugepage_set_lines(cl_set, mmap_start, size * geometry_set_stride(geometry),
+                     geometry, set, size);
   return cl_set;
 }
 
-EvictionSet **get_all_slices_eviction_sets(void *mmap_start, int set) {
+// One eviction set per slice for set, from a hugepage mapping of
+// geometry->ways set strides. The first *found entries are filled in and the
+// others are NULL.
+EvictionSet **get_all_slices_eviction_sets(void *mmap_start, int set,
+                                           CacheGeometry *geometry,
+                                           int *found) {
   CacheLineSet *cl_set =
-      hugepage_inflate(mmap_start, EVERGLADES_ASSOCIATIVITY, set);
+      hugepage_inflate(mmap_start, geometry->ways, set, geometry);
 
   int threshold = threshold_from_flush((uint8_t *)cl_set->cache_lines[0]);
 
   int i = 0;
-  EvictionSet **es_list = malloc(4 * sizeof(EvictionSet *));
-  for (int i = 0; i < 4; i++) {
-    es_list[i] = malloc(sizeof(EvictionSet));
-  }
+  EvictionSet **es_list = calloc(geometry->slices, sizeof(EvictionSet *));
   while (i < cl_set->size) {
-    if (i >= EVERGLADES_NUM_SLICES) {
+    if (i >= geometry->slices) {
       printf("finding sets for all slices failed, please retry\n");
       break;
     }
@@ -129,7 +281,7 @@ EvictionSet **get_all_slices_eviction_sets(void *mmap_start, int set) {
       exit(1);
     }
     EvictionSet *es = new_eviction_set(cl_evset);
-    NumList *nl = new_num_list(EVERGLADES_ASSOCIATIVITY);
+    NumList *nl = new_num_list(geometry->ways);
     int size = 0;
     for (int j = i + 1; j < cl_set->size; j++) {
       int count = 0;
@@ -167,12 +319,24 @@ EvictionSet **get_all_slices_eviction_sets(void *mmap_start, int set) {
   }
 
   print_cl_set(cl_set);
+  free_cl_set(cl_set);
+  if (i < geometry->slices) {
+    printf("found eviction sets for %d of %d slices\n", i, geometry->slices);
+  }
+  *found = i;
   return es_list;
 }
 
-void free_es_list(EvictionSet **es_list) {
-  for (int i = 0; i < 4; i++) {
-    deep_free_es(es_list[i]);
+// Free the eviction sets of get_all_slices_eviction_sets, skipping the slices
+// it did not find
+void free_es_list(EvictionSet **es_list, CacheGeometry *geometry) {
+  if (es_list == NULL) {
+    return;
+  }
+  for (int i = 0; i < geometry->slices; i++) {
+    if (es_list[i] != NULL) {
+      deep_free_es(es_list[i]);
+    }
   }
   free(es_list);
 }
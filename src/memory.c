@@ -0,0 +1,115 @@
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <x86intrin.h>
+
+#include "../lib/eviction.h"
+#include "../lib/memory.h"
+#include "../lib/pagemap.h"
+#include "../lib/timing.h"
+#include "../lib/traversal.h"
+
+/*********************************************************************
+ * Hardware
+ *********************************************************************/
+
+void hardware_load(MemoryBackend *memory, volatile uint8_t *va) { (void)*va; }
+
+uint64_t hardware_time_load(MemoryBackend *memory, volatile uint8_t *va) {
+  return timer_load(load_timer, va);
+}
+
+uint64_t hardware_time_traverse(MemoryBackend *memory, void *start,
+                                bool backward) {
+  return timer_traverse(load_timer, start, backward);
+}
+
+void hardware_flush(MemoryBackend *memory, volatile uint8_t *va) {
+  _mm_clflush((void *)va);
+}
+
+// Translate a virtual address by reading the page map
+uintptr_t hardware_translate(MemoryBackend *memory, void *va) {
+  if (!open_pagemap_reader()) {
+    return -1;
+  }
+
+  uintptr_t pa = pagemap_translate_one(pagemap_reader, va);
+  if (pa == (uintptr_t)-1) {
+    fprintf(stderr, "error: no physical address for %p\n", va);
+  }
+
+  return pa;
+}
+
+// Translate with batched pagemap reads
+int hardware_translate_lines(MemoryBackend *memory, void **vas, uintptr_t *pas,
+                             int count) {
+  if (!open_pagemap_reader()) {
+    for (int i = 0; i < count; i++) {
+      pas[i] = -1;
+    }
+    return 0;
+  }
+
+  return pagemap_translate(pagemap_reader, vas, pas, count);
+}
+
+void hardware_access_set(MemoryBackend *memory, EvictionSet *es) {
+  traversal_kernel(es, &traversal_config);
+}
+
+uint64_t hardware_cycles(MemoryBackend *memory) {
+  unsigned int core_id = 0;
+  return __rdtscp(&core_id);
+}
+
+void *hardware_map_hugepages(MemoryBackend *memory, size_t bytes) {
+  void *start = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (start == MAP_FAILED) {
+    perror("mmap hugepages");
+    return NULL;
+  }
+  return start;
+}
+
+void hardware_unmap_hugepages(MemoryBackend *memory, void *start,
+                              size_t bytes) {
+  munmap(start, bytes);
+}
+
+MemoryBackend hardware_memory = {"hardware",
+                                 hardware_load,
+                                 hardware_time_load,
+                                 hardware_time_traverse,
+                                 hardware_flush,
+                                 hardware_translate,
+                                 hardware_translate_lines,
+                                 hardware_access_set,
+                                 hardware_cycles,
+                                 hardware_map_hugepages,
+                                 hardware_unmap_hugepages,
+                                 NULL};
+
+MemoryBackend *memory_backend = &hardware_memory;
+
+/*********************************************************************
+ * Access
+ *********************************************************************/
+
+void load_line(volatile uint8_t *va) {
+  memory_backend->load(memory_backend, va);
+}
+
+void flush_line(volatile uint8_t *va) {
+  memory_backend->flush(memory_backend, va);
+}
+
+// Time following the list from start, through the previous pointers if
+// backward
+uint64_t time_traversal(void *start, bool backward) {
+  return memory_backend->time_traverse(memory_backend, start, backward);
+}
@@ -0,0 +1,260 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../lib/address_translation.h"
+#include "../lib/constants.h"
+#include "../lib/pagemap.h"
+#include "../lib/utils.h"
+
+#define PAGEMAP_INITIAL_BITS 10
+
+/*********************************************************************
+ * Page Cache
+ *********************************************************************/
+
+size_t pagemap_slot(PagemapReader *reader, uint64_t page) {
+  return (page * 0x9E3779B97F4A7C15ULL) >> (64 - reader->capacity_bits);
+}
+
+// Index of page's slot, or of the empty slot where it would go
+size_t pagemap_find(PagemapReader *reader, uint64_t page) {
+  size_t mask = ((size_t)1 << reader->capacity_bits) - 1;
+  size_t i = pagemap_slot(reader, page);
+
+  while (reader->pages[i] != 0 && reader->pages[i] != page + 1) {
+    i = (i + 1) & mask;
+  }
+
+  return i;
+}
+
+void pagemap_insert(PagemapReader *reader, uint64_t page, uint64_t entry);
+
+// Double the table once it is half full
+void pagemap_grow(PagemapReader *reader) {
+  size_t capacity = (size_t)1 << reader->capacity_bits;
+  uint64_t *pages = reader->pages;
+  uint64_t *entries = reader->entries;
+
+  reader->capacity_bits++;
+  reader->pages = calloc(capacity * 2, sizeof(uint64_t));
+  reader->entries = malloc(capacity * 2 * sizeof(uint64_t));
+  reader->count = 0;
+
+  for (size_t i = 0; i < capacity; i++) {
+    if (pages[i] != 0) {
+      pagemap_insert(reader, pages[i] - 1, entries[i]);
+    }
+  }
+
+  free(pages);
+  free(entries);
+}
+
+void pagemap_insert(PagemapReader *reader, uint64_t page, uint64_t entry) {
+  if (2 * (reader->count + 1) > (size_t)1 << reader->capacity_bits) {
+    pagemap_grow(reader);
+  }
+
+  size_t i = pagemap_find(reader, page);
+  if (reader->pages[i] == 0) {
+    reader->pages[i] = page + 1;
+    reader->count++;
+  }
+  reader->entries[i] = entry;
+}
+
+// Remove page, shifting later entries of its probe sequence back so that no
+// tombstones are needed
+void pagemap_remove(PagemapReader *reader, uint64_t page) {
+  size_t mask = ((size_t)1 << reader->capacity_bits) - 1;
+  size_t hole = pagemap_find(reader, page);
+
+  if (reader->pages[hole] == 0) {
+    return;
+  }
+
+  for (size_t i = (hole + 1) & mask; reader->pages[i] != 0;
+       i = (i + 1) & mask) {
+    size_t home = pagemap_slot(reader, reader->pages[i] - 1);
+    // Entries whose home lies cyclically in (hole, i] must stay put
+    if (((i - home) & mask) >= ((i - hole) & mask)) {
+      reader->pages[hole] = reader->pages[i];
+      reader->entries[hole] = reader->entries[i];
+      hole = i;
+    }
+  }
+
+  reader->pages[hole] = 0;
+  reader->count--;
+}
+
+/*********************************************************************
+ * Reader
+ *********************************************************************/
+
+// Open the pagemap of process pid, or of this process if pid is 0
+PagemapReader *new_pagemap_reader(pid_t pid) {
+  char path[64];
+
+  if (pid == 0) {
+    snprintf(path, sizeof(path), "/proc/self/pagemap");
+  } else {
+    snprintf(path, sizeof(path), "/proc/%ju/pagemap", (uintmax_t)pid);
+  }
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    perror("open pagemap");
+    return NULL;
+  }
+
+  PagemapReader *reader = calloc(1, sizeof(PagemapReader));
+  reader->fd = fd;
+  reader->capacity_bits = PAGEMAP_INITIAL_BITS;
+  reader->pages = calloc((size_t)1 << PAGEMAP_INITIAL_BITS, sizeof(uint64_t));
+  reader->entries = malloc(sizeof(uint64_t) << PAGEMAP_INITIAL_BITS);
+  reader->buffer = malloc(PAGEMAP_RUN * sizeof(uint64_t));
+
+  return reader;
+}
+
+void free_pagemap_reader(PagemapReader *reader) {
+  close(reader->fd);
+  free(reader->pages);
+  free(reader->entries);
+  free(reader->buffer);
+  free(reader);
+}
+
+// Read the entries of length consecutive pages starting at first into
+// reader->buffer. Returns the number of entries read.
+size_t pagemap_read_run(PagemapReader *reader, uint64_t first, size_t length) {
+  size_t bytes = length * sizeof(uint64_t);
+  size_t nread = 0;
+
+  while (nread < bytes) {
+    ssize_t ret = pread(reader->fd, (uint8_t *)reader->buffer + nread,
+                        bytes - nread, first * sizeof(uint64_t) + nread);
+    reader->reads++;
+    if (ret <= 0) {
+      break;
+    }
+    nread += ret;
+  }
+
+  return nread / sizeof(uint64_t);
+}
+
+int compare_pages(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+// Translate count virtual addresses into pas. Pages not yet cached are sorted
+// and read in runs of at most PAGEMAP_RUN entries, one pread per run, reading
+// through gaps of up to PAGEMAP_GAP pages. Addresses on pages that are not
+// present get (uintptr_t)-1. Returns the number translated.
+int pagemap_translate(PagemapReader *reader, void **vas, uintptr_t *pas,
+                      int count) {
+  uint64_t *missing = malloc(count * sizeof(uint64_t));
+  int num_missing = 0;
+
+  for (int i = 0; i < count; i++) {
+    uint64_t page = (uintptr_t)vas[i] >> PAGE_OFFSET_BITS;
+    if (reader->pages[pagemap_find(reader, page)] == 0) {
+      missing[num_missing++] = page;
+    }
+  }
+  reader->hits += count - num_missing;
+
+  qsort(missing, num_missing, sizeof(uint64_t), compare_pages);
+
+  for (int i = 0; i < num_missing;) {
+    int j = i + 1;
+    while (j < num_missing && missing[j] - missing[j - 1] <= PAGEMAP_GAP &&
+           missing[j] - missing[i] < PAGEMAP_RUN) {
+      j++;
+    }
+
+    size_t read = pagemap_read_run(reader, missing[i],
+                                   missing[j - 1] - missing[i] + 1);
+    for (int k = i; k < j; k++) {
+      uint64_t index = missing[k] - missing[i];
+      if (k > i && missing[k] == missing[k - 1]) {
+        continue;
+      }
+      reader->misses++;
+      // Only present pages are cached; others may be faulted in later
+      if (index < read && (reader->buffer[index] >> 63)) {
+        pagemap_insert(reader, missing[k], reader->buffer[index]);
+      }
+    }
+    i = j;
+  }
+
+  free(missing);
+
+  int translated = 0;
+  for (int i = 0; i < count; i++) {
+    uintptr_t va = (uintptr_t)vas[i];
+    size_t slot = pagemap_find(reader, va >> PAGE_OFFSET_BITS);
+
+    if (reader->pages[slot] == 0) {
+      pas[i] = -1;
+      continue;
+    }
+
+    PagemapEntry entry;
+    pagemap_parse_entry(&entry, reader->entries[slot]);
+    pas[i] = ((uintptr_t)entry.pfn << PAGE_OFFSET_BITS) |
+             (va & (PAGE_BYTES - 1));
+    translated++;
+  }
+
+  return translated;
+}
+
+uintptr_t pagemap_translate_one(PagemapReader *reader, void *va) {
+  uintptr_t pa;
+  pagemap_translate(reader, &va, &pa, 1);
+  return pa;
+}
+
+// Forget the cached entries of the pages overlapping [va, va + bytes), so they
+// are read again on their next translation
+void pagemap_invalidate(PagemapReader *reader, void *va, size_t bytes) {
+  uint64_t first = (uintptr_t)va >> PAGE_OFFSET_BITS;
+  uint64_t last = ((uintptr_t)va + MAX(bytes, 1) - 1) >> PAGE_OFFSET_BITS;
+
+  if (last - first < reader->count) {
+    for (uint64_t page = first; page <= last; page++) {
+      pagemap_remove(reader, page);
+    }
+    return;
+  }
+
+  // Fewer cached pages than pages in the range: scan the table instead
+  size_t capacity = (size_t)1 << reader->capacity_bits;
+  for (size_t i = 0; i < capacity;) {
+    uint64_t page = reader->pages[i] - 1;
+    if (reader->pages[i] != 0 && page >= first && page <= last) {
+      // Removal may shift another entry into slot i
+      pagemap_remove(reader, page);
+    } else {
+      i++;
+    }
+  }
+}
+
+void pagemap_invalidate_all(PagemapReader *reader) {
+  memset(reader->pages, 0, sizeof(uint64_t) << reader->capacity_bits);
+  reader->count = 0;
+}
@@ -0,0 +1,217 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../lib/constants.h"
+#include "../lib/pagemap.h"
+#include "../lib/pipeline.h"
+
+/*********************************************************************
+ * Helper CPU
+ *********************************************************************/
+
+// Topology value of cpu from sysfs, or -1
+int read_cpu_topology(int cpu, const char *name) {
+  char path[96];
+  int value = -1;
+
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s",
+           cpu, name);
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    return -1;
+  }
+  if (fscanf(file, "%d", &value) != 1) {
+    value = -1;
+  }
+  fclose(file);
+
+  return value;
+}
+
+// Pin the calling thread to the CPU it is running on, so that it cannot
+// migrate onto the helper's core. Returns false if it could not be pinned.
+bool pin_measuring_thread(void) {
+  int self = sched_getcpu();
+  cpu_set_t mask;
+  CPU_ZERO(&mask);
+  CPU_SET(self, &mask);
+  if (self < 0 || sched_setaffinity(0, sizeof(mask), &mask) != 0) {
+    perror("pin measuring thread");
+    return false;
+  }
+  return true;
+}
+
+// An online CPU on a different physical core than the calling thread, or -1
+// if there is none
+int pick_helper_cpu(void) {
+  int self = sched_getcpu();
+  if (self < 0) {
+    return -1;
+  }
+
+  int core = read_cpu_topology(self, "core_id");
+  int package = read_cpu_topology(self, "physical_package_id");
+  int cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+  for (int cpu = 0; cpu < cpus; cpu++) {
+    if (read_cpu_topology(cpu, "core_id") != core ||
+        read_cpu_topology(cpu, "physical_package_id") != package) {
+      return cpu;
+    }
+  }
+
+  return -1;
+}
+
+/*********************************************************************
+ * Producer
+ *********************************************************************/
+
+CandidateBatch *prepare_batch(CandidatePipeline *pipeline) {
+  CandidateBatch *batch = malloc(sizeof(CandidateBatch));
+  batch->pages = malloc(pipeline->batch_size * sizeof(uint8_t *));
+  batch->pas = NULL;
+  batch->size = pipeline->batch_size;
+  batch->next = 0;
+
+  for (int i = 0; i < batch->size; i++) {
+    batch->pages[i] = aligned_alloc(PAGE_BYTES, PAGE_BYTES);
+    memset(batch->pages[i], 0xFF, PAGE_BYTES);
+  }
+
+  if (pipeline->reader != NULL) {
+    // Freed pages may come back from the allocator backed by new frames
+    pagemap_invalidate_all(pipeline->reader);
+    batch->pas = malloc(batch->size * sizeof(uintptr_t));
+    pagemap_translate(pipeline->reader, (void **)batch->pages, batch->pas,
+                      batch->size);
+  }
+
+  return batch;
+}
+
+void free_batch(CandidateBatch *batch) {
+  for (int i = batch->next; i < batch->size; i++) {
+    free(batch->pages[i]);
+  }
+  free(batch->pages);
+  free(batch->pas);
+  free(batch);
+}
+
+// Keep the ring full until the pipeline is stopped
+void *pipeline_producer(void *arg) {
+  CandidatePipeline *pipeline = arg;
+
+  while (!__atomic_load_n(&pipeline->stop, __ATOMIC_ACQUIRE)) {
+    uint64_t tail = pipeline->tail;
+    if (tail - __atomic_load_n(&pipeline->head, __ATOMIC_ACQUIRE) ==
+        PIPELINE_DEPTH) {
+      sched_yield();
+      continue;
+    }
+
+    pipeline->ring[tail % PIPELINE_DEPTH] = prepare_batch(pipeline);
+    __atomic_store_n(&pipeline->tail, tail + 1, __ATOMIC_RELEASE);
+  }
+
+  return NULL;
+}
+
+/*********************************************************************
+ * Pipeline
+ *********************************************************************/
+
+// Start a helper thread preparing batches of batch_size pages on cpu (see
+// pick_helper_cpu; -1 leaves it unpinned). With translate, the physical
+// address of every page is read as well.
+CandidatePipeline *new_candidate_pipeline(int batch_size, int cpu,
+                                          bool translate) {
+  CandidatePipeline *pipeline = calloc(1, sizeof(CandidatePipeline));
+  pipeline->cpu = cpu;
+  pipeline->batch_size = batch_size;
+  pipeline->translate = translate;
+  pipeline->reader = translate ? new_pagemap_reader(0) : NULL;
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  if (cpu >= 0) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+  }
+
+  int error = pthread_create(&pipeline->thread, &attr, pipeline_producer,
+                             pipeline);
+  pthread_attr_destroy(&attr);
+  if (error) {
+    fprintf(stderr, "error: could not start candidate pipeline: %s\n",
+            strerror(error));
+    if (pipeline->reader != NULL) {
+      free_pagemap_reader(pipeline->reader);
+    }
+    free(pipeline);
+    return NULL;
+  }
+
+  return pipeline;
+}
+
+// Stop the helper thread and free every page that was not taken
+void free_candidate_pipeline(CandidatePipeline *pipeline) {
+  __atomic_store_n(&pipeline->stop, true, __ATOMIC_RELEASE);
+  pthread_join(pipeline->thread, NULL);
+
+  for (uint64_t i = pipeline->head; i < pipeline->tail; i++) {
+    free_batch(pipeline->ring[i % PIPELINE_DEPTH]);
+  }
+  if (pipeline->current != NULL) {
+    free_batch(pipeline->current);
+  }
+  if (pipeline->reader != NULL) {
+    free_pagemap_reader(pipeline->reader);
+  }
+  free(pipeline);
+}
+
+// Take the next prepared page, waiting for the helper if no batch is ready.
+// If pa is not NULL, it receives the page's physical address, or
+// (uintptr_t)-1 if the pipeline does not translate. Pages are freed with
+// free().
+uint8_t *pipeline_take_page(CandidatePipeline *pipeline, uintptr_t *pa) {
+  CandidateBatch *batch = pipeline->current;
+
+  if (batch == NULL || batch->next == batch->size) {
+    if (batch != NULL) {
+      free_batch(batch);
+    }
+
+    uint64_t head = pipeline->head;
+    if (__atomic_load_n(&pipeline->tail, __ATOMIC_ACQUIRE) == head) {
+      pipeline->stalls++;
+      while (__atomic_load_n(&pipeline->tail, __ATOMIC_ACQUIRE) == head) {
+        sched_yield();
+      }
+    }
+
+    batch = pipeline->ring[head % PIPELINE_DEPTH];
+    __atomic_store_n(&pipeline->head, head + 1, __ATOMIC_RELEASE);
+    pipeline->current = batch;
+    pipeline->batches++;
+  }
+
+  if (pa != NULL) {
+    *pa = batch->pas != NULL ? batch->pas[batch->next] : (uintptr_t)-1;
+  }
+
+  return batch->pages[batch->next++];
+}
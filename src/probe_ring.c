@@ -0,0 +1,95 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "../lib/probe_ring.h"
+#include "../lib/utils.h"
+
+// Round capacity up to a power of two of at least 64 probes
+ProbeRing *new_probe_ring(uint64_t capacity) {
+  ProbeRing *ring = malloc(sizeof(ProbeRing));
+  ring->capacity = 64;
+  while (ring->capacity < capacity) {
+    ring->capacity *= 2;
+  }
+  ring->words = calloc(ring->capacity / 64, sizeof(uint64_t));
+  ring->written = 0;
+
+  return ring;
+}
+
+void clear_probe_ring(ProbeRing *ring) { ring->written = 0; }
+
+void free_probe_ring(ProbeRing *ring) {
+  free(ring->words);
+  free(ring);
+}
+
+void probe_ring_push(ProbeRing *ring, bool hit) {
+  uint64_t bit = ring->written & (ring->capacity - 1);
+  uint64_t *word = &ring->words[bit >> 6];
+  uint64_t mask = (uint64_t)1 << (bit & 63);
+
+  *word = (*word & ~mask) | (-(uint64_t)hit & mask);
+  ring->written++;
+}
+
+// Index of the oldest probe still in the ring
+uint64_t probe_ring_oldest(ProbeRing *ring) {
+  return ring->written > ring->capacity ? ring->written - ring->capacity : 0;
+}
+
+// Outcome of probe index, or false if it is not in the ring
+bool probe_ring_get(ProbeRing *ring, uint64_t index) {
+  if (index < probe_ring_oldest(ring) || index >= ring->written) {
+    return false;
+  }
+
+  uint64_t bit = index & (ring->capacity - 1);
+  return ring->words[bit >> 6] >> (bit & 63) & 1;
+}
+
+// Outcomes of count <= 64 probes from index, the first in bit 0. Probes that
+// are not in the ring read as misses.
+uint64_t probe_ring_bits(ProbeRing *ring, uint64_t index, int count) {
+  uint64_t first = index & (ring->capacity - 1);
+  int offset = first & 63;
+  uint64_t bits = ring->words[first >> 6] >> offset;
+  if (offset != 0) {
+    uint64_t next = ((first >> 6) + 1) & (ring->capacity / 64 - 1);
+    bits |= ring->words[next] << (64 - offset);
+  }
+
+  uint64_t oldest = probe_ring_oldest(ring);
+  if (index < oldest) {
+    bits = oldest - index >= 64 ? 0 : bits & ~(uint64_t)0 << (oldest - index);
+  }
+  if (index + count > ring->written) {
+    count = ring->written > index ? ring->written - index : 0;
+  }
+
+  return count >= 64 ? bits : bits & (((uint64_t)1 << count) - 1);
+}
+
+// Same as probe_ring_bits, keeping only the first hit of every run of hits
+uint64_t probe_ring_detections(ProbeRing *ring, uint64_t index, int count) {
+  uint64_t bits = probe_ring_bits(ring, index, count);
+  uint64_t previous = index > 0 && probe_ring_get(ring, index - 1);
+
+  return bits & ~(bits << 1 | previous);
+}
+
+// Number of hits, or of detections if filtered, in length probes from index
+uint64_t probe_ring_count(ProbeRing *ring, uint64_t index, uint64_t length,
+                          bool filtered) {
+  uint64_t count = 0;
+
+  for (uint64_t i = index; i < index + length; i += 64) {
+    int n = MIN(index + length - i, 64);
+    uint64_t bits = filtered ? probe_ring_detections(ring, i, n)
+                             : probe_ring_bits(ring, i, n);
+    count += __builtin_popcountll(bits);
+  }
+
+  return count;
+}
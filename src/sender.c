@@ -0,0 +1,78 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <x86intrin.h>
+
+#include "../lib/pipeline.h"
+#include "../lib/sender.h"
+
+// Load the target and log the time, then wait gap cycles
+void sender_access(Sender *sender, uint64_t gap) {
+  unsigned int core_id = 0;
+
+  (void)*(volatile uint8_t *)sender->target;
+  uint64_t start_time = __rdtscp(&core_id);
+  if (sender->timestamps != NULL && sender->length < sender->capacity) {
+    sender->timestamps[sender->length++] = start_time;
+  }
+  while (__rdtscp(&core_id) - start_time < gap)
+    ;
+}
+
+// Access the target on the sender's schedule until stop is set
+void run_sender(Sender *sender) {
+  while (!__atomic_load_n(&sender->stop, __ATOMIC_ACQUIRE)) {
+    sender_access(sender, SENDER_SHORT_GAP);
+    sender_access(sender, SENDER_LONG_GAP);
+  }
+}
+
+void *sender_thread(void *arg) {
+  run_sender(arg);
+  return NULL;
+}
+
+// Start a sender of target on another core, logging up to capacity accesses.
+// Returns NULL if the thread cannot be started.
+Sender *start_sender(uint8_t *target, uint64_t capacity) {
+  Sender *sender = calloc(1, sizeof(Sender));
+  sender->target = target;
+  sender->timestamps = malloc(capacity * sizeof(uint64_t));
+  sender->capacity = capacity;
+  sender->cpu = pick_helper_cpu();
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  if (sender->cpu >= 0) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(sender->cpu, &cpus);
+    pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+  }
+  int error = pthread_create(&sender->thread, &attr, sender_thread, sender);
+  pthread_attr_destroy(&attr);
+  if (error) {
+    fprintf(stderr, "error: could not start sender: %s\n", strerror(error));
+    free(sender->timestamps);
+    free(sender);
+    return NULL;
+  }
+
+  return sender;
+}
+
+// Stop the sender, after which its timestamps stay valid until it is freed
+void stop_sender(Sender *sender) {
+  __atomic_store_n(&sender->stop, true, __ATOMIC_RELEASE);
+  pthread_join(sender->thread, NULL);
+}
+
+void free_sender(Sender *sender) {
+  free(sender->timestamps);
+  free(sender);
+}
@@ -0,0 +1,761 @@
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "../lib/constants.h"
+#include "../lib/geometry.h"
+#include "../lib/memory.h"
+#include "../lib/simulator.h"
+#include "../lib/slice.h"
+#include "../lib/traversal.h"
+#include "../lib/utils.h"
+
+// Simulated physical addresses have 48 bits. 4 KiB pages take the lower half
+// and hugepages the upper half.
+#define SIMULATED_PA_BITS 48
+#define SIMULATED_HUGEPAGE_BIT (1ULL << (SIMULATED_PA_BITS - 1))
+
+// QLRU ages saturate at this value, which marks a line for eviction
+#define QLRU_MAX_AGE 3
+
+SimulatorConfig everglades_simulator = {.geometry = &everglades_geometry,
+                                        .hash = &slice_hashes[1],
+                                        .policy = REPLACE_LRU,
+                                        .private_set_bits = 9,
+                                        .private_ways = 8,
+                                        .private_latency = 5,
+                                        .llc_latency = 50,
+                                        .memory_latency = 300,
+                                        .seed = 0x5EED,
+                                        .noise = {0}};
+
+SimulatorNoise unit_noise = {.random_loads = 2.0,
+                             .stream_loads = 2.0,
+                             .burst_period = 1000000,
+                             .burst_lines = 256,
+                             .jitter = 10,
+                             .outlier_rate = 0.001,
+                             .outlier_latency = 2000,
+                             .remaps = 0.001,
+                             .seed = 0x4015E};
+
+// Geometry and slice hash to restore with use_hardware_memory
+CacheGeometry *hardware_geometry = NULL;
+SliceHash *hardware_slice_hash = NULL;
+
+const char *replacement_policy_name(ReplacementPolicy policy) {
+  switch (policy) {
+  case REPLACE_LRU:
+    return "lru";
+  case REPLACE_TREE_PLRU:
+    return "tree_plru";
+  case REPLACE_QLRU:
+    return "qlru";
+  case REPLACE_RANDOM:
+    return "random";
+  default:
+    return "unknown";
+  }
+}
+
+// noise with every rate, the jitter and the burst length multiplied by scale
+SimulatorNoise scale_noise(SimulatorNoise noise, double scale) {
+  noise.random_loads *= scale;
+  noise.stream_loads *= scale;
+  noise.burst_lines *= scale;
+  noise.jitter *= scale;
+  noise.outlier_rate *= scale;
+  noise.remaps *= scale;
+  return noise;
+}
+
+/*********************************************************************
+ * Address Translation
+ *********************************************************************/
+
+// A seeded permutation of the integers below 1 << bits: multiplying by an odd
+// number and xoring in the high half are both invertible modulo 1 << bits
+uint64_t permute_bits(uint64_t x, int bits, uint64_t seed) {
+  uint64_t mask = (1ULL << bits) - 1;
+
+  x = ((x ^ seed) * 0x9E3779B97F4A7C15ULL) & mask;
+  x ^= x >> (bits / 2);
+  x = (x * 0xBF58476D1CE4E5B9ULL) & mask;
+  x ^= x >> (bits / 2);
+
+  return x;
+}
+
+// Slot of the page table holding page, or the empty slot it would go in
+size_t page_table_slot(SimulatedCache *cache, uint64_t page) {
+  size_t mask = cache->page_capacity - 1;
+  size_t slot = (page * 0x9E3779B97F4A7C15ULL >> 32) & mask;
+
+  while (cache->page_numbers[slot] != 0 &&
+         cache->page_numbers[slot] != page + 1) {
+    slot = (slot + 1) & mask;
+  }
+
+  return slot;
+}
+
+void grow_page_table(SimulatedCache *cache) {
+  uint64_t *numbers = cache->page_numbers;
+  uint64_t *frames = cache->page_frames;
+  size_t capacity = cache->page_capacity;
+
+  cache->page_capacity *= 2;
+  cache->page_numbers = calloc(cache->page_capacity, sizeof(uint64_t));
+  cache->page_frames = malloc(cache->page_capacity * sizeof(uint64_t));
+  for (size_t i = 0; i < capacity; i++) {
+    if (numbers[i] != 0) {
+      size_t slot = page_table_slot(cache, numbers[i] - 1);
+      cache->page_numbers[slot] = numbers[i];
+      cache->page_frames[slot] = frames[i];
+    }
+  }
+
+  free(numbers);
+  free(frames);
+}
+
+// Frame of a 4 KiB page, given out on its first translation
+uint64_t page_frame(SimulatedCache *cache, uint64_t page) {
+  size_t slot = page_table_slot(cache, page);
+
+  if (cache->page_numbers[slot] == 0) {
+    int frame_bits = SIMULATED_PA_BITS - 1 - PAGE_OFFSET_BITS;
+    cache->page_numbers[slot] = page + 1;
+    cache->page_frames[slot] =
+        permute_bits(cache->frames++, frame_bits, cache->config.seed);
+    if (2 * ++cache->pages > cache->page_capacity) {
+      uint64_t frame = cache->page_frames[slot];
+      grow_page_table(cache);
+      return frame;
+    }
+  }
+
+  return cache->page_frames[slot];
+}
+
+// Physical address of va: within a registered hugepage region, its 2 MiB page
+// is mapped to a permuted hugepage frame; elsewhere, its 4 KiB page gets the
+// next permuted page frame the first time it is translated
+uintptr_t simulated_translate(SimulatedCache *cache, void *va) {
+  uintptr_t address = (uintptr_t)va;
+
+  for (int r = 0; r < cache->hugepage_regions; r++) {
+    uintptr_t offset = address - (uintptr_t)cache->hugepage_starts[r];
+    if (address >= (uintptr_t)cache->hugepage_starts[r] &&
+        offset < cache->hugepage_bytes[r]) {
+      int frame_bits = SIMULATED_PA_BITS - 1 - HUGE_PAGE_OFFSET_BITS;
+      uint64_t page = (uint64_t)r << 16 | offset >> HUGE_PAGE_OFFSET_BITS;
+      uint64_t frame = permute_bits(page, frame_bits, ~cache->config.seed);
+      return SIMULATED_HUGEPAGE_BIT | frame << HUGE_PAGE_OFFSET_BITS |
+             (offset & (HUGE_PAGE_BYTES - 1));
+    }
+  }
+
+  uint64_t frame = page_frame(cache, address >> PAGE_OFFSET_BITS);
+  return frame << PAGE_OFFSET_BITS | (address & (PAGE_BYTES - 1));
+}
+
+// Map [start, start + bytes) with hugepages from now on, the first one
+// starting at start. Returns false if there are already
+// SIMULATED_HUGEPAGE_REGIONS regions.
+bool simulate_hugepages(SimulatedCache *cache, void *start, size_t bytes) {
+  if (cache->hugepage_regions == SIMULATED_HUGEPAGE_REGIONS) {
+    fprintf(stderr, "error: too many simulated hugepage regions\n");
+    return false;
+  }
+
+  cache->hugepage_starts[cache->hugepage_regions] = start;
+  cache->hugepage_bytes[cache->hugepage_regions] = bytes;
+  cache->hugepage_regions++;
+
+  return true;
+}
+
+// Stop mapping the region registered at start with hugepages
+void forget_hugepages(SimulatedCache *cache, void *start) {
+  for (int r = 0; r < cache->hugepage_regions; r++) {
+    if (cache->hugepage_starts[r] == start) {
+      cache->hugepage_regions--;
+      int last = cache->hugepage_regions;
+      cache->hugepage_starts[r] = cache->hugepage_starts[last];
+      cache->hugepage_bytes[r] = cache->hugepage_bytes[last];
+      return;
+    }
+  }
+}
+
+// Slice of pa with the configured hash if it has the right number of slices,
+// and with a fixed mix of the line number otherwise
+int simulated_slice(SimulatedCache *cache, uintptr_t pa) {
+  CacheGeometry *geometry = cache->config.geometry;
+  SliceHash *hash = cache->config.hash;
+
+  if (hash != NULL && hash->slices == geometry->slices) {
+    return pa_to_slice(hash, pa);
+  }
+  if (geometry->slices == 1) {
+    return 0;
+  }
+
+  uint64_t line = pa >> geometry->line_bits;
+  return permute_bits(line, 64 - 1, 0) % geometry->slices;
+}
+
+/*********************************************************************
+ * Replacement
+ *********************************************************************/
+
+uint64_t next_random(SimulatedCache *cache) {
+  cache->random ^= cache->random << 13;
+  cache->random ^= cache->random >> 7;
+  cache->random ^= cache->random << 17;
+  return cache->random;
+}
+
+// Leaf of the tree reached by following every node's bit, skipping the
+// padding leaves past ways
+int plru_victim(uint64_t bits, int leaves, int ways) {
+  int node = 1, low = 0, span = leaves;
+
+  while (span > 1) {
+    span /= 2;
+    bool right = (bits >> node) & 1;
+    if (right && low + span >= ways) {
+      right = false;
+    }
+    node = 2 * node + right;
+    low += right ? span : 0;
+  }
+
+  return low;
+}
+
+// Point every node on the path to way away from it
+void plru_touch(uint64_t *bits, int leaves, int way) {
+  int node = 1, low = 0, span = leaves;
+
+  while (span > 1) {
+    span /= 2;
+    bool right = way >= low + span;
+    if (right) {
+      *bits &= ~(1ULL << node);
+    } else {
+      *bits |= 1ULL << node;
+    }
+    node = 2 * node + right;
+    low += right ? span : 0;
+  }
+}
+
+// Update the replacement state of way of set after a hit, or after a fill
+void replacement_touch(SimulatedCache *cache, int set, int way, bool fill) {
+  int ways = cache->config.geometry->ways;
+  uint64_t *age = &cache->ages[(size_t)set * ways + way];
+
+  switch (cache->config.policy) {
+  case REPLACE_LRU:
+    *age = ++cache->clock;
+    break;
+  case REPLACE_TREE_PLRU:
+    plru_touch(&cache->plru[set], cache->plru_leaves, way);
+    break;
+  case REPLACE_QLRU:
+    *age = fill ? 1 : 0;
+    break;
+  default:
+    break;
+  }
+}
+
+// Way of set to fill next: an empty one if there is one, and the policy's
+// choice otherwise
+int replacement_victim(SimulatedCache *cache, int set) {
+  int ways = cache->config.geometry->ways;
+  uint64_t *lines = &cache->lines[(size_t)set * ways];
+  uint64_t *ages = &cache->ages[(size_t)set * ways];
+
+  for (int way = 0; way < ways; way++) {
+    if (lines[way] == 0) {
+      return way;
+    }
+  }
+
+  switch (cache->config.policy) {
+  case REPLACE_LRU: {
+    int oldest = 0;
+    for (int way = 1; way < ways; way++) {
+      if (ages[way] < ages[oldest]) {
+        oldest = way;
+      }
+    }
+    return oldest;
+  }
+  case REPLACE_TREE_PLRU:
+    return plru_victim(cache->plru[set], cache->plru_leaves, ways);
+  case REPLACE_QLRU:
+    while (true) {
+      for (int way = 0; way < ways; way++) {
+        if (ages[way] == QLRU_MAX_AGE) {
+          return way;
+        }
+      }
+      for (int way = 0; way < ways; way++) {
+        ages[way]++;
+      }
+    }
+  default:
+    return next_random(cache) % ways;
+  }
+}
+
+/*********************************************************************
+ * Private Cache
+ *********************************************************************/
+
+// Way of the private cache holding line, or -1
+int private_find(SimulatedCache *cache, uint64_t line) {
+  int ways = cache->config.private_ways;
+  size_t base = (line & ((1ULL << cache->config.private_set_bits) - 1)) * ways;
+
+  for (int way = 0; way < ways; way++) {
+    if (cache->private_lines[base + way] == line + 1) {
+      return base + way;
+    }
+  }
+
+  return -1;
+}
+
+// Put line into the private cache, in place of the least recently used line
+// of its set. Lines leave the private cache silently, since the LLC still
+// holds them.
+void private_fill(SimulatedCache *cache, uint64_t line) {
+  int ways = cache->config.private_ways;
+  size_t base = (line & ((1ULL << cache->config.private_set_bits) - 1)) * ways;
+  size_t oldest = base;
+
+  for (int way = 1; way < ways; way++) {
+    if (cache->private_ages[base + way] < cache->private_ages[oldest]) {
+      oldest = base + way;
+    }
+  }
+
+  cache->private_lines[oldest] = line + 1;
+  cache->private_ages[oldest] = ++cache->clock;
+}
+
+void private_invalidate(SimulatedCache *cache, uint64_t line) {
+  if (cache->config.private_ways == 0) {
+    return;
+  }
+
+  int way = private_find(cache, line);
+  if (way >= 0) {
+    cache->private_lines[way] = 0;
+    cache->private_ages[way] = 0;
+  }
+}
+
+/*********************************************************************
+ * Access
+ *********************************************************************/
+
+// Index of the LLC set (over all slices) of pa
+int simulated_set(SimulatedCache *cache, uintptr_t pa) {
+  CacheGeometry *geometry = cache->config.geometry;
+
+  return simulated_slice(cache, pa) << geometry->set_bits |
+         geometry_set_index(geometry, pa);
+}
+
+// Load line into the LLC, evicting a line (and its copy in the private cache)
+// if its set is full. Returns whether the LLC had it.
+bool llc_access(SimulatedCache *cache, uint64_t line) {
+  CacheGeometry *geometry = cache->config.geometry;
+  int set = simulated_set(cache, line << geometry->line_bits);
+  uint64_t *lines = &cache->lines[(size_t)set * geometry->ways];
+
+  for (int way = 0; way < geometry->ways; way++) {
+    if (lines[way] == line + 1) {
+      replacement_touch(cache, set, way, false);
+      return true;
+    }
+  }
+
+  int way = replacement_victim(cache, set);
+  if (lines[way] != 0) {
+    private_invalidate(cache, lines[way] - 1);
+    cache->stats.evictions++;
+  }
+  lines[way] = line + 1;
+  replacement_touch(cache, set, way, true);
+
+  return false;
+}
+
+void simulate_noise(SimulatedCache *cache, uint64_t cycles);
+
+// Load pa, filling the caches on the way, and return the latency of the level
+// that had it. Then let the noise for that latency happen.
+uint64_t simulated_access(SimulatedCache *cache, uintptr_t pa) {
+  uint64_t line = pa >> cache->config.geometry->line_bits;
+  int way = cache->config.private_ways > 0 ? private_find(cache, line) : -1;
+  uint64_t latency;
+
+  cache->stats.loads++;
+
+  if (way >= 0) {
+    cache->private_ages[way] = ++cache->clock;
+    cache->stats.private_hits++;
+    latency = cache->config.private_latency;
+  } else {
+    if (llc_access(cache, line)) {
+      cache->stats.llc_hits++;
+      latency = cache->config.llc_latency;
+    } else {
+      cache->stats.misses++;
+      latency = cache->config.memory_latency;
+    }
+    if (cache->config.private_ways > 0) {
+      private_fill(cache, line);
+    }
+  }
+
+  cache->stats.cycles += latency;
+  if (cache->noisy) {
+    simulate_noise(cache, latency);
+  }
+
+  return latency;
+}
+
+// Remove pa from every level
+void simulated_flush(SimulatedCache *cache, uintptr_t pa) {
+  CacheGeometry *geometry = cache->config.geometry;
+  uint64_t line = pa >> geometry->line_bits;
+  uint64_t *lines =
+      &cache->lines[(size_t)simulated_set(cache, pa) * geometry->ways];
+
+  cache->stats.flushes++;
+  private_invalidate(cache, line);
+  for (int way = 0; way < geometry->ways; way++) {
+    if (lines[way] == line + 1) {
+      lines[way] = 0;
+    }
+  }
+}
+
+/*********************************************************************
+ * Noise
+ *********************************************************************/
+
+uint64_t next_noise(SimulatedCache *cache) {
+  cache->noise_random ^= cache->noise_random << 13;
+  cache->noise_random ^= cache->noise_random >> 7;
+  cache->noise_random ^= cache->noise_random << 17;
+  return cache->noise_random;
+}
+
+// Uniform in [0, 1)
+double noise_uniform(SimulatedCache *cache) {
+  return (next_noise(cache) >> 11) * 0x1.0p-53;
+}
+
+// A random line of the physical address space
+uint64_t noise_line(SimulatedCache *cache) {
+  int line_bits = SIMULATED_PA_BITS - cache->config.geometry->line_bits;
+  return next_noise(cache) & ((1ULL << line_bits) - 1);
+}
+
+// Move a random translated 4 KiB page to a new frame
+void remap_page(SimulatedCache *cache) {
+  if (cache->pages == 0) {
+    return;
+  }
+
+  size_t slot;
+  do {
+    slot = next_noise(cache) & (cache->page_capacity - 1);
+  } while (cache->page_numbers[slot] == 0);
+
+  int frame_bits = SIMULATED_PA_BITS - 1 - PAGE_OFFSET_BITS;
+  cache->page_frames[slot] =
+      permute_bits(cache->frames++, frame_bits, cache->config.seed);
+  cache->stats.remaps++;
+}
+
+// Make the loads of other cores and the remaps due over cycles more cycles
+void simulate_noise(SimulatedCache *cache, uint64_t cycles) {
+  SimulatorNoise *noise = &cache->config.noise;
+
+  cache->random_debt += noise->random_loads * cycles / 1000;
+  for (; cache->random_debt >= 1; cache->random_debt--) {
+    llc_access(cache, noise_line(cache));
+    cache->stats.noise_loads++;
+  }
+
+  cache->stream_debt += noise->stream_loads * cycles / 1000;
+  for (; cache->stream_debt >= 1; cache->stream_debt--) {
+    llc_access(cache, cache->stream_line++);
+    cache->stats.noise_loads++;
+  }
+
+  if (noise->burst_period > 0 && cache->stats.cycles >= cache->next_burst) {
+    uint64_t start = noise_line(cache);
+    for (int i = 0; i < noise->burst_lines; i++) {
+      llc_access(cache, start + i);
+    }
+    cache->stats.noise_loads += noise->burst_lines;
+    cache->next_burst += noise->burst_period;
+  }
+
+  cache->remap_debt += noise->remaps * cycles / 1e6;
+  for (; cache->remap_debt >= 1; cache->remap_debt--) {
+    remap_page(cache);
+  }
+}
+
+// The timing a timer would report for latency cycles
+uint64_t timer_noise(SimulatedCache *cache, uint64_t latency) {
+  SimulatorNoise *noise = &cache->config.noise;
+
+  if (noise->jitter > 0) {
+    latency += next_noise(cache) % (2 * noise->jitter + 1);
+    latency = latency > noise->jitter ? latency - noise->jitter : 0;
+  }
+  if (noise->outlier_rate > 0 && noise_uniform(cache) < noise->outlier_rate) {
+    latency += noise->outlier_latency;
+    cache->stats.outliers++;
+  }
+
+  return latency;
+}
+
+/*********************************************************************
+ * Backend
+ *********************************************************************/
+
+void simulated_load(MemoryBackend *memory, volatile uint8_t *va) {
+  SimulatedCache *cache = memory->state;
+  simulated_access(cache, simulated_translate(cache, (void *)va));
+}
+
+uint64_t simulated_time_load(MemoryBackend *memory, volatile uint8_t *va) {
+  SimulatedCache *cache = memory->state;
+  cache->stats.timed_loads++;
+  uint64_t latency =
+      simulated_access(cache, simulated_translate(cache, (void *)va));
+  return cache->noisy ? timer_noise(cache, latency) : latency;
+}
+
+// Total latency of the loads of a traversal from start
+uint64_t simulated_time_traverse(MemoryBackend *memory, void *start,
+                                 bool backward) {
+  SimulatedCache *cache = memory->state;
+  uint64_t latency = 0;
+
+  cache->stats.timed_traversals++;
+  for (CacheLine *cl = start; cl != NULL;
+       cl = backward ? cl->previous : cl->next) {
+    latency += simulated_access(cache, simulated_translate(cache, cl));
+  }
+
+  return cache->noisy ? timer_noise(cache, latency) : latency;
+}
+
+void simulated_flush_line(MemoryBackend *memory, volatile uint8_t *va) {
+  SimulatedCache *cache = memory->state;
+  simulated_flush(cache, simulated_translate(cache, (void *)va));
+}
+
+uintptr_t simulated_translate_one(MemoryBackend *memory, void *va) {
+  return simulated_translate(memory->state, va);
+}
+
+int simulated_translate_lines(MemoryBackend *memory, void **vas,
+                              uintptr_t *pas, int count) {
+  for (int i = 0; i < count; i++) {
+    pas[i] = simulated_translate(memory->state, vas[i]);
+  }
+  return count;
+}
+
+void simulated_access_set(MemoryBackend *memory, EvictionSet *es) {
+  traverse_backend(memory, es, &traversal_config);
+}
+
+// Simulated cycles of every load so far
+uint64_t simulated_cycles(MemoryBackend *memory) {
+  SimulatedCache *cache = memory->state;
+  return cache->stats.cycles;
+}
+
+// Plain pages registered with simulate_hugepages, so no real hugepages are
+// needed
+void *simulated_map_hugepages(MemoryBackend *memory, size_t bytes) {
+  void *start = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (start == MAP_FAILED) {
+    perror("mmap simulated hugepages");
+    return NULL;
+  }
+  if (!simulate_hugepages(memory->state, start, bytes)) {
+    munmap(start, bytes);
+    return NULL;
+  }
+  return start;
+}
+
+void simulated_unmap_hugepages(MemoryBackend *memory, void *start,
+                               size_t bytes) {
+  forget_hugepages(memory->state, start);
+  munmap(start, bytes);
+}
+
+// Allocate a simulated cache for config, starting empty. Returns NULL if the
+// geometry has more than 64 ways.
+SimulatedCache *new_simulated_cache(SimulatorConfig config) {
+  CacheGeometry *geometry = config.geometry;
+  if (geometry->ways > 64 || config.private_ways > 64) {
+    fprintf(stderr, "error: cannot simulate more than 64 ways\n");
+    return NULL;
+  }
+
+  SimulatedCache *cache = calloc(1, sizeof(SimulatedCache));
+  MemoryBackend backend = {"simulated",
+                           simulated_load,
+                           simulated_time_load,
+                           simulated_time_traverse,
+                           simulated_flush_line,
+                           simulated_translate_one,
+                           simulated_translate_lines,
+                           simulated_access_set,
+                           simulated_cycles,
+                           simulated_map_hugepages,
+                           simulated_unmap_hugepages,
+                           cache};
+  cache->backend = backend;
+  cache->config = config;
+  cache->sets = geometry->slices << geometry->set_bits;
+  cache->plru_leaves = 1;
+  while (cache->plru_leaves < geometry->ways) {
+    cache->plru_leaves *= 2;
+  }
+
+  size_t ways = (size_t)cache->sets * geometry->ways;
+  cache->lines = malloc(ways * sizeof(uint64_t));
+  cache->ages = malloc(ways * sizeof(uint64_t));
+  cache->plru = malloc(cache->sets * sizeof(uint64_t));
+
+  size_t private_ways = (size_t)config.private_ways
+                        << config.private_set_bits;
+  cache->private_lines = malloc(MAX(private_ways, 1) * sizeof(uint64_t));
+  cache->private_ages = malloc(MAX(private_ways, 1) * sizeof(uint64_t));
+
+  cache->page_capacity = SIMULATED_PAGE_TABLE_SIZE;
+  cache->page_numbers = calloc(cache->page_capacity, sizeof(uint64_t));
+  cache->page_frames = malloc(cache->page_capacity * sizeof(uint64_t));
+
+  reset_simulated_cache(cache);
+
+  return cache;
+}
+
+void free_simulated_cache(SimulatedCache *cache) {
+  free(cache->lines);
+  free(cache->ages);
+  free(cache->plru);
+  free(cache->private_lines);
+  free(cache->private_ages);
+  free(cache->page_numbers);
+  free(cache->page_frames);
+  free(cache);
+}
+
+// Empty every level, clear the statistics and restart the noise. Pages keep
+// their frames and hugepage regions stay registered.
+void reset_simulated_cache(SimulatedCache *cache) {
+  CacheGeometry *geometry = cache->config.geometry;
+  size_t ways = (size_t)cache->sets * geometry->ways;
+  size_t private_ways = (size_t)cache->config.private_ways
+                        << cache->config.private_set_bits;
+
+  memset(cache->lines, 0, ways * sizeof(uint64_t));
+  memset(cache->ages, 0, ways * sizeof(uint64_t));
+  memset(cache->plru, 0, cache->sets * sizeof(uint64_t));
+  memset(cache->private_lines, 0, private_ways * sizeof(uint64_t));
+  memset(cache->private_ages, 0, private_ways * sizeof(uint64_t));
+  memset(&cache->stats, 0, sizeof(SimulatorStats));
+  cache->clock = 0;
+  cache->random = cache->config.seed | 1;
+
+  SimulatorNoise *noise = &cache->config.noise;
+  cache->noisy = noise->random_loads > 0 || noise->stream_loads > 0 ||
+                 noise->burst_period > 0 || noise->jitter > 0 ||
+                 noise->outlier_rate > 0 || noise->remaps > 0;
+  cache->noise_random = noise->seed | 1;
+  cache->random_debt = 0;
+  cache->stream_debt = 0;
+  cache->remap_debt = 0;
+  cache->stream_line = noise_line(cache);
+  cache->next_burst = noise->burst_period;
+}
+
+/*********************************************************************
+ * Selection
+ *********************************************************************/
+
+// Make the library run on cache, and take cache_geometry and slice_hash from
+// its config until use_hardware_memory
+void use_simulated_cache(SimulatedCache *cache) {
+  if (memory_backend == &hardware_memory) {
+    hardware_geometry = cache_geometry;
+    hardware_slice_hash = slice_hash;
+  }
+
+  memory_backend = &cache->backend;
+  cache_geometry = cache->config.geometry;
+  if (cache->config.hash != NULL &&
+      cache->config.hash->slices == cache->config.geometry->slices) {
+    slice_hash = cache->config.hash;
+  } else {
+    slice_hash = NULL;
+  }
+  use_traversal_ways(cache_geometry->ways);
+}
+
+void use_hardware_memory(void) {
+  if (memory_backend == &hardware_memory) {
+    return;
+  }
+
+  memory_backend = &hardware_memory;
+  cache_geometry = hardware_geometry;
+  slice_hash = hardware_slice_hash;
+  use_traversal_ways(cache_geometry->ways);
+}
+
+void print_simulator_stats(SimulatedCache *cache) {
+  SimulatorStats *stats = &cache->stats;
+
+  printf("%lu loads (%lu timed, %lu traversals timed), %lu flushes\n",
+         stats->loads, stats->timed_loads, stats->timed_traversals,
+         stats->flushes);
+  printf("%lu private hits, %lu LLC hits, %lu misses, %lu evictions, "
+         "%lu cycles\n",
+         stats->private_hits, stats->llc_hits, stats->misses,
+         stats->evictions, stats->cycles);
+  if (cache->noisy) {
+    printf("%lu noise loads, %lu outliers, %lu remaps\n", stats->noise_loads,
+           stats->outliers, stats->remaps);
+  }
+}
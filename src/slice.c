@@ -0,0 +1,193 @@
+#define _GNU_SOURCE
+#include <cpuid.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../lib/geometry.h"
+#include "../lib/slice.h"
+
+/*********************************************************************
+ * Hash Functions
+ *********************************************************************/
+
+// Address bits of each slice bit
+#define SLICE_O0 0x1B5F575440ULL
+#define SLICE_O1 0x2EB5FAA880ULL
+#define SLICE_O2 0x3CCCC93100ULL
+
+#define SANDY_BRIDGE_MODELS {0x2A, 0}
+#define IVY_BRIDGE_MODELS {0x3A, 0}
+#define HASWELL_MODELS {0x3C, 0x45, 0x46, 0}
+#define SKYLAKE_MODELS {0x4E, 0x5E, 0}
+#define COFFEE_LAKE_MODELS {0x8E, 0x9E, 0}
+
+SliceHash slice_hashes[] = {
+    {"Sandy Bridge", SANDY_BRIDGE_MODELS, 2, 1, {SLICE_O0}},
+    {"Sandy Bridge", SANDY_BRIDGE_MODELS, 4, 2, {SLICE_O0, SLICE_O1}},
+    {"Ivy Bridge", IVY_BRIDGE_MODELS, 2, 1, {SLICE_O0}},
+    {"Ivy Bridge", IVY_BRIDGE_MODELS, 4, 2, {SLICE_O0, SLICE_O1}},
+    {"Haswell", HASWELL_MODELS, 2, 1, {SLICE_O0}},
+    {"Haswell", HASWELL_MODELS, 4, 2, {SLICE_O0, SLICE_O1}},
+    {"Skylake", SKYLAKE_MODELS, 2, 1, {SLICE_O0}},
+    {"Skylake", SKYLAKE_MODELS, 4, 2, {SLICE_O0, SLICE_O1}},
+    {"Coffee Lake", COFFEE_LAKE_MODELS, 2, 1, {SLICE_O0}},
+    {"Coffee Lake", COFFEE_LAKE_MODELS, 4, 2, {SLICE_O0, SLICE_O1}},
+    {"Coffee Lake", COFFEE_LAKE_MODELS, 8, 3, {SLICE_O0, SLICE_O1, SLICE_O2}},
+    {NULL}};
+
+SliceHash *slice_hash = &slice_hashes[1];
+
+int pa_to_slice(SliceHash *hash, uintptr_t pa) {
+  int slice = 0;
+  for (int i = 0; i < hash->bits; i++) {
+    slice |= __builtin_parityll(pa & hash->masks[i]) << i;
+  }
+  return slice;
+}
+
+// Classify count physical addresses in one branch-free pass; (uintptr_t)-1
+// gives -1. Parity comes from the parity flag, or popcnt where available,
+// which measured faster than folding the bits in vector registers.
+void pas_to_slices(SliceHash *hash, uintptr_t *pas, int *slices, int count) {
+  uint64_t masks[MAX_SLICE_BITS] = {0};
+  for (int bit = 0; bit < hash->bits; bit++) {
+    masks[bit] = hash->masks[bit];
+  }
+
+  // Unused masks are 0 and contribute nothing
+  for (int i = 0; i < count; i++) {
+    uintptr_t pa = pas[i];
+    int slice = __builtin_parityll(pa & masks[0]) |
+                __builtin_parityll(pa & masks[1]) << 1 |
+                __builtin_parityll(pa & masks[2]) << 2;
+    slices[i] = pa == (uintptr_t)-1 ? -1 : slice;
+  }
+}
+
+/*********************************************************************
+ * Detection
+ *********************************************************************/
+
+// CPUID display model of a family 6 processor, or -1 for other families
+int cpuid_model(void) {
+  unsigned int eax, ebx, ecx, edx;
+
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || ((eax >> 8) & 0xF) != 6) {
+    return -1;
+  }
+
+  return ((eax >> 4) & 0xF) | ((eax >> 12) & 0xF0);
+}
+
+// Hash for a processor model with the given number of slices, or NULL
+SliceHash *find_slice_hash(int model, int slices) {
+  for (SliceHash *hash = slice_hashes; hash->name != NULL; hash++) {
+    if (hash->slices != slices) {
+      continue;
+    }
+    for (int i = 0; hash->models[i] != 0; i++) {
+      if (hash->models[i] == model) {
+        return hash;
+      }
+    }
+  }
+
+  return NULL;
+}
+
+// Point slice_hash at the hash of this processor with geometry's slices, or
+// NULL if it is not known
+SliceHash *init_slice_hash(CacheGeometry *geometry) {
+  slice_hash = find_slice_hash(cpuid_model(), geometry->slices);
+
+#ifndef __MEASURE__
+  if (slice_hash != NULL) {
+    printf("Slice hash: %s, %d slices\n", slice_hash->name,
+           slice_hash->slices);
+  } else {
+    printf("Slice hash: unknown for %d slices\n", geometry->slices);
+  }
+#endif
+
+  return slice_hash;
+}
+
+/*********************************************************************
+ * Descriptors
+ *
+ * A hash can be saved to and loaded from a text file with a name line, a
+ * slices line and one mask line per slice bit:
+ *
+ *   name Sandy Bridge
+ *   slices 4
+ *   mask 0x1b5f575440
+ *   mask 0x2eb5faa880
+ *********************************************************************/
+
+// Write hash to path. Returns false if it could not be written.
+bool save_slice_hash(SliceHash *hash, const char *path) {
+  FILE *file = fopen(path, "w");
+  if (file == NULL) {
+    perror("fopen slice hash");
+    return false;
+  }
+
+  fprintf(file, "name %s\n", hash->name);
+  fprintf(file, "slices %d\n", hash->slices);
+  for (int i = 0; i < hash->bits; i++) {
+    fprintf(file, "mask %#lx\n", hash->masks[i]);
+  }
+
+  bool ok = !ferror(file);
+  ok &= fclose(file) == 0;
+
+  return ok;
+}
+
+// Read a hash saved by save_slice_hash, or return NULL if path cannot be read
+// or does not describe a power-of-two number of slices with one mask per
+// slice bit. Free it with free_slice_hash.
+SliceHash *load_slice_hash(const char *path) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    return NULL;
+  }
+
+  SliceHash *hash = calloc(1, sizeof(SliceHash));
+  char line[128];
+  char *name = NULL;
+  bool ok = true;
+
+  while (ok && fgets(line, sizeof(line), file) != NULL) {
+    line[strcspn(line, "\n")] = '\0';
+    if (strncmp(line, "name ", 5) == 0 && name == NULL) {
+      name = strdup(line + 5);
+    } else if (strncmp(line, "slices ", 7) == 0) {
+      ok = sscanf(line + 7, "%d", &hash->slices) == 1;
+    } else if (strncmp(line, "mask ", 5) == 0) {
+      ok = hash->bits < MAX_SLICE_BITS &&
+           sscanf(line + 5, "%lx", &hash->masks[hash->bits++]) == 1;
+    }
+  }
+  fclose(file);
+
+  ok &= hash->slices > 0 && hash->slices == 1 << hash->bits;
+  if (!ok) {
+    fprintf(stderr, "warning: %s is not a slice hash descriptor\n", path);
+    free(name);
+    free(hash);
+    return NULL;
+  }
+
+  hash->name = name != NULL ? name : strdup("unnamed");
+
+  return hash;
+}
+
+// Free a hash from load_slice_hash or recover_slice_hash
+void free_slice_hash(SliceHash *hash) {
+  free((char *)hash->name);
+  free(hash);
+}
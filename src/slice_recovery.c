@@ -0,0 +1,316 @@
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../lib/atlas.h"
+#include "../lib/constants.h"
+#include "../lib/eviction.h"
+#include "../lib/geometry.h"
+#include "../lib/slice.h"
+#include "../lib/slice_recovery.h"
+
+/*********************************************************************
+ * Congruence Classes
+ *********************************************************************/
+
+// Set classes[i] to the slice of the one entry of set in atlas that evicts
+// line i, or to -1 if none or several do. Returns the number classified.
+int classify_slice_lines(EvictionAtlas *atlas, int set, CacheLineSet *lines,
+                         int *classes) {
+  EvictionScratch *scratch =
+      new_eviction_scratch(2 * (atlas->geometry->ways + 1));
+  NumList *timings = new_num_list(SAMPLES);
+  int classified = 0;
+
+  for (int i = 0; i < lines->size; i++) {
+    uint8_t *line = (uint8_t *)lines->cache_lines[i];
+    int matches = 0;
+
+    classes[i] = -1;
+    for (int slice = 0; slice < atlas->slices; slice++) {
+      AtlasEntry *entry = atlas_entry(atlas, set, slice);
+      if (entry->lines != NULL &&
+          evicts_all(entry->lines, line, atlas->threshold, ATLAS_VERIFY_REPS,
+                     true, timings, scratch)) {
+        classes[i] = slice;
+        matches++;
+      }
+    }
+
+    if (matches != 1) {
+      classes[i] = -1;
+    } else {
+      classified++;
+    }
+  }
+
+  free_num_list(timings);
+  free_eviction_scratch(scratch);
+
+  return classified;
+}
+
+/*********************************************************************
+ * GF(2) Solver
+ *********************************************************************/
+
+// Add vector to a basis kept in reduced row echelon form, where row i is the
+// only row with bit pivots[i] set
+void gf2_insert(uint64_t *rows, int *pivots, int *rank, uint64_t vector) {
+  for (int i = 0; i < *rank; i++) {
+    if (vector >> pivots[i] & 1) {
+      vector ^= rows[i];
+    }
+  }
+  if (vector == 0) {
+    return;
+  }
+
+  int pivot = __builtin_ctzll(vector);
+  for (int i = 0; i < *rank; i++) {
+    if (rows[i] >> pivot & 1) {
+      rows[i] ^= vector;
+    }
+  }
+  rows[*rank] = vector;
+  pivots[*rank] = pivot;
+  (*rank)++;
+}
+
+// Find the masks over the bits in columns that are orthogonal to the address
+// difference of every two lines in the same class (classes[i] < 0 is
+// ignored). Writes up to max_masks basis vectors of that null space to masks
+// and returns its dimension.
+int solve_slice_masks(uintptr_t *pas, int *classes, int count,
+                      uint64_t columns, uint64_t *masks, int max_masks) {
+  uint64_t rows[64];
+  int pivots[64];
+  int rank = 0;
+  int num_classes = 0;
+
+  for (int i = 0; i < count; i++) {
+    num_classes = MAX(num_classes, classes[i] + 1);
+  }
+
+  int *first = malloc(MAX(num_classes, 1) * sizeof(int));
+  for (int c = 0; c < num_classes; c++) {
+    first[c] = -1;
+  }
+
+  for (int i = 0; i < count; i++) {
+    int c = classes[i];
+    if (c < 0) {
+      continue;
+    }
+    if (first[c] < 0) {
+      first[c] = i;
+    } else {
+      gf2_insert(rows, pivots, &rank, (pas[i] ^ pas[first[c]]) & columns);
+    }
+  }
+  free(first);
+
+  // One basis vector per free column, with the pivots that cancel it
+  uint64_t pivot_columns = 0;
+  for (int i = 0; i < rank; i++) {
+    pivot_columns |= (uint64_t)1 << pivots[i];
+  }
+
+  int dimension = 0;
+  uint64_t free_columns = columns & ~pivot_columns;
+  for (int column = 0; column < 64; column++) {
+    if (!(free_columns >> column & 1)) {
+      continue;
+    }
+
+    uint64_t mask = (uint64_t)1 << column;
+    for (int i = 0; i < rank; i++) {
+      if (rows[i] >> column & 1) {
+        mask |= (uint64_t)1 << pivots[i];
+      }
+    }
+    if (dimension < max_masks) {
+      masks[dimension] = mask;
+    }
+    dimension++;
+  }
+
+  return dimension;
+}
+
+/*********************************************************************
+ * Recovery
+ *********************************************************************/
+
+// Whether the masks give every class its own slice and every line the slice
+// of its class
+bool hash_separates_classes(SliceHash *hash, uintptr_t *pas, int *classes,
+                            int count) {
+  int *slices = malloc(count * sizeof(int));
+  int labels[1 << MAX_SLICE_BITS];
+  int owners[1 << MAX_SLICE_BITS];
+  bool ok = true;
+
+  for (int i = 0; i < hash->slices; i++) {
+    labels[i] = owners[i] = -1;
+  }
+
+  pas_to_slices(hash, pas, slices, count);
+  for (int i = 0; ok && i < count; i++) {
+    int c = classes[i];
+    if (c < 0) {
+      continue;
+    }
+    if (labels[c] < 0 && owners[slices[i]] < 0) {
+      labels[c] = slices[i];
+      owners[slices[i]] = c;
+    }
+    ok = labels[c] == slices[i] && owners[slices[i]] == c;
+  }
+
+  free(slices);
+
+  return ok;
+}
+
+// Warn about address bits below the top of physical memory that no line
+// varied, since frames this run never saw may set them
+void warn_unseen_bits(uint64_t columns, int index_bits) {
+  uint64_t memory = (uint64_t)sysconf(_SC_PHYS_PAGES) * PAGE_BYTES;
+  uint64_t unseen = 0;
+
+  for (int bit = index_bits; bit < 63 && (uint64_t)1 << bit < memory; bit++) {
+    unseen |= ~columns & (uint64_t)1 << bit;
+  }
+  if (unseen != 0) {
+    fprintf(stderr,
+            "warning: address bits %#lx never varied and are assumed not to "
+            "be hashed\n",
+            unseen);
+  }
+}
+
+// Classify lines with the eviction sets of set in atlas and solve for the
+// masks. Returns NULL if they do not determine a hash.
+SliceHash *solve_slice_hash(EvictionAtlas *atlas, int set,
+                            CacheLineSet *lines) {
+  CacheGeometry *geometry = atlas->geometry;
+  int bits = __builtin_ctz(geometry->slices);
+  uintptr_t *pas = malloc(lines->size * sizeof(uintptr_t));
+  int *classes = malloc(lines->size * sizeof(int));
+  SliceHash *hash = NULL;
+
+  bool translated = cl_set_to_pas(lines, pas) == lines->size;
+  for (int i = 0; translated && i < lines->size; i++) {
+    // Without CAP_SYS_ADMIN every frame number reads as 0
+    translated = pas[i] >> PAGE_OFFSET_BITS != 0;
+  }
+  if (!translated) {
+    fprintf(stderr, "error: slice hash recovery needs physical addresses\n");
+    free(classes);
+    free(pas);
+    return NULL;
+  }
+
+  int classified = classify_slice_lines(atlas, set, lines, classes);
+
+  uint64_t varied = 0;
+  for (int i = 0; i < lines->size; i++) {
+    varied |= pas[i] ^ pas[0];
+  }
+  int index_bits = geometry->line_bits + geometry->set_bits;
+  uint64_t columns = varied & ~(((uint64_t)1 << index_bits) - 1);
+
+  uint64_t masks[MAX_SLICE_BITS] = {0};
+  int dimension = solve_slice_masks(pas, classes, lines->size, columns, masks,
+                                    MAX_SLICE_BITS);
+
+  if (dimension == bits) {
+    hash = calloc(1, sizeof(SliceHash));
+    hash->name = strdup(geometry->name);
+    hash->slices = geometry->slices;
+    hash->bits = bits;
+    memcpy(hash->masks, masks, sizeof(masks));
+
+    if (!hash_separates_classes(hash, pas, classes, lines->size)) {
+      fprintf(stderr, "error: recovered masks do not separate the slices\n");
+      free_slice_hash(hash);
+      hash = NULL;
+    }
+  } else {
+    fprintf(stderr, "error: %d candidate masks for %d slice bits (%s)\n",
+            dimension, bits,
+            dimension > bits ? "too few lines or hugepages"
+                             : "misclassified lines or a non-linear hash");
+  }
+
+  if (hash != NULL) {
+    warn_unseen_bits(columns, index_bits);
+#ifndef __MEASURE__
+    printf("Recovered slice hash from %d/%d lines of set %d:\n", classified,
+           lines->size, set);
+    for (int i = 0; i < bits; i++) {
+      printf("  mask %#lx\n", hash->masks[i]);
+    }
+#endif
+  }
+
+  free(classes);
+  free(pas);
+
+  return hash;
+}
+
+// Recover the slice hash of this machine's LLC from set, classifying the lines
+// of set in hugepages hugepages. Needs physical addresses, so root. Returns
+// NULL if the hash is not linear or could not be determined; free it with
+// free_slice_hash.
+SliceHash *recover_slice_hash(CacheGeometry *geometry, int set,
+                              int hugepages) {
+  int bits = __builtin_ctz(geometry->slices);
+  if (geometry->slices != 1 << bits || bits > MAX_SLICE_BITS) {
+    fprintf(stderr, "error: %d slices do not have a linear hash\n",
+            geometry->slices);
+    return NULL;
+  }
+
+  EvictionAtlas *atlas = new_eviction_atlas(geometry, set);
+  if (atlas == NULL) {
+    return NULL;
+  }
+
+  // Find the slices by timing alone
+  SliceHash *known = slice_hash;
+  slice_hash = NULL;
+  int found = discover_atlas_set(atlas, set, ATLAS_VERIFIED);
+  slice_hash = known;
+
+  if (found < geometry->slices) {
+    fprintf(stderr, "error: found eviction sets for %d of %d slices\n", found,
+            geometry->slices);
+    free_eviction_atlas(atlas);
+    return NULL;
+  }
+
+  HugepagePool *pool = new_hugepage_pool(
+      (size_t)hugepages << geometry->hugepage_bits, geometry);
+  if (pool == NULL) {
+    free_eviction_atlas(atlas);
+    return NULL;
+  }
+
+  CacheLineSet *lines = new_cl_set();
+  hugepage_set_lines(lines, pool->start, pool->bytes, geometry, set,
+                     pool->bytes / geometry_set_stride(geometry));
+  SliceHash *hash = solve_slice_hash(atlas, set, lines);
+
+  free_cl_set(lines);
+  free_hugepage_pool(pool);
+  free_eviction_atlas(atlas);
+
+  return hash;
+}
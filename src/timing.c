@@ -0,0 +1,329 @@
+#define _GNU_SOURCE
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <x86intrin.h>
+
+#include "../lib/pipeline.h"
+#include "../lib/timing.h"
+#include "../lib/utils.h"
+
+#define INLINE static inline __attribute__((always_inline))
+
+Timer rdtscp_timer = {.backend = TIMER_RDTSCP, .perf_fd = -1};
+
+Timer *load_timer = &rdtscp_timer;
+
+const char *timer_backend_name(TimerBackend backend) {
+  switch (backend) {
+  case TIMER_RDTSCP:
+    return "rdtscp";
+  case TIMER_RDTSC_LFENCE:
+    return "rdtsc+lfence";
+  case TIMER_PERF:
+    return "perf_event";
+  case TIMER_COUNTING_THREAD:
+    return "counting thread";
+  default:
+    return "unknown";
+  }
+}
+
+/*********************************************************************
+ * Timed Regions
+ *
+ * Each region times work on victim: nothing (for calibration), a load, or a
+ * pointer chase through a list of CacheLines from victim. work is a constant
+ * at every call site, so the branch is compiled away.
+ *********************************************************************/
+
+typedef enum {
+  TIMED_NOTHING,
+  TIMED_LOAD,
+  TIMED_NEXT,
+  TIMED_PREVIOUS
+} TimedWork;
+
+// Load victim, or follow the next (first) or previous (second) pointer of
+// every line from victim until NULL
+INLINE void timed_work(volatile uint8_t *victim, TimedWork work) {
+  void *volatile *line = (void *volatile *)victim;
+
+  if (work == TIMED_LOAD) {
+    (void)*victim;
+  } else if (work == TIMED_NEXT) {
+    while (line != NULL) {
+      line = line[0];
+    }
+  } else if (work == TIMED_PREVIOUS) {
+    while (line != NULL) {
+      line = line[1];
+    }
+  }
+}
+
+INLINE uint64_t rdtscp_region(volatile uint8_t *victim, TimedWork work) {
+  unsigned int aux;
+  _mm_mfence();
+  uint64_t t0 = __rdtscp(&aux);
+  _mm_lfence();
+  timed_work(victim, work);
+  uint64_t t1 = __rdtscp(&aux);
+  _mm_lfence();
+
+  return t1 - t0;
+}
+
+INLINE uint64_t rdtsc_lfence_region(volatile uint8_t *victim,
+                                    TimedWork work) {
+  _mm_lfence();
+  uint64_t t0 = __rdtsc();
+  _mm_lfence();
+  timed_work(victim, work);
+  _mm_lfence();
+  uint64_t t1 = __rdtsc();
+
+  return t1 - t0;
+}
+
+INLINE uint64_t perf_read(Timer *timer) {
+  if (timer->perf_page != NULL) {
+    // The counter index can change when the event is rescheduled
+    uint32_t index = *(volatile uint32_t *)&timer->perf_page->index;
+    return __rdpmc(index - 1);
+  }
+
+  uint64_t count = 0;
+  if (read(timer->perf_fd, &count, sizeof(count)) != sizeof(count)) {
+    return 0;
+  }
+  return count;
+}
+
+INLINE uint64_t perf_region(Timer *timer, volatile uint8_t *victim,
+                            TimedWork work) {
+  _mm_lfence();
+  uint64_t t0 = perf_read(timer);
+  _mm_lfence();
+  timed_work(victim, work);
+  _mm_lfence();
+  uint64_t t1 = perf_read(timer);
+
+  return (t1 - t0) & timer->perf_mask;
+}
+
+INLINE uint64_t counting_region(Timer *timer, volatile uint8_t *victim,
+                                TimedWork work) {
+  _mm_mfence();
+  uint64_t t0 = __atomic_load_n(&timer->ticks, __ATOMIC_RELAXED);
+  _mm_lfence();
+  timed_work(victim, work);
+  _mm_lfence();
+  uint64_t t1 = __atomic_load_n(&timer->ticks, __ATOMIC_RELAXED);
+
+  return t1 - t0;
+}
+
+INLINE uint64_t timed_region(Timer *timer, volatile uint8_t *victim,
+                             TimedWork work) {
+  switch (timer->backend) {
+  case TIMER_RDTSC_LFENCE:
+    return rdtsc_lfence_region(victim, work);
+  case TIMER_PERF:
+    return perf_region(timer, victim, work);
+  case TIMER_COUNTING_THREAD:
+    return counting_region(timer, victim, work);
+  default:
+    return rdtscp_region(victim, work);
+  }
+}
+
+// Ticks to load victim, less the timer's overhead
+uint64_t timer_load(Timer *timer, volatile uint8_t *victim) {
+  uint64_t ticks = timed_region(timer, victim, TIMED_LOAD);
+  return ticks > timer->overhead ? ticks - timer->overhead : 0;
+}
+
+// Ticks to follow a list of CacheLines from start to its end, through the
+// next pointers or, if backward, the previous pointers, less the timer's
+// overhead
+uint64_t timer_traverse(Timer *timer, void *start, bool backward) {
+  uint64_t ticks =
+      backward ? timed_region(timer, start, TIMED_PREVIOUS)
+               : timed_region(timer, start, TIMED_NEXT);
+  return ticks > timer->overhead ? ticks - timer->overhead : 0;
+}
+
+/*********************************************************************
+ * Backends
+ *********************************************************************/
+
+// Open a user-space cycle counter for this thread. Returns false if
+// perf_event is unavailable (e.g. perf_event_paranoid or a VM without a PMU).
+bool open_perf_counter(Timer *timer) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.size = sizeof(attr);
+  attr.config = PERF_COUNT_HW_CPU_CYCLES;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+
+  timer->perf_fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+  if (timer->perf_fd < 0) {
+    perror("perf_event_open");
+    return false;
+  }
+
+  timer->perf_mask = ~(uint64_t)0;
+  void *page = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED,
+                    timer->perf_fd, 0);
+  if (page != MAP_FAILED) {
+    timer->perf_page = page;
+    if (!timer->perf_page->cap_user_rdpmc || timer->perf_page->index == 0) {
+      munmap(page, sysconf(_SC_PAGESIZE));
+      timer->perf_page = NULL;
+    } else if (timer->perf_page->pmc_width < 64) {
+      timer->perf_mask = ((uint64_t)1 << timer->perf_page->pmc_width) - 1;
+    }
+  }
+
+  return true;
+}
+
+void *count_ticks(void *arg) {
+  Timer *timer = arg;
+  uint64_t ticks = 0;
+
+  while (!__atomic_load_n(&timer->stop, __ATOMIC_RELAXED)) {
+    __atomic_store_n(&timer->ticks, ++ticks, __ATOMIC_RELAXED);
+  }
+
+  return NULL;
+}
+
+// Start the counting thread on another physical core if there is one, and
+// wait until it is counting
+bool start_counting_thread(Timer *timer) {
+  int cpu = pick_helper_cpu();
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  if (cpu >= 0) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+  } else {
+    fprintf(stderr, "warning: counting thread shares a core with the "
+                    "measurements\n");
+  }
+
+  int error = pthread_create(&timer->thread, &attr, count_ticks, timer);
+  pthread_attr_destroy(&attr);
+  if (error) {
+    fprintf(stderr, "error: could not start counting thread: %s\n",
+            strerror(error));
+    return false;
+  }
+
+  while (__atomic_load_n(&timer->ticks, __ATOMIC_RELAXED) == 0) {
+    sched_yield();
+  }
+
+  return true;
+}
+
+/*********************************************************************
+ * Timers
+ *********************************************************************/
+
+// Measure the overhead and resolution of timer
+void calibrate_timer(Timer *timer) {
+  NumList *samples = new_num_list(TIMER_CALIBRATION_SAMPLES);
+
+  for (int i = 0; i < TIMER_CALIBRATION_SAMPLES; i++) {
+    push_num(samples, timed_region(timer, NULL, TIMED_NOTHING));
+  }
+
+  timer->overhead = median_and_sort(samples);
+  timer->resolution = 0;
+  for (int i = 1; i < samples->length; i++) {
+    uint64_t step = samples->nums[i] - samples->nums[i - 1];
+    if (step != 0 && (timer->resolution == 0 || step < timer->resolution)) {
+      timer->resolution = step;
+    }
+  }
+
+  free_num_list(samples);
+}
+
+// Create and calibrate a timer with the given backend. Returns NULL if the
+// backend is not available on this host.
+Timer *new_timer(TimerBackend backend) {
+  Timer *timer = aligned_alloc(64, sizeof(Timer));
+  memset(timer, 0, sizeof(Timer));
+  timer->backend = backend;
+  timer->perf_fd = -1;
+
+  bool ok = true;
+  if (backend == TIMER_PERF) {
+    ok = open_perf_counter(timer);
+  } else if (backend == TIMER_COUNTING_THREAD) {
+    ok = start_counting_thread(timer);
+  }
+  if (!ok) {
+    free(timer);
+    return NULL;
+  }
+
+  calibrate_timer(timer);
+
+  return timer;
+}
+
+void free_timer(Timer *timer) {
+  if (timer == &rdtscp_timer) {
+    return;
+  }
+
+  if (timer->backend == TIMER_COUNTING_THREAD) {
+    __atomic_store_n(&timer->stop, true, __ATOMIC_RELAXED);
+    pthread_join(timer->thread, NULL);
+  }
+  if (timer->perf_page != NULL) {
+    munmap(timer->perf_page, sysconf(_SC_PAGESIZE));
+  }
+  if (timer->perf_fd >= 0) {
+    close(timer->perf_fd);
+  }
+  if (load_timer == timer) {
+    load_timer = &rdtscp_timer;
+  }
+  free(timer);
+}
+
+// TSC ticks per second, counted against CLOCK_MONOTONIC over
+// TSC_CALIBRATION_MS
+uint64_t measure_tsc_hz(void) {
+  struct timespec start, end;
+  struct timespec pause = {0, TSC_CALIBRATION_MS * 1000000};
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  uint64_t t0 = __rdtsc();
+  nanosleep(&pause, NULL);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  uint64_t t1 = __rdtsc();
+
+  double seconds =
+      (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  return (t1 - t0) / seconds;
+}
@@ -0,0 +1,209 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include <x86intrin.h>
+
+#include "../lib/geometry.h"
+#include "../lib/pipeline.h"
+#include "../lib/timing.h"
+#include "../lib/trace.h"
+
+/*********************************************************************
+ * Writer Thread
+ *********************************************************************/
+
+TraceHeader *trace_header(TraceWriter *trace) {
+  return (TraceHeader *)trace->map;
+}
+
+// Double the file until it has room for records more records. Returns false
+// if it cannot grow.
+bool grow_trace(TraceWriter *trace, uint64_t records) {
+  size_t needed = sizeof(TraceHeader) +
+                  (trace_header(trace)->records + records) * sizeof(uint64_t);
+  size_t bytes = trace->map_bytes;
+  while (bytes < needed) {
+    bytes *= 2;
+  }
+  if (bytes == trace->map_bytes) {
+    return true;
+  }
+
+  if (ftruncate(trace->fd, bytes) != 0) {
+    perror("ftruncate");
+    return false;
+  }
+  void *map = mremap(trace->map, trace->map_bytes, bytes, MREMAP_MAYMOVE);
+  if (map == MAP_FAILED) {
+    perror("mremap");
+    return false;
+  }
+  trace->map = map;
+  trace->map_bytes = bytes;
+
+  return true;
+}
+
+// Copy buffer to the end of the file and update the header
+void write_trace_buffer(TraceWriter *trace, TraceBuffer *buffer) {
+  if (!grow_trace(trace, buffer->length)) {
+    __atomic_add_fetch(&trace->dropped, buffer->length, __ATOMIC_RELAXED);
+  } else {
+    TraceHeader *header = trace_header(trace);
+    uint64_t *records = (uint64_t *)(header + 1);
+    memcpy(&records[header->records], buffer->records,
+           buffer->length * sizeof(uint64_t));
+    header->records += buffer->length;
+  }
+
+  trace_header(trace)->dropped =
+      __atomic_load_n(&trace->dropped, __ATOMIC_RELAXED);
+}
+
+void *trace_writer_thread(void *arg) {
+  TraceWriter *trace = arg;
+  struct timespec poll = {0, TRACE_POLL_MS * 1000000};
+  bool stopping = false;
+
+  while (!stopping) {
+    stopping = __atomic_load_n(&trace->stop, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < 2; i++) {
+      TraceBuffer *buffer = &trace->buffers[i];
+      if (__atomic_load_n(&buffer->full, __ATOMIC_ACQUIRE)) {
+        write_trace_buffer(trace, buffer);
+        buffer->length = 0;
+        __atomic_store_n(&buffer->full, false, __ATOMIC_RELEASE);
+      }
+    }
+    if (!stopping) {
+      nanosleep(&poll, NULL);
+    }
+  }
+
+  return NULL;
+}
+
+/*********************************************************************
+ * Trace Writer
+ *********************************************************************/
+
+// Create the trace file at path for a probe of set and slice with threshold,
+// and start its writer thread. Measures the TSC frequency, which takes
+// TSC_CALIBRATION_MS. Returns NULL if the file cannot be created.
+TraceWriter *open_trace_writer(const char *path, int set, int slice,
+                               uint64_t threshold) {
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    perror(path);
+    return NULL;
+  }
+
+  size_t bytes =
+      sizeof(TraceHeader) + (size_t)TRACE_INITIAL_RECORDS * sizeof(uint64_t);
+  void *map = MAP_FAILED;
+  if (ftruncate(fd, bytes) == 0) {
+    map = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  if (map == MAP_FAILED) {
+    perror("mmap");
+    close(fd);
+    return NULL;
+  }
+
+  TraceWriter *trace = calloc(1, sizeof(TraceWriter));
+  trace->fd = fd;
+  trace->map = map;
+  trace->map_bytes = bytes;
+
+  TraceHeader *header = trace_header(trace);
+  memcpy(header->magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+  header->version = TRACE_VERSION;
+  header->record_bytes = sizeof(uint64_t);
+  header->fingerprint = geometry_fingerprint(cache_geometry);
+  snprintf(header->cpu, sizeof(header->cpu), "%s", cache_geometry->name);
+  header->tsc_hz = measure_tsc_hz();
+  header->set = set;
+  header->slice = slice;
+  header->threshold = threshold;
+  header->created = time(NULL);
+  header->start_tsc = __rdtsc();
+
+  // Keep the writer off the probing core if there is another one
+  int cpu = pick_helper_cpu();
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  if (cpu >= 0) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+  }
+  int error = pthread_create(&trace->thread, &attr, trace_writer_thread, trace);
+  pthread_attr_destroy(&attr);
+  if (error) {
+    fprintf(stderr, "error: could not start trace writer: %s\n",
+            strerror(error));
+    munmap(trace->map, trace->map_bytes);
+    close(fd);
+    free(trace);
+    return NULL;
+  }
+
+  return trace;
+}
+
+// Hand the active buffer to the writer thread and switch to the other one,
+// unless the writer is still busy with it
+void swap_trace_buffers(TraceWriter *trace) {
+  TraceBuffer *buffer = &trace->buffers[trace->active];
+  TraceBuffer *other = &trace->buffers[!trace->active];
+
+  if (__atomic_load_n(&other->full, __ATOMIC_ACQUIRE)) {
+    __atomic_add_fetch(&trace->dropped, buffer->length, __ATOMIC_RELAXED);
+    buffer->length = 0;
+    return;
+  }
+
+  __atomic_store_n(&buffer->full, true, __ATOMIC_RELEASE);
+  trace->active = !trace->active;
+}
+
+void trace_append(TraceWriter *trace, uint64_t record) {
+  TraceBuffer *buffer = &trace->buffers[trace->active];
+  buffer->records[buffer->length++] = record;
+  if (buffer->length == TRACE_BUFFER_RECORDS) {
+    swap_trace_buffers(trace);
+  }
+}
+
+// Stop the writer thread, write the records still buffered and trim the file
+// to its records
+void close_trace_writer(TraceWriter *trace) {
+  __atomic_store_n(&trace->stop, true, __ATOMIC_RELEASE);
+  pthread_join(trace->thread, NULL);
+
+  // The writer thread has emptied every full buffer
+  write_trace_buffer(trace, &trace->buffers[trace->active]);
+
+  TraceHeader *header = trace_header(trace);
+  size_t bytes = sizeof(TraceHeader) + header->records * sizeof(uint64_t);
+  if (header->dropped != 0) {
+    fprintf(stderr, "warning: trace writer dropped %lu records\n",
+            header->dropped);
+  }
+  munmap(trace->map, trace->map_bytes);
+  if (ftruncate(trace->fd, bytes) != 0) {
+    perror("ftruncate");
+  }
+  close(trace->fd);
+  free(trace);
+}
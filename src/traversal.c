@@ -0,0 +1,298 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <x86intrin.h>
+
+#include "../lib/constants.h"
+#include "../lib/eviction.h"
+#include "../lib/memory.h"
+#include "../lib/traversal.h"
+#include "../lib/utils.h"
+
+// Loads that the compiler may neither drop nor merge
+#define NEXT(cl) (*(CacheLine *volatile *)&(cl)->next)
+#define PREVIOUS(cl) (*(CacheLine *volatile *)&(cl)->previous)
+#define TOUCH(cl) ((void)*(volatile uint8_t *)(cl))
+
+#define INLINE static inline __attribute__((always_inline))
+
+/*********************************************************************
+ * Generic Kernels
+ *
+ * ways is a compile-time constant in every specialized instantiation below.
+ * memory is NULL in all of them, so the loads are plain loads; otherwise
+ * every line is also loaded through the backend (see traverse_backend).
+ *********************************************************************/
+
+INLINE CacheLine *next_line(MemoryBackend *memory, CacheLine *cl) {
+  if (memory != NULL) {
+    memory->load(memory, (volatile uint8_t *)cl);
+  }
+  return NEXT(cl);
+}
+
+INLINE CacheLine *previous_line(MemoryBackend *memory, CacheLine *cl) {
+  if (memory != NULL) {
+    memory->load(memory, (volatile uint8_t *)cl);
+  }
+  return PREVIOUS(cl);
+}
+
+INLINE void touch_line(MemoryBackend *memory, CacheLine *cl) {
+  if (memory != NULL) {
+    memory->load(memory, (volatile uint8_t *)cl);
+  } else {
+    TOUCH(cl);
+  }
+}
+
+INLINE void zigzag(EvictionSet *es, MemoryBackend *memory, int ways,
+                   int repeats) {
+  int lag = ways / 2;
+
+  for (int r = 0; r < repeats; r++) {
+    // Forwards dual-chasing, lagging lags lag cache lines behind iter
+    CacheLine *iter = es->head;
+    CacheLine *lagging = es->head;
+    for (int j = 0; j < lag && iter != NULL; j++) {
+      iter = next_line(memory, iter);
+    }
+    while (lagging != NULL) {
+      if (iter != NULL) {
+        iter = next_line(memory, iter);
+      }
+      lagging = next_line(memory, lagging);
+    }
+
+    // Repeat the same pattern but in reverse
+    iter = es->tail;
+    lagging = es->tail;
+    for (int j = 0; j < lag && iter != NULL; j++) {
+      iter = previous_line(memory, iter);
+    }
+    while (lagging != NULL) {
+      if (iter != NULL) {
+        iter = previous_line(memory, iter);
+      }
+      lagging = previous_line(memory, lagging);
+    }
+  }
+}
+
+INLINE void sliding_window(EvictionSet *es, MemoryBackend *memory, int ways,
+                           int overlap, int repeats) {
+  int stride = MAX(ways - overlap, 1);
+  CacheLine *window = es->head;
+
+  while (window != NULL) {
+    for (int r = 0; r < repeats; r++) {
+      CacheLine *iter = window;
+      for (int j = 0; j < ways && iter != NULL; j++) {
+        iter = next_line(memory, iter);
+      }
+    }
+    for (int j = 0; j < stride && window != NULL; j++) {
+      window = next_line(memory, window);
+    }
+  }
+}
+
+INLINE void multi_chain(EvictionSet *es, MemoryBackend *memory, int chains,
+                        int repeats) {
+  CacheLine **lines = es->cache_lines->cache_lines;
+  int size = es->size;
+  chains = MAX(MIN(chains, MIN(MAX_CHAINS, size)), 1);
+  int length = (size + chains - 1) / chains;
+
+  for (int r = 0; r < repeats; r++) {
+    CacheLine *iters[MAX_CHAINS];
+    int lengths[MAX_CHAINS];
+    for (int c = 0; c < chains; c++) {
+      int start = MIN(c * length, size);
+      iters[c] = start < size ? lines[start] : NULL;
+      lengths[c] = MIN(start + length, size) - start;
+    }
+
+    for (int j = 0; j < length; j++) {
+      for (int c = 0; c < chains; c++) {
+        if (j < lengths[c]) {
+          touch_line(memory, iters[c]);
+          if (j + 1 < lengths[c]) {
+            iters[c] = next_line(memory, iters[c]);
+          }
+        }
+      }
+    }
+  }
+}
+
+INLINE void independent(EvictionSet *es, MemoryBackend *memory, int repeats) {
+  CacheLine **lines = es->cache_lines->cache_lines;
+  int size = es->size;
+
+  for (int r = 0; r < repeats; r++) {
+    for (int j = 0; j < size; j++) {
+      touch_line(memory, lines[j]);
+    }
+    for (int j = size - 1; j >= 0; j--) {
+      touch_line(memory, lines[j]);
+    }
+  }
+}
+
+/*********************************************************************
+ * Specialized Kernels
+ *
+ * Only the patterns that read ways are specialized; multi_chain and
+ * independent would compile to the generic kernel.
+ *********************************************************************/
+
+#define DEFINE_TRAVERSAL_KERNELS(WAYS)                                         \
+  void zigzag_##WAYS(EvictionSet *es, TraversalConfig *config) {               \
+    zigzag(es, NULL, WAYS, config->repeats);                                   \
+  }                                                                            \
+  void sliding_window_##WAYS(EvictionSet *es, TraversalConfig *config) {       \
+    sliding_window(es, NULL, WAYS, config->overlap, config->repeats);          \
+  }
+
+DEFINE_TRAVERSAL_KERNELS(12)
+DEFINE_TRAVERSAL_KERNELS(16)
+
+void zigzag_generic(EvictionSet *es, TraversalConfig *config) {
+  zigzag(es, NULL, config->ways, config->repeats);
+}
+
+void sliding_window_generic(EvictionSet *es, TraversalConfig *config) {
+  sliding_window(es, NULL, config->ways, config->overlap, config->repeats);
+}
+
+void multi_chain_generic(EvictionSet *es, TraversalConfig *config) {
+  multi_chain(es, NULL, config->chains, config->repeats);
+}
+
+void independent_generic(EvictionSet *es, TraversalConfig *config) {
+  independent(es, NULL, config->repeats);
+}
+
+// Run the pattern of config with every load made through memory, for
+// backends that model the cache rather than load from it
+void traverse_backend(MemoryBackend *memory, EvictionSet *es,
+                      TraversalConfig *config) {
+  switch (config->pattern) {
+  case TRAVERSE_SLIDING_WINDOW:
+    sliding_window(es, memory, config->ways, config->overlap, config->repeats);
+    break;
+  case TRAVERSE_MULTI_CHAIN:
+    multi_chain(es, memory, config->chains, config->repeats);
+    break;
+  case TRAVERSE_INDEPENDENT:
+    independent(es, memory, config->repeats);
+    break;
+  default:
+    zigzag(es, memory, config->ways, config->repeats);
+  }
+}
+
+/*********************************************************************
+ * Dispatch
+ *********************************************************************/
+
+TraversalConfig traversal_config = {TRAVERSE_ZIGZAG, EVERGLADES_ASSOCIATIVITY,
+                                    0, 2, 4};
+TraversalKernel traversal_kernel = zigzag_16;
+
+const char *traversal_pattern_name(TraversalPattern pattern) {
+  switch (pattern) {
+  case TRAVERSE_ZIGZAG:
+    return "zigzag";
+  case TRAVERSE_SLIDING_WINDOW:
+    return "sliding_window";
+  case TRAVERSE_MULTI_CHAIN:
+    return "multi_chain";
+  case TRAVERSE_INDEPENDENT:
+    return "independent";
+  default:
+    return "unknown";
+  }
+}
+
+// Return the kernel for a pattern, specialized for ways if there is one
+TraversalKernel select_traversal_kernel(TraversalPattern pattern, int ways) {
+  TraversalKernel kernels[][3] = {
+      {zigzag_12, zigzag_16, zigzag_generic},
+      {sliding_window_12, sliding_window_16, sliding_window_generic},
+      {multi_chain_generic, multi_chain_generic, multi_chain_generic},
+      {independent_generic, independent_generic, independent_generic},
+  };
+  int variant = (ways == 12) ? 0 : (ways == 16) ? 1 : 2;
+
+  return kernels[pattern][variant];
+}
+
+// Make access_set use the given traversal
+void use_traversal(TraversalConfig config) {
+  traversal_config = config;
+  traversal_kernel = select_traversal_kernel(config.pattern, config.ways);
+}
+
+// Keep the traversal pattern, but for an LLC of ways ways
+void use_traversal_ways(int ways) {
+  TraversalConfig config = traversal_config;
+  config.ways = ways;
+  use_traversal(config);
+}
+
+/*********************************************************************
+ * Profiling
+ *********************************************************************/
+
+// For every pattern, report the median cycles per traversal of cl_set and how
+// often a traversal evicts the victim. Uses the overlap, repeats and chains
+// of traversal_config. Loads and cycles go through memory_backend, so with a
+// simulated cache the kernels are profiled on the simulation.
+void profile_traversal_kernels(CacheLineSet *cl_set, uint8_t *victim,
+                               uint64_t threshold) {
+  // Shuffled for every sample, leaving the caller's order alone
+  CacheLineSet *lines = new_cl_set();
+  reserve_cl_set(lines, cl_set->size);
+  for (int i = 0; i < cl_set->size; i++) {
+    push_cache_line(lines, cl_set->cache_lines[i]);
+  }
+  EvictionSet *es = new_eviction_set(lines);
+  NumList *cycles = new_num_list(SAMPLES);
+  TraversalConfig config = traversal_config;
+
+  printf("%-16s %12s %10s\n", "pattern", "cycles", "evictions");
+  for (int p = 0; p < NUM_TRAVERSAL_PATTERNS; p++) {
+    config.pattern = p;
+    TraversalKernel kernel = select_traversal_kernel(p, config.ways);
+    int evictions = 0;
+    clear_num_list(cycles);
+
+    for (int i = 0; i < SAMPLES; i++) {
+      shuffle_lines(lines);
+      link_eviction_set(es, lines);
+
+      load_line(victim);
+      uint64_t t0 = memory_backend->cycles(memory_backend);
+      if (memory_backend == &hardware_memory) {
+        kernel(es, &config);
+      } else {
+        traverse_backend(memory_backend, es, &config);
+      }
+      uint64_t t1 = memory_backend->cycles(memory_backend);
+      push_num(cycles, t1 - t0);
+
+      if (time_load(victim) >= threshold) {
+        evictions++;
+      }
+    }
+
+    printf("%-16s %12lu %6u/%u\n", traversal_pattern_name(p),
+           median_and_sort(cycles), evictions, SAMPLES);
+  }
+
+  free_num_list(cycles);
+  free(es);
+  free_cl_set(lines);
+}
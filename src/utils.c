@@ -1,10 +1,10 @@
 #define _GNU_SOURCE
-#include <math.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/mman.h>
 
+#include "../lib/histogram.h"
 #include "../lib/utils.h"
 
 /*********************************************************************
@@ -159,38 +159,17 @@ uint64_t has_greater_than(NumList *nl, int threshold) {
   return 0;
 }
 
+// Print the statistics of nl from a histogram fine enough to hold its maximum,
+// and return the median
 uint64_t print_stats(NumList *nl) {
-  uint64_t median = median_and_sort(nl);
-  double mean = 0;
+  LatencyHistogram *h = new_latency_histogram(histogram_shift_for(max(nl)));
+  histogram_insert_num_list(h, nl);
+  print_histogram_stats(h);
 
-  for (int i = 0; i < nl->length; i++) {
-    mean += nl->nums[i];
-  }
-
-  mean /= nl->length;
-
-  double sd = 0;
-  uint64_t minimum = nl->nums[0];
-  uint64_t maximum = nl->nums[0];
-
-  for (int i = 0; i < nl->length; i++) {
-    sd += pow(nl->nums[i] - mean, 2);
-    if (nl->nums[i] < minimum) {
-      minimum = nl->nums[i];
-    }
-
-    if (nl->nums[i] > maximum) {
-      maximum = nl->nums[i];
-    }
-  }
-
-  sd /= (nl->length - 1);
-
-  sd = sqrt(sd);
+  uint64_t median = histogram_median(h);
+  free_latency_histogram(h);
 
-  printf("Median: %lu Mean: %.2f Standard deviation: %.2f Minimum: %lu "
-         "Maximum: %lu\n",
-         median, mean, sd, minimum, maximum);
+  return median;
 }
 
 int get_bit(uint64_t value, int n) { return (value >> n) & 0x1; }
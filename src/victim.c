@@ -8,10 +8,11 @@
 #include <x86intrin.h>
 
 #include "../lib/constants.h"
+#include "../lib/covert.h"
 #include "../lib/eviction.h"
 #include "../lib/l3pp.h"
-
-#define TRANSMIT_INTERVAL 6000
+#include "../lib/sender.h"
+#include "../lib/slice.h"
 
 uint8_t *target;
 
@@ -19,47 +20,32 @@ unsigned int core_id = 0;
 
 void handle_sigint(int sig) { free(target); }
 
-void send(int bit) {
-  uint64_t start_time = __rdtscp(&core_id);
-  if (bit) {
-    while (__rdtscp(&core_id) - start_time < 10000) {
-      *(volatile uint8_t *)target;
-    }
-  } else {
-    while (__rdtscp(&core_id) - start_time < 10000)
-      ;
-  }
-}
-
-void send_byte(uint8_t byte) {
-  for (int i = 0; i < 8; i++) {
-    send(byte & 0x1);
-    byte >>= 1;
-  }
-}
-
-int main() {
-  void *mapping_start = mmap(NULL, EVERGLADES_LLC_SIZE, PROT_READ,
-                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+int main(int argc, char **argv) {
+  init_cache_geometry();
+  init_slice_hash(cache_geometry);
+  void *mapping_start =
+      mmap(NULL, geometry_llc_bytes(cache_geometry), PROT_READ,
+           MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
   printf("%p\n", (void *)mapping_start);
 
-  CacheLineSet *cl_set = hugepage_inflate(mapping_start, 16, 428);
+  CacheLineSet *cl_set = hugepage_inflate(mapping_start, cache_geometry->ways,
+                                          COVERT_SET, cache_geometry);
   printf("%p\n", cl_set->cache_lines[0]);
 
   volatile uint8_t tmp = *(volatile uint8_t *)mapping_start;
 
-  printf("%d\n", get_i7_2600_slice(KBD_KEYCODE_ADDR));
-
-  uint64_t start_time = 0;
-  while (1) {
-    tmp = *(volatile uint8_t *)cl_set->cache_lines[0];
-    start_time = __rdtscp(&core_id);
-    while (__rdtscp(&core_id) - start_time < 20000)
-      ;
+  if (slice_hash != NULL) {
+    printf("%d\n", pa_to_slice(slice_hash, KBD_KEYCODE_ADDR));
+  }
 
-    tmp = *(volatile uint8_t *)cl_set->cache_lines[0];
-    start_time = __rdtscp(&core_id);
-    while (__rdtscp(&core_id) - start_time < 40000)
-      ;
+  uint64_t symbol_cycles;
+  bool fec, sweep;
+  if (parse_covert_args(argc, argv, &symbol_cycles, &fec, &sweep)) {
+    covert_send_epochs((uint8_t *)cl_set->cache_lines[0], symbol_cycles, fec,
+                       sweep);
+    return 0;
   }
+
+  Sender sender = {.target = (uint8_t *)cl_set->cache_lines[0]};
+  run_sender(&sender);
 }